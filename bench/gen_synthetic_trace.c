@@ -0,0 +1,313 @@
+// Copyright Hewlett Packard Enterprise Development LP.
+
+// Synthetic OTF2 trace generator for the benchmarks
+//
+// Writes an archive with the shape of a Score-P trace: processes with
+// threads, nested Enter/Leave regions and a metric sampled at a fixed rate,
+// so the readers can be timed without access to real traces. The output is
+// fully determined by the options (including the seed).
+//
+// Compile with gcc -O2 -o gen_synthetic_trace gen_synthetic_trace.c -I/opt/otf2/include -L/opt/otf2/lib -lotf2 -lm
+//
+// Usage: gen_synthetic_trace -o <dir> [-p processes] [-t threads] [-e events]
+//                            [-d depth] [-r regions] [-m metric_every]
+//                            [-s skew] [-S seed]
+//   -e  Enter/Leave events per location on average
+//   -d  maximum call stack depth
+//   -m  one metric sample every this many Enter/Leave events (0 = none)
+//   -s  location i gets a share of the events proportional to (i+1)^-skew,
+//       0 gives every location the same number
+//
+// Besides <dir>/traces.otf2 it writes <dir>/synthetic.meta, KEY=value lines
+// describing what was generated (read by run_bench.sh).
+
+#include <otf2/otf2.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#define TIMER_RESOLUTION 1000000000ULL
+#define GLOBAL_OFFSET    1700000000000000000ULL
+
+// String refs: 0 is the empty string, then fixed names, then region names
+enum {
+    STR_EMPTY = 0,
+    STR_MACHINE,
+    STR_NODE,
+    STR_METRIC,
+    STR_METRIC_UNIT,
+    STR_FIRST_DYNAMIC
+};
+
+typedef struct {
+    const char* output_dir;
+    uint64_t processes;
+    uint64_t threads;
+    uint64_t events;
+    uint32_t depth;
+    uint32_t regions;
+    uint64_t metric_every;
+    double skew;
+    uint64_t seed;
+} Options;
+
+static OTF2_FlushType pre_flush(void* user_data, OTF2_FileType file_type,
+                                OTF2_LocationRef location, void* caller_data,
+                                bool final) {
+    return OTF2_FLUSH;
+}
+
+static OTF2_TimeStamp post_flush(void* user_data, OTF2_FileType file_type,
+                                 OTF2_LocationRef location) {
+    return 0;
+}
+
+static OTF2_FlushCallbacks flush_callbacks = {
+    .otf2_pre_flush = pre_flush,
+    .otf2_post_flush = post_flush
+};
+
+// xorshift64*, so traces are identical across platforms for a given seed
+static uint64_t next_random(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 2685821657736338717ULL;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s -o <dir> [-p processes] [-t threads] [-e events] [-d depth]\n"
+            "          [-r regions] [-m metric_every] [-s skew] [-S seed]\n", prog);
+}
+
+static int parse_options(int argc, char** argv, Options* opts) {
+    opts->output_dir = NULL;
+    opts->processes = 4;
+    opts->threads = 4;
+    opts->events = 100000;
+    opts->depth = 8;
+    opts->regions = 64;
+    opts->metric_every = 100;
+    opts->skew = 0.0;
+    opts->seed = 42;
+
+    int c;
+    while ((c = getopt(argc, argv, "o:p:t:e:d:r:m:s:S:h")) != -1) {
+        switch (c) {
+            case 'o': opts->output_dir = optarg; break;
+            case 'p': opts->processes = strtoull(optarg, NULL, 10); break;
+            case 't': opts->threads = strtoull(optarg, NULL, 10); break;
+            case 'e': opts->events = strtoull(optarg, NULL, 10); break;
+            case 'd': opts->depth = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 'r': opts->regions = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 'm': opts->metric_every = strtoull(optarg, NULL, 10); break;
+            case 's': opts->skew = strtod(optarg, NULL); break;
+            case 'S': opts->seed = strtoull(optarg, NULL, 10); break;
+            default: return -1;
+        }
+    }
+    if (!opts->output_dir || opts->processes == 0 || opts->threads == 0 ||
+        opts->depth == 0 || opts->regions == 0 || opts->skew < 0.0) {
+        return -1;
+    }
+    if (opts->seed == 0) opts->seed = 1; // xorshift must not start at 0
+    return 0;
+}
+
+// Enter/Leave events of each location. The shares follow (i+1)^-skew and
+// are scaled so the total stays locations * events; every count is even
+// and at least 2 * depth so stacks can be unwound.
+static uint64_t* event_counts(const Options* opts, uint64_t num_locations) {
+    uint64_t* counts = malloc(num_locations * sizeof(uint64_t));
+    double total_weight = 0.0;
+    for (uint64_t i = 0; i < num_locations; i++) {
+        total_weight += pow((double)(i + 1), -opts->skew);
+    }
+    const double total_events = (double)opts->events * (double)num_locations;
+    for (uint64_t i = 0; i < num_locations; i++) {
+        uint64_t n = (uint64_t)(total_events * pow((double)(i + 1), -opts->skew) / total_weight);
+        n &= ~1ULL;
+        if (n < 2ULL * opts->depth) n = 2ULL * opts->depth;
+        counts[i] = n;
+    }
+    return counts;
+}
+
+// Write the events of one location: a random walk over the call stack that
+// ends with every region left. Returns the number of events written and
+// stores the timestamp of the last one in last_time.
+static uint64_t write_location(OTF2_EvtWriter* writer, const Options* opts,
+                               uint64_t location, uint64_t enter_leave_events,
+                               OTF2_TimeStamp* last_time) {
+    uint64_t rng = opts->seed ^ (0x9E3779B97F4A7C15ULL * (location + 1));
+    OTF2_RegionRef stack[opts->depth];
+    uint32_t depth = 0;
+    OTF2_TimeStamp time = GLOBAL_OFFSET;
+    uint64_t written = 0;
+    const OTF2_Type metric_type = OTF2_TYPE_DOUBLE;
+
+    for (uint64_t i = 0; i < enter_leave_events; i++) {
+        // 50 to 1050 ns between events
+        time += 50 + next_random(&rng) % 1000;
+        const uint64_t remaining = enter_leave_events - i;
+        // Leave when the stack is full or the rest is needed to unwind it
+        const int leave = depth > 0 &&
+            (depth == opts->depth || remaining <= depth || next_random(&rng) % 2 == 0);
+        if (leave) {
+            depth--;
+            OTF2_EvtWriter_Leave(writer, NULL, time, stack[depth]);
+        } else {
+            const OTF2_RegionRef region = (OTF2_RegionRef)(next_random(&rng) % opts->regions);
+            stack[depth++] = region;
+            OTF2_EvtWriter_Enter(writer, NULL, time, region);
+        }
+        written++;
+
+        if (opts->metric_every > 0 && (i + 1) % opts->metric_every == 0) {
+            OTF2_MetricValue value;
+            value.floating_point = 100.0 + (double)(next_random(&rng) % 10000) / 100.0;
+            OTF2_EvtWriter_Metric(writer, NULL, time, 0, 1, &metric_type, &value);
+            written++;
+        }
+    }
+    *last_time = time;
+    return written;
+}
+
+static void write_global_definitions(OTF2_Archive* archive, const Options* opts,
+                                     const uint64_t* events_per_location,
+                                     OTF2_TimeStamp trace_length) {
+    OTF2_GlobalDefWriter* defs = OTF2_Archive_GetGlobalDefWriter(archive);
+    const uint64_t num_locations = opts->processes * opts->threads;
+    char name[64];
+
+    OTF2_GlobalDefWriter_WriteClockProperties(defs, TIMER_RESOLUTION, GLOBAL_OFFSET,
+                                              trace_length, OTF2_UNDEFINED_TIMESTAMP);
+
+    OTF2_GlobalDefWriter_WriteString(defs, STR_EMPTY, "");
+    OTF2_GlobalDefWriter_WriteString(defs, STR_MACHINE, "synthetic");
+    OTF2_GlobalDefWriter_WriteString(defs, STR_NODE, "node");
+    OTF2_GlobalDefWriter_WriteString(defs, STR_METRIC, "synthetic_power");
+    OTF2_GlobalDefWriter_WriteString(defs, STR_METRIC_UNIT, "W");
+    OTF2_StringRef next_string = STR_FIRST_DYNAMIC;
+
+    for (uint32_t r = 0; r < opts->regions; r++) {
+        snprintf(name, sizeof(name), "region_%u", r);
+        OTF2_GlobalDefWriter_WriteString(defs, next_string, name);
+        OTF2_GlobalDefWriter_WriteRegion(defs, r, next_string, next_string, STR_EMPTY,
+                                         OTF2_REGION_ROLE_FUNCTION, OTF2_PARADIGM_USER,
+                                         OTF2_REGION_FLAG_NONE, STR_EMPTY, 0, 0);
+        next_string++;
+    }
+
+    OTF2_GlobalDefWriter_WriteSystemTreeNode(defs, 0, STR_MACHINE, STR_NODE,
+                                             OTF2_UNDEFINED_SYSTEM_TREE_NODE);
+
+    for (uint64_t p = 0; p < opts->processes; p++) {
+        snprintf(name, sizeof(name), "Rank %" PRIu64, p);
+        OTF2_GlobalDefWriter_WriteString(defs, next_string, name);
+        OTF2_GlobalDefWriter_WriteLocationGroup(defs, (OTF2_LocationGroupRef)p, next_string,
+                                                OTF2_LOCATION_GROUP_TYPE_PROCESS, 0,
+                                                OTF2_UNDEFINED_LOCATION_GROUP);
+        next_string++;
+    }
+
+    for (uint64_t l = 0; l < num_locations; l++) {
+        snprintf(name, sizeof(name), "Thread %" PRIu64, l % opts->threads);
+        OTF2_GlobalDefWriter_WriteString(defs, next_string, name);
+        OTF2_GlobalDefWriter_WriteLocation(defs, l, next_string, OTF2_LOCATION_TYPE_CPU_THREAD,
+                                           events_per_location[l],
+                                           (OTF2_LocationGroupRef)(l / opts->threads));
+        next_string++;
+    }
+
+    if (opts->metric_every > 0) {
+        const OTF2_MetricMemberRef member = 0;
+        OTF2_GlobalDefWriter_WriteMetricMember(defs, member, STR_METRIC, STR_EMPTY,
+                                               OTF2_METRIC_TYPE_OTHER, OTF2_METRIC_ABSOLUTE_POINT,
+                                               OTF2_TYPE_DOUBLE, OTF2_BASE_DECIMAL, 0,
+                                               STR_METRIC_UNIT);
+        OTF2_GlobalDefWriter_WriteMetricClass(defs, 0, 1, &member,
+                                              OTF2_METRIC_SYNCHRONOUS_STRICT,
+                                              OTF2_RECORDER_KIND_ABSTRACT);
+    }
+}
+
+int main(int argc, char** argv) {
+    Options opts;
+    if (parse_options(argc, argv, &opts) != 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const uint64_t num_locations = opts.processes * opts.threads;
+    uint64_t* enter_leave = event_counts(&opts, num_locations);
+
+    OTF2_Archive* archive = OTF2_Archive_Open(opts.output_dir, "traces", OTF2_FILEMODE_WRITE,
+                                              1024 * 1024, 4 * 1024 * 1024,
+                                              OTF2_SUBSTRATE_POSIX, OTF2_COMPRESSION_NONE);
+    if (!archive) {
+        fprintf(stderr, "Failed to create OTF2 archive in %s\n", opts.output_dir);
+        return EXIT_FAILURE;
+    }
+    OTF2_Archive_SetFlushCallbacks(archive, &flush_callbacks, NULL);
+    OTF2_Archive_SetSerialCollectiveCallbacks(archive);
+
+    // Events first, the location definitions need the event counts
+    uint64_t* written = malloc(num_locations * sizeof(uint64_t));
+    uint64_t total_events = 0;
+    uint64_t total_enter_leave = 0;
+    OTF2_TimeStamp end_time = GLOBAL_OFFSET;
+    OTF2_Archive_OpenEvtFiles(archive);
+    for (uint64_t l = 0; l < num_locations; l++) {
+        OTF2_EvtWriter* writer = OTF2_Archive_GetEvtWriter(archive, l);
+        OTF2_TimeStamp last_time;
+        written[l] = write_location(writer, &opts, l, enter_leave[l], &last_time);
+        if (last_time > end_time) end_time = last_time;
+        total_events += written[l];
+        total_enter_leave += enter_leave[l];
+        OTF2_Archive_CloseEvtWriter(archive, writer);
+    }
+    OTF2_Archive_CloseEvtFiles(archive);
+
+    // Empty local definitions, as Score-P writes one file per location
+    OTF2_Archive_OpenDefFiles(archive);
+    for (uint64_t l = 0; l < num_locations; l++) {
+        OTF2_DefWriter* def_writer = OTF2_Archive_GetDefWriter(archive, l);
+        OTF2_Archive_CloseDefWriter(archive, def_writer);
+    }
+    OTF2_Archive_CloseDefFiles(archive);
+
+    write_global_definitions(archive, &opts, written, end_time - GLOBAL_OFFSET + 1);
+    OTF2_Archive_Close(archive);
+
+    char meta_path[4096];
+    snprintf(meta_path, sizeof(meta_path), "%s/synthetic.meta", opts.output_dir);
+    FILE* meta = fopen(meta_path, "w");
+    if (!meta) {
+        fprintf(stderr, "Failed to write %s\n", meta_path);
+        return EXIT_FAILURE;
+    }
+    fprintf(meta, "PROCESSES=%" PRIu64 "\n", opts.processes);
+    fprintf(meta, "THREADS=%" PRIu64 "\n", opts.threads);
+    fprintf(meta, "LOCATIONS=%" PRIu64 "\n", num_locations);
+    fprintf(meta, "DEPTH=%u\n", opts.depth);
+    fprintf(meta, "REGIONS=%u\n", opts.regions);
+    fprintf(meta, "METRIC_EVERY=%" PRIu64 "\n", opts.metric_every);
+    fprintf(meta, "SKEW=%g\n", opts.skew);
+    fprintf(meta, "SEED=%" PRIu64 "\n", opts.seed);
+    fprintf(meta, "ENTER_LEAVE_EVENTS=%" PRIu64 "\n", total_enter_leave);
+    fprintf(meta, "EVENTS=%" PRIu64 "\n", total_events);
+    fclose(meta);
+
+    printf("Wrote %" PRIu64 " events on %" PRIu64 " locations to %s/traces.otf2\n",
+           total_events, num_locations, opts.output_dir);
+    free(enter_leave);
+    free(written);
+    return EXIT_SUCCESS;
+}
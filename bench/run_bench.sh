@@ -0,0 +1,94 @@
+#!/usr/bin/env bash
+# Copyright Hewlett Packard Enterprise Development LP.
+
+# Times every reader on the given synthetic traces and prints one CSV row per
+# run: program, trace, seconds, events_per_sec, bytes_per_sec, peak_rss_kb
+#
+# Usage: ./run_bench.sh traces/small traces/large > results.csv
+#
+# Each argument is a directory written by gen_synthetic_trace; its event count
+# is taken from synthetic.meta and its size from the files on disk. Programs
+# that have not been built are skipped with a note on stderr. Set REPEAT to
+# run each program several times (one row per run) and NUMLOCALES for the
+# distributed variants.
+
+set -u
+
+BENCH_DIR="$(cd "$(dirname "$0")" && pwd)"
+CHPL_DIR="$BENCH_DIR/../chpl"
+REPEAT="${REPEAT:-1}"
+NUMLOCALES="${NUMLOCALES:-1}"
+TIME=/usr/bin/time
+
+if [ ! -x "$TIME" ]; then
+    echo "GNU time is required at $TIME" >&2
+    exit 1
+fi
+
+if [ "$#" -eq 0 ]; then
+    echo "Usage: $0 <trace dir>..." >&2
+    exit 1
+fi
+
+# run <name> <trace dir> <events> <bytes> <command...>
+run() {
+    local name="$1" trace_dir="$2" events="$3" bytes="$4"
+    shift 4
+    if [ ! -x "$1" ]; then
+        echo "Skipping $name: $1 not built" >&2
+        return
+    fi
+    local out_dir
+    out_dir="$(mktemp -d)"
+    for _ in $(seq "$REPEAT"); do
+        local stats
+        # The program's own output goes to its log, only the timing is kept
+        if ! (cd "$out_dir" && "$TIME" -f "%e %M" -o "$out_dir/time" "$@" > "$out_dir/log" 2>&1); then
+            echo "Run of $name on $trace_dir failed, see below" >&2
+            tail -n 20 "$out_dir/log" >&2
+            continue
+        fi
+        stats="$(tail -n 1 "$out_dir/time")"
+        awk -v name="$name" -v trace="$(basename "$trace_dir")" -v events="$events" \
+            -v bytes="$bytes" -v stats="$stats" 'BEGIN {
+            split(stats, s, " ");
+            seconds = s[1] > 0 ? s[1] : 0.01;  # GNU time reports 10 ms steps
+            printf "%s,%s,%.2f,%.0f,%.0f,%d\n", name, trace, s[1],
+                   events / seconds, bytes / seconds, s[2];
+        }'
+    done
+    rm -rf "$out_dir"
+}
+
+echo "program,trace,seconds,events_per_sec,bytes_per_sec,peak_rss_kb"
+
+for trace_dir in "$@"; do
+    trace_dir="$(cd "$trace_dir" && pwd)"
+    trace="$trace_dir/traces.otf2"
+    meta="$trace_dir/synthetic.meta"
+    if [ ! -f "$trace" ] || [ ! -f "$meta" ]; then
+        echo "Skipping $trace_dir: not a synthetic trace directory" >&2
+        continue
+    fi
+    events="$(sed -n 's/^EVENTS=//p' "$meta")"
+    bytes="$(du -sb --exclude=synthetic.meta "$trace_dir" | cut -f1)"
+
+    run c_read_events "$trace_dir" "$events" "$bytes" \
+        "$BENCH_DIR/build/otf2_read_events" "$trace"
+    run c_read_events_hash "$trace_dir" "$events" "$bytes" \
+        "$BENCH_DIR/build/otf2_read_events_hash" "$trace"
+
+    run chpl_read_events "$trace_dir" "$events" "$bytes" \
+        "$CHPL_DIR/read_events/otf2_read_events" --tracePath="$trace"
+    run chpl_read_events_parallel "$trace_dir" "$events" "$bytes" \
+        "$CHPL_DIR/read_events/otf2_read_events_parallel" --tracePath="$trace"
+    run chpl_read_events_distributed "$trace_dir" "$events" "$bytes" \
+        "$CHPL_DIR/read_events/otf2_read_events_distributed" -nl "$NUMLOCALES" --tracePath="$trace"
+
+    run chpl_trace_to_csv "$trace_dir" "$events" "$bytes" \
+        "$CHPL_DIR/trace_to_csv/trace_to_csv" --tracePath="$trace" --metricsToTrackArg=synthetic_power
+    run chpl_trace_to_csv_parallel "$trace_dir" "$events" "$bytes" \
+        "$CHPL_DIR/trace_to_csv/trace_to_csv_parallel" "$trace" --outputDir=out --metrics=synthetic_power
+    run chpl_trace_to_csv_distributed "$trace_dir" "$events" "$bytes" \
+        "$CHPL_DIR/trace_to_csv/trace_to_csv_distributed" -nl "$NUMLOCALES" "$trace" --outputDir=out --metrics=synthetic_power
+done
@@ -319,8 +319,10 @@ Leave_store_and_count(OTF2_LocationRef location,
 int main(int argc, char** argv) {
     clock_t start_time = clock();
 
-    OTF2_Reader* reader = OTF2_Reader_Open("/workspace/scorep-traces/frontier-hpl-run-using-2-ranks-with-craypm/traces.otf2" );
-    // OTF2_Reader* reader = OTF2_Reader_Open("/workspace/scorep-traces/simple-mi300-example-run/traces.otf2" );
+    // Usage: otf2_read_events [path/to/traces.otf2]
+    const char* trace_path = argc > 1 ? argv[1]
+                                      : "/workspace/scorep-traces/frontier-hpl-run-using-2-ranks-with-craypm/traces.otf2";
+    OTF2_Reader* reader = OTF2_Reader_Open(trace_path);
     if (!reader) {
         fprintf(stderr, "Failed to open OTF2 archive\n");
         return EXIT_FAILURE;
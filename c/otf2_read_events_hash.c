@@ -7,217 +7,190 @@
 #include <string.h>
 #include <time.h>
 #include <stdbool.h>
-
+#include <omp.h>
+
+// Parallel reference reader: the locations are split into one set per OpenMP
+// thread, balanced by their event counts, and every thread reads its set with
+// its own OTF2_Reader and one local event reader per location. Events are
+// stored as definition refs, names are only looked up when printed.
+// The number of threads is taken from OMP_NUM_THREADS.
+//
 // Compile with gcc -o otf2_read_events_hash otf2_read_events_hash.c -I/opt/otf2/include -L/opt/otf2/lib -lotf2 -fopenmp
 // Or for mac use: clang -o otf2_read_events_hash otf2_read_events_hash.c -I/opt/otf2/include -L/opt/otf2/lib -lotf2 -Xpreprocessor -fopenmp -lomp -I/opt/homebrew/opt/libomp/include -L/opt/homebrew/opt/libomp/lib
-// --- Hash table implementations for O(1) lookup ---
 
-// Hash table node for chaining
-typedef struct StringHashNode {
-    OTF2_StringRef ref;
-    char* name;
-    struct StringHashNode* next;
-} StringHashNode;
+// --- Definition tables ---
+// All definition tables share one bump arena: their slot arrays and the
+// name bytes are carved out of it, so filling a table does no per-entry
+// malloc and tearing everything down is a single Arena_free.
 
-typedef struct {
-    size_t capacity;
-    size_t size;
-    StringHashNode** buckets;
-} StringTable;
+#define ARENA_CHUNK_SIZE (1 << 20)
 
-typedef struct LocationHashNode {
-    OTF2_LocationRef ref;
-    char* name;
-    struct LocationHashNode* next;
-} LocationHashNode;
-
-typedef struct {
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
     size_t capacity;
-    size_t size;
-    LocationHashNode** buckets;
-} LocationNameTable;
-
-typedef struct RegionHashNode {
-    OTF2_RegionRef ref;
-    char* name;
-    struct RegionHashNode* next;
-} RegionHashNode;
+    size_t used;
+    _Alignas(16) unsigned char data[];
+} ArenaChunk;
 
 typedef struct {
-    size_t capacity;
-    size_t size;
-    RegionHashNode** buckets;
-} RegionNameTable;
-
-// Simple hash function
-static size_t hash_uint64(uint64_t key, size_t capacity) {
-    // Simple multiplicative hash using a good constant
-    return ((key * 2654435761UL) >> 16) % capacity;
-}
+    ArenaChunk* head;
+} Arena;
 
-static void StringTable_init(StringTable* t) {
-    t->capacity = 1024;  // Larger initial capacity for better performance
-    t->size = 0;
-    t->buckets = calloc(t->capacity, sizeof(StringHashNode*));
-    if (!t->buckets) {
-        fprintf(stderr, "Failed to allocate memory for string table\n");
-        exit(EXIT_FAILURE);
-    }
+static void Arena_init(Arena* a) {
+    a->head = NULL;
 }
 
-static void StringTable_free(StringTable* t) {
-    for (size_t i = 0; i < t->capacity; i++) {
-        StringHashNode* node = t->buckets[i];
-        while (node) {
-            StringHashNode* temp = node;
-            node = node->next;
-            free(temp->name);
-            free(temp);
+static void* Arena_alloc(Arena* a, size_t size) {
+    // Keep every allocation 16-byte aligned
+    size = (size + 15) & ~(size_t)15;
+    ArenaChunk* chunk = a->head;
+    if (!chunk || chunk->capacity - chunk->used < size) {
+        size_t capacity = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        chunk = malloc(sizeof(ArenaChunk) + capacity);
+        if (!chunk) {
+            fprintf(stderr, "Failed to allocate memory for definition arena\n");
+            exit(EXIT_FAILURE);
         }
+        chunk->next = a->head;
+        chunk->capacity = capacity;
+        chunk->used = 0;
+        a->head = chunk;
     }
-    free(t->buckets);
+    void* p = chunk->data + chunk->used;
+    chunk->used += size;
+    return p;
 }
 
-static void StringTable_add(StringTable* t, OTF2_StringRef ref, const char* name) {
-    size_t bucket = hash_uint64(ref, t->capacity);
-    
-    StringHashNode* new_node = malloc(sizeof(StringHashNode));
-    if (!new_node) {
-        fprintf(stderr, "Failed to allocate memory for string hash node\n");
-        exit(EXIT_FAILURE);
-    }
-    
-    new_node->ref = ref;
-    new_node->name = strdup(name);
-    new_node->next = t->buckets[bucket];
-    t->buckets[bucket] = new_node;
-    t->size++;
+static const char* Arena_strdup(Arena* a, const char* s) {
+    size_t n = strlen(s) + 1;
+    char* copy = Arena_alloc(a, n);
+    memcpy(copy, s, n);
+    return copy;
 }
 
-static const char* StringTable_lookup(StringTable* t, OTF2_StringRef ref) {
-    size_t bucket = hash_uint64(ref, t->capacity);
-    StringHashNode* node = t->buckets[bucket];
-    
-    while (node) {
-        if (node->ref == ref) {
-            return node->name;
-        }
-        node = node->next;
+static void Arena_free(Arena* a) {
+    ArenaChunk* chunk = a->head;
+    while (chunk) {
+        ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
     }
-    return NULL;
+    a->head = NULL;
 }
 
-static void LocationNameTable_init(LocationNameTable* t, uint64_t number_of_locations) {
-    // Use next power of 2 that's at least as large as number_of_locations, minimum 256
-    t->capacity = 256;
-    while (t->capacity < number_of_locations) {
-        t->capacity *= 2;
-    }
-    t->size = 0;
-    t->buckets = calloc(t->capacity, sizeof(LocationHashNode*));
-    if (!t->buckets) {
-        fprintf(stderr, "Failed to allocate memory for location name table\n");
-        exit(EXIT_FAILURE);
-    }
+// Open-addressing table from a definition ref to its name (and one number,
+// e.g. the event count of a location), with linear probing over a
+// power-of-two slot array. Refs are dense small integers or 64-bit ids,
+// and the all-ones value is OTF2's "undefined" ref, so it marks empty slots.
+#define REF_TABLE_EMPTY UINT64_MAX
+
+typedef struct {
+    uint64_t ref;
+    const char* name;
+    uint64_t value;
+} RefTableSlot;
+
+typedef struct {
+    Arena* arena;
+    size_t capacity;  // Power of two
+    size_t size;
+    unsigned shift;   // 64 - log2(capacity)
+    RefTableSlot* slots;
+} RefTable;
+
+// Fibonacci hashing: the top bits of ref * 2^64/phi, which spreads both
+// dense refs and rank/thread-encoded location ids
+static inline size_t RefTable_slot_of(const RefTable* t, uint64_t ref) {
+    return (size_t)((ref * 0x9E3779B97F4A7C15ULL) >> t->shift);
 }
 
-static void LocationNameTable_free(LocationNameTable* t) {
+static void RefTable_alloc_slots(RefTable* t, size_t capacity) {
+    t->capacity = capacity;
+    t->shift = 64;
+    while (capacity > 1) {
+        capacity >>= 1;
+        t->shift--;
+    }
+    t->slots = Arena_alloc(t->arena, t->capacity * sizeof(RefTableSlot));
     for (size_t i = 0; i < t->capacity; i++) {
-        LocationHashNode* node = t->buckets[i];
-        while (node) {
-            LocationHashNode* temp = node;
-            node = node->next;
-            free(temp->name);
-            free(temp);
-        }
+        t->slots[i].ref = REF_TABLE_EMPTY;
     }
-    free(t->buckets);
 }
 
-static void LocationNameTable_add(LocationNameTable* t, OTF2_LocationRef ref, const char* name) {
-    size_t bucket = hash_uint64(ref, t->capacity);
-    
-    LocationHashNode* new_node = malloc(sizeof(LocationHashNode));
-    if (!new_node) {
-        fprintf(stderr, "Failed to allocate memory for location hash node\n");
-        exit(EXIT_FAILURE);
+static void RefTable_init(RefTable* t, Arena* arena, size_t expected) {
+    t->arena = arena;
+    t->size = 0;
+    // Room for the expected entries at a load factor of at most 1/2
+    size_t capacity = 16;
+    while (capacity < 2 * expected) {
+        capacity *= 2;
     }
-    
-    new_node->ref = ref;
-    new_node->name = strdup(name);
-    new_node->next = t->buckets[bucket];
-    t->buckets[bucket] = new_node;
-    t->size++;
+    RefTable_alloc_slots(t, capacity);
 }
 
-static const char* LocationNameTable_lookup(LocationNameTable* t, OTF2_LocationRef ref) {
-    size_t bucket = hash_uint64(ref, t->capacity);
-    LocationHashNode* node = t->buckets[bucket];
-    
-    while (node) {
-        if (node->ref == ref) {
-            return node->name;
+static void RefTable_put(RefTable* t, uint64_t ref, const char* name, uint64_t value);
+
+// Double the capacity; the old slot array stays in the arena until teardown
+static void RefTable_grow(RefTable* t) {
+    RefTableSlot* old_slots = t->slots;
+    size_t old_capacity = t->capacity;
+    RefTable_alloc_slots(t, old_capacity * 2);
+    t->size = 0;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i].ref != REF_TABLE_EMPTY) {
+            RefTable_put(t, old_slots[i].ref, old_slots[i].name, old_slots[i].value);
         }
-        node = node->next;
     }
-    return NULL;
 }
 
-static void RegionNameTable_init(RegionNameTable* t) {
-    t->capacity = 512;  // Good initial size for regions
-    t->size = 0;
-    t->buckets = calloc(t->capacity, sizeof(RegionHashNode*));
-    if (!t->buckets) {
-        fprintf(stderr, "Failed to allocate memory for region name table\n");
-        exit(EXIT_FAILURE);
+// Insert or replace the entry of ref; name must already live in the arena
+static void RefTable_put(RefTable* t, uint64_t ref, const char* name, uint64_t value) {
+    if (2 * (t->size + 1) > t->capacity) {
+        RefTable_grow(t);
+    }
+    const size_t mask = t->capacity - 1;
+    size_t i = RefTable_slot_of(t, ref);
+    while (t->slots[i].ref != REF_TABLE_EMPTY && t->slots[i].ref != ref) {
+        i = (i + 1) & mask;
+    }
+    if (t->slots[i].ref == REF_TABLE_EMPTY) {
+        t->size++;
     }
+    t->slots[i].ref = ref;
+    t->slots[i].name = name;
+    t->slots[i].value = value;
 }
 
-static void RegionNameTable_free(RegionNameTable* t) {
-    for (size_t i = 0; i < t->capacity; i++) {
-        RegionHashNode* node = t->buckets[i];
-        while (node) {
-            RegionHashNode* temp = node;
-            node = node->next;
-            free(temp->name);
-            free(temp);
-        }
-    }
-    free(t->buckets);
+static void RefTable_add(RefTable* t, uint64_t ref, const char* name, uint64_t value) {
+    RefTable_put(t, ref, Arena_strdup(t->arena, name), value);
 }
 
-static void RegionNameTable_add(RegionNameTable* t, OTF2_RegionRef ref, const char* name) {
-    size_t bucket = hash_uint64(ref, t->capacity);
-    
-    RegionHashNode* new_node = malloc(sizeof(RegionHashNode));
-    if (!new_node) {
-        fprintf(stderr, "Failed to allocate memory for region hash node\n");
-        exit(EXIT_FAILURE);
+static const RefTableSlot* RefTable_find(const RefTable* t, uint64_t ref) {
+    const size_t mask = t->capacity - 1;
+    size_t i = RefTable_slot_of(t, ref);
+    // The load factor keeps an empty slot in every probe sequence
+    while (t->slots[i].ref != ref) {
+        if (t->slots[i].ref == REF_TABLE_EMPTY) return NULL;
+        i = (i + 1) & mask;
     }
-    
-    new_node->ref = ref;
-    new_node->name = strdup(name);
-    new_node->next = t->buckets[bucket];
-    t->buckets[bucket] = new_node;
-    t->size++;
+    return &t->slots[i];
 }
 
-static const char* RegionNameTable_lookup(RegionNameTable* t, OTF2_RegionRef ref) {
-    size_t bucket = hash_uint64(ref, t->capacity);
-    RegionHashNode* node = t->buckets[bucket];
-    
-    while (node) {
-        if (node->ref == ref) {
-            return node->name;
-        }
-        node = node->next;
-    }
-    return NULL;
+static const char* RefTable_lookup(const RefTable* t, uint64_t ref) {
+    if (ref == REF_TABLE_EMPTY) return NULL;
+    const RefTableSlot* slot = RefTable_find(t, ref);
+    return slot ? slot->name : NULL;
 }
 
-// Helper function to collect all location references for iteration
-static void LocationNameTable_collect_refs(LocationNameTable* t, OTF2_LocationRef** refs, size_t* count) {
-    *refs = malloc(t->size * sizeof(OTF2_LocationRef));
+// A location and the number of events recorded for it
+typedef struct {
+    OTF2_LocationRef ref;
+    uint64_t weight;
+} WeightedLocation;
+
+// Helper function to collect all locations with their event counts for iteration
+static void collect_locations(const RefTable* t, WeightedLocation** refs, size_t* count) {
+    *refs = malloc((t->size ? t->size : 1) * sizeof(WeightedLocation));
     if (!*refs) {
         fprintf(stderr, "Failed to allocate memory for location refs\n");
         exit(EXIT_FAILURE);
@@ -225,20 +198,20 @@ static void LocationNameTable_collect_refs(LocationNameTable* t, OTF2_LocationRe
     
     *count = 0;
     for (size_t i = 0; i < t->capacity; i++) {
-        LocationHashNode* node = t->buckets[i];
-        while (node) {
-            (*refs)[(*count)++] = node->ref;
-            node = node->next;
-        }
+        if (t->slots[i].ref == REF_TABLE_EMPTY) continue;
+        (*refs)[*count].ref = t->slots[i].ref;
+        // Locations without events still cost opening their event file
+        (*refs)[*count].weight = t->slots[i].value + 1;
+        (*count)++;
     }
 }
 
 // --- Definition callbacks ---
 // Combined context for all definition callbacks
 typedef struct {
-    StringTable* string_table;
-    LocationNameTable* location_table;
-    RegionNameTable* region_table;
+    RefTable* string_table;
+    RefTable* location_table;  // Value: number of events
+    RefTable* region_table;
 } AllDefContext;
 
 
@@ -247,24 +220,18 @@ static void PrintUniqueLocationAndRegionStats(AllDefContext* all_def_ctx, bool v
     printf("Total unique locations: %zu\n", all_def_ctx->location_table->size);
     if (verbose) {
         printf("Unique locations:\n");
-        for (size_t i = 0; i < all_def_ctx->location_table->capacity; i++) {
-            LocationHashNode* node = all_def_ctx->location_table->buckets[i];
-            while (node) {
-                printf("  %s\n", node->name);
-                node = node->next;
-            }
+        const RefTable* t = all_def_ctx->location_table;
+        for (size_t i = 0; i < t->capacity; i++) {
+            if (t->slots[i].ref != REF_TABLE_EMPTY) printf("  %s\n", t->slots[i].name);
         }
     }
 
     printf("Total unique regions: %zu\n", all_def_ctx->region_table->size);
     if (verbose) {
         printf("Unique regions:\n");
-        for (size_t i = 0; i < all_def_ctx->region_table->capacity; i++) {
-            RegionHashNode* node = all_def_ctx->region_table->buckets[i];
-            while (node) {
-                printf("  %s\n", node->name);
-                node = node->next;
-            }
+        const RefTable* t = all_def_ctx->region_table;
+        for (size_t i = 0; i < t->capacity; i++) {
+            if (t->slots[i].ref != REF_TABLE_EMPTY) printf("  %s\n", t->slots[i].name);
         }
     }
 }
@@ -277,7 +244,7 @@ GlobDefString_Register(void* userData,
                        const char* string)
 {
     AllDefContext* all_ctx = (AllDefContext*)userData;
-    StringTable_add(all_ctx->string_table, self, string ? string : "UnknownString");
+    RefTable_add(all_ctx->string_table, self, string ? string : "UnknownString", 0);
     return OTF2_CALLBACK_SUCCESS;
 }
 
@@ -291,9 +258,9 @@ GlobDefLocation_Register(void* userData,
 {
     AllDefContext* all_ctx = (AllDefContext*)userData;
     // Lookup name in string table
-    const char* locname = StringTable_lookup(all_ctx->string_table, name);
+    const char* locname = RefTable_lookup(all_ctx->string_table, name);
     if (!locname) locname = "UnknownLocation";
-    LocationNameTable_add(all_ctx->location_table, location, locname);
+    RefTable_add(all_ctx->location_table, location, locname, numberOfEvents);
     return OTF2_CALLBACK_SUCCESS;
 }
 
@@ -311,16 +278,25 @@ GlobDefRegion_Register(void* userData,
                        uint32_t endLineNumber)
 {
     AllDefContext* all_ctx = (AllDefContext*)userData;
-    const char* regionname = StringTable_lookup(all_ctx->string_table, name);
+    const char* regionname = RefTable_lookup(all_ctx->string_table, name);
     if (!regionname) regionname = "UnknownRegion";
-    RegionNameTable_add(all_ctx->region_table, region, regionname);
+    RefTable_add(all_ctx->region_table, region, regionname, 0);
     return OTF2_CALLBACK_SUCCESS;
 }
 
+
+typedef enum {
+    EVENT_ENTER,
+    EVENT_LEAVE
+} EventType;
+
+// Names are resolved through the definition tables when needed, so an event
+// is a few integers and storing it allocates nothing beyond the array
 typedef struct {
-    char* location_name;
-    char* event_name;
-    char* region_name;
+    OTF2_TimeStamp time;
+    OTF2_LocationRef location;
+    OTF2_RegionRef region;
+    EventType type;
 } EventInfo;
 
 typedef struct {
@@ -331,8 +307,13 @@ typedef struct {
     EventInfo* events;
 } AllEventsData;
 
+static const char* event_type_name(EventType type) {
+    return type == EVENT_ENTER ? "Enter" : "Leave";
+}
+
 // Helper: add event to events array
-static void add_event(AllEventsData* data, const char* location, const char* event, const char* region) {
+static void add_event(AllEventsData* data, OTF2_TimeStamp time, OTF2_LocationRef location,
+                      EventType type, OTF2_RegionRef region) {
     if (data->size == data->capacity) {
         size_t new_cap = data->capacity * 2 + 1;
         EventInfo* new_events = realloc(data->events, new_cap * sizeof(EventInfo));
@@ -343,33 +324,32 @@ static void add_event(AllEventsData* data, const char* location, const char* eve
         data->events = new_events;
         data->capacity = new_cap;
     }
-    data->events[data->size].location_name = strdup(location);
-    data->events[data->size].event_name = strdup(event);
-    data->events[data->size].region_name = region ? strdup(region) : strdup("");
+    data->events[data->size].time = time;
+    data->events[data->size].location = location;
+    data->events[data->size].region = region;
+    data->events[data->size].type = type;
     data->size++;
 }
 
 // Helper: free allocated memory in AllEventsData
 static void free_events_data(AllEventsData* data) {
-    for (size_t i = 0; i < data->size; i++) {
-        free(data->events[i].location_name);
-        free(data->events[i].event_name);
-        free(data->events[i].region_name);
-    }
     free(data->events);
+    data->events = NULL;
+    data->size = data->capacity = 0;
 }
 
 
 // --- Event callback context ---
+// One per thread, so the callbacks never synchronize
 typedef struct {
     AllEventsData* event_data;
-    LocationNameTable* location_table;
-    RegionNameTable* region_table;
 } EventCallbackContext;
 
+// Local event reader callbacks, the event position is not needed
 static OTF2_CallbackCode
 Enter_store_and_count(OTF2_LocationRef location,
                       OTF2_TimeStamp time,
+                      uint64_t eventPosition,
                       void* userData,
                       OTF2_AttributeList* attributes,
                       OTF2_RegionRef region)
@@ -379,19 +359,15 @@ Enter_store_and_count(OTF2_LocationRef location,
     AllEventsData* all_event_data = ctx->event_data;
     // Increment enter count
     all_event_data->enter_count++;
-    // Get location and region names
-    const char* locname = LocationNameTable_lookup(ctx->location_table, location);
-    if (!locname) locname = "UnknownLocation";
-    const char* regionname = RegionNameTable_lookup(ctx->region_table, region);
-    if (!regionname) regionname = "UnknownRegion";
     // Add event to all_event_data
-    add_event(all_event_data, locname, "Enter", regionname);
+    add_event(all_event_data, time, location, EVENT_ENTER, region);
     return OTF2_CALLBACK_SUCCESS;
 }
 
 static OTF2_CallbackCode
 Leave_store_and_count(OTF2_LocationRef location,
                       OTF2_TimeStamp time,
+                      uint64_t eventPosition,
                       void* userData,
                       OTF2_AttributeList* attributes,
                       OTF2_RegionRef region)
@@ -401,30 +377,121 @@ Leave_store_and_count(OTF2_LocationRef location,
     AllEventsData* all_event_data = ctx->event_data;
     // Increment leave count
     all_event_data->leave_count++;
-    // Get location and region names
-    const char* locname = LocationNameTable_lookup(ctx->location_table, location);
-    if (!locname) locname = "UnknownLocation";
-    const char* regionname = RegionNameTable_lookup(ctx->region_table, region);
-    if (!regionname) regionname = "UnknownRegion";
     // Add event to all_event_data
-    add_event(all_event_data, locname, "Leave", regionname);
+    add_event(all_event_data, time, location, EVENT_LEAVE, region);
     return OTF2_CALLBACK_SUCCESS;
 }
 
 
+// --- Location partitioning ---
+// The same static LPT bins as the Chapel readers: heaviest location first,
+// each into the currently lightest part
+
+typedef struct {
+    OTF2_LocationRef* refs;
+    size_t count;
+    uint64_t weight;
+} LocationPart;
+
+static int compare_heavier_first(const void* a, const void* b) {
+    const WeightedLocation* x = a;
+    const WeightedLocation* y = b;
+    if (x->weight != y->weight) return x->weight > y->weight ? -1 : 1;
+    if (x->ref != y->ref) return x->ref < y->ref ? -1 : 1;
+    return 0;
+}
+
+static LocationPart* partition_locations(WeightedLocation* locations, size_t count, int num_parts) {
+    LocationPart* parts = calloc(num_parts, sizeof(LocationPart));
+    if (!parts) {
+        fprintf(stderr, "Failed to allocate memory for location parts\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int p = 0; p < num_parts; p++) {
+        parts[p].refs = malloc((count ? count : 1) * sizeof(OTF2_LocationRef));
+        if (!parts[p].refs) {
+            fprintf(stderr, "Failed to allocate memory for location parts\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    qsort(locations, count, sizeof(WeightedLocation), compare_heavier_first);
+    for (size_t i = 0; i < count; i++) {
+        // The number of threads is small, a linear scan beats a heap
+        int lightest = 0;
+        for (int p = 1; p < num_parts; p++) {
+            if (parts[p].weight < parts[lightest].weight) lightest = p;
+        }
+        parts[lightest].refs[parts[lightest].count++] = locations[i].ref;
+        parts[lightest].weight += locations[i].weight;
+    }
+    return parts;
+}
+
+static void free_location_parts(LocationPart* parts, int num_parts) {
+    for (int p = 0; p < num_parts; p++) {
+        free(parts[p].refs);
+    }
+    free(parts);
+}
+
+
+// Open a reader of its own on the trace and read the events of the given
+// locations, each with a local event reader. Returns the events read.
+static uint64_t read_events_for_locations(const char* trace_path, const LocationPart* part,
+                                          AllEventsData* event_data) {
+    if (part->count == 0) return 0;
+
+    OTF2_Reader* reader = OTF2_Reader_Open(trace_path);
+    if (!reader) {
+        fprintf(stderr, "Failed to open OTF2 archive\n");
+        return 0;
+    }
+    OTF2_Reader_SetSerialCollectiveCallbacks(reader);
+
+    for (size_t i = 0; i < part->count; i++) {
+        OTF2_Reader_SelectLocation(reader, part->refs[i]);
+    }
+    OTF2_Reader_OpenEvtFiles(reader);
+
+    EventCallbackContext evt_ctx = {event_data};
+    OTF2_EvtReaderCallbacks* event_callbacks = OTF2_EvtReaderCallbacks_New();
+    OTF2_EvtReaderCallbacks_SetEnterCallback(event_callbacks, &Enter_store_and_count);
+    OTF2_EvtReaderCallbacks_SetLeaveCallback(event_callbacks, &Leave_store_and_count);
+
+    uint64_t total_events_read = 0;
+    for (size_t i = 0; i < part->count; i++) {
+        OTF2_EvtReader* evt_reader = OTF2_Reader_GetEvtReader(reader, part->refs[i]);
+        if (!evt_reader) continue;
+        OTF2_Reader_RegisterEvtCallbacks(reader, evt_reader, event_callbacks, &evt_ctx);
+        uint64_t events_read = 0;
+        OTF2_Reader_ReadAllLocalEvents(reader, evt_reader, &events_read);
+        total_events_read += events_read;
+        OTF2_Reader_CloseEvtReader(reader, evt_reader);
+    }
+
+    OTF2_EvtReaderCallbacks_Delete(event_callbacks);
+    OTF2_Reader_CloseEvtFiles(reader);
+    OTF2_Reader_Close(reader);
+    return total_events_read;
+}
+
+
 int main(int argc, char** argv) {
-    clock_t start_time = clock();
+    // Wall-clock time, clock() would add up the CPU time of all threads
+    double start_time = omp_get_wtime();
 
-    // OTF2_Reader* reader = OTF2_Reader_Open("/workspace/scorep-traces/frontier-hpl-run-using-2-ranks-with-craypm/traces.otf2" );
-    OTF2_Reader* reader = OTF2_Reader_Open("/workspace/scorep-traces/simple-mi300-example-run/traces.otf2" );
+    // Usage: otf2_read_events_hash [path/to/traces.otf2]
+    const char* trace_path = argc > 1 ? argv[1]
+                                      : "/workspace/scorep-traces/simple-mi300-example-run/traces.otf2";
+    OTF2_Reader* reader = OTF2_Reader_Open(trace_path);
     if (!reader) {
         fprintf(stderr, "Failed to open OTF2 archive\n");
         return EXIT_FAILURE;
     }
 
-    printf("Time taken to open OTF2 archive: %.2f seconds\n",
-           (double)(clock() - start_time) / CLOCKS_PER_SEC);
-    clock_t def_read_start_time = clock();
+    printf("Time taken to open initial OTF2 archive: %.2f seconds\n",
+           omp_get_wtime() - start_time);
+    double def_read_start_time = omp_get_wtime();
 
     OTF2_Reader_SetSerialCollectiveCallbacks(reader);
     uint64_t number_of_locations;
@@ -432,9 +499,11 @@ int main(int argc, char** argv) {
     printf("Number of locations: %" PRIu64 "\n", number_of_locations);
 
     // --- Lookup tables ---
-    StringTable string_table; StringTable_init(&string_table);
-    LocationNameTable location_table; LocationNameTable_init(&location_table, number_of_locations);
-    RegionNameTable region_table; RegionNameTable_init(&region_table);
+    // Filled here and only read afterwards, so all threads share them
+    Arena arena; Arena_init(&arena);
+    RefTable string_table; RefTable_init(&string_table, &arena, 1024);
+    RefTable location_table; RefTable_init(&location_table, &arena, number_of_locations);
+    RefTable region_table; RefTable_init(&region_table, &arena, 512);
 
     // --- Definition callbacks ---
     OTF2_GlobalDefReader* global_def_reader = OTF2_Reader_GetGlobalDefReader(reader);
@@ -472,28 +541,26 @@ int main(int argc, char** argv) {
                                          &definitions_read);
     printf("Read %" PRIu64 " global definitions\n", definitions_read);
     printf("Time taken to read global definitions: %.2f seconds\n",
-           (double)(clock() - def_read_start_time) / CLOCKS_PER_SEC);
+           omp_get_wtime() - def_read_start_time);
 
-    clock_t local_def_start_time = clock();
+    double local_def_start_time = omp_get_wtime();
 
-    // Collect all location references for iteration
-    OTF2_LocationRef* location_refs;
+    // Collect all locations with their event counts for partitioning
+    WeightedLocation* locations;
     size_t location_count;
-    LocationNameTable_collect_refs(&location_table, &location_refs, &location_count);
+    collect_locations(&location_table, &locations, &location_count);
 
     for (size_t i = 0; i < location_count; i++) {
-        OTF2_Reader_SelectLocation(reader, location_refs[i]);
+        OTF2_Reader_SelectLocation(reader, locations[i].ref);
     }
 
     bool successful_open_def_files =
         OTF2_Reader_OpenDefFiles(reader) == OTF2_SUCCESS;
 
-
-    OTF2_Reader_OpenEvtFiles(reader);
-    for (size_t i = 0; i < location_count; i++) {
-        if (successful_open_def_files) {
+    if (successful_open_def_files) {
+        for (size_t i = 0; i < location_count; i++) {
             OTF2_DefReader* def_reader = OTF2_Reader_GetDefReader(reader,
-                                                                  location_refs[i]);
+                                                                  locations[i].ref);
             if (def_reader) {
                 uint64_t def_reads = 0;
                 OTF2_Reader_ReadAllLocalDefinitions(reader,
@@ -504,79 +571,97 @@ int main(int argc, char** argv) {
                                            def_reader);
             }
         }
-        // Mark file to be read by Global Reader later
-        OTF2_EvtReader* evt_reader =
-                OTF2_Reader_GetEvtReader(reader, location_refs[i]);
-    }
-    if (successful_open_def_files) {
         OTF2_Reader_CloseDefFiles(reader);
     }
+    // The event files are read by the threads, each with its own reader
+    OTF2_Reader_Close(reader);
+
+    printf("Time taken to read local definition files: %.2f seconds\n",
+           omp_get_wtime() - local_def_start_time);
 
-    printf("Time taken to read local definition files and mark all local event files for reading: %.2f seconds\n",
-           (double)(clock() - local_def_start_time) / CLOCKS_PER_SEC);
+    double event_read_start_time = omp_get_wtime();
 
-    clock_t event_read_start_time = clock();
+    int number_of_readers = omp_get_max_threads();
+    if ((size_t)number_of_readers > location_count) number_of_readers = (int)location_count;
+    if (number_of_readers < 1) number_of_readers = 1;
+    printf("Number of readers: %d\n", number_of_readers);
 
-    OTF2_GlobalEvtReader* global_evt_reader = OTF2_Reader_GetGlobalEvtReader(reader);
+    LocationPart* parts = partition_locations(locations, location_count, number_of_readers);
 
-    // Initialize event_data
-    AllEventsData event_data = {0};
-    event_data.capacity = 1024;
-    event_data.size = 0;
-    event_data.enter_count = 0;
-    event_data.leave_count = 0;
-    event_data.events = calloc(event_data.capacity, sizeof(EventInfo));
-    if (!event_data.events) {
+    // Per-part event data, merged after the parallel region
+    AllEventsData* thread_event_data = calloc(number_of_readers, sizeof(AllEventsData));
+    if (!thread_event_data) {
         fprintf(stderr, "Failed to allocate memory for event data\n");
         return EXIT_FAILURE;
     }
 
-    // Event callback context
-    EventCallbackContext evt_ctx = {&event_data, &location_table, &region_table};
-
-    OTF2_GlobalEvtReaderCallbacks* event_callbacks = OTF2_GlobalEvtReaderCallbacks_New();
-
-    OTF2_GlobalEvtReaderCallbacks_SetEnterCallback(event_callbacks, &Enter_store_and_count);
-    OTF2_GlobalEvtReaderCallbacks_SetLeaveCallback(event_callbacks, &Leave_store_and_count);
-
-    OTF2_Reader_RegisterGlobalEvtCallbacks(reader,
-                                           global_evt_reader,
-                                           event_callbacks,
-                                           &evt_ctx);
-
-    OTF2_GlobalEvtReaderCallbacks_Delete(event_callbacks);
-
     uint64_t total_events_read = 0;
-    OTF2_Reader_ReadAllGlobalEvents(reader,
-                                    global_evt_reader,
-                                    &total_events_read);
-
-    OTF2_Reader_CloseGlobalEvtReader(reader,
-                                     global_evt_reader);
-
-    OTF2_Reader_CloseEvtFiles(reader);
-    OTF2_Reader_Close(reader);
+    // A loop over the parts rather than one part per thread id: the runtime
+    // may grant fewer threads than asked for (OMP_DYNAMIC, thread limits,
+    // nesting), and every part must still be read
+    #pragma omp parallel for num_threads(number_of_readers) schedule(static, 1) reduction(+:total_events_read)
+    for (int p = 0; p < number_of_readers; p++) {
+        double part_start_time = omp_get_wtime();
+        AllEventsData* event_data = &thread_event_data[p];
+        event_data->capacity = 1024;
+        event_data->events = malloc(event_data->capacity * sizeof(EventInfo));
+        if (!event_data->events) {
+            fprintf(stderr, "Failed to allocate memory for event data\n");
+            exit(EXIT_FAILURE);
+        }
+        total_events_read += read_events_for_locations(trace_path, &parts[p], event_data);
+        printf("Time taken to read events (part %d on thread %d, %zu locations): %.2f seconds\n",
+               p, omp_get_thread_num(), parts[p].count, omp_get_wtime() - part_start_time);
+    }
 
     printf("Time taken to read events: %.2f seconds\n",
-           (double)(clock() - event_read_start_time) / CLOCKS_PER_SEC);
-
-    printf("Total time: %.2f seconds\n", (double)(clock() - start_time) / CLOCKS_PER_SEC);
+           omp_get_wtime() - event_read_start_time);
+
+    printf("Total time: %.2f seconds\n", omp_get_wtime() - start_time);
+
+    // --- Merge per-thread counts ---
+    uint64_t enter_count = 0;
+    uint64_t leave_count = 0;
+    size_t stored_events = 0;
+    for (int t = 0; t < number_of_readers; t++) {
+        enter_count += thread_event_data[t].enter_count;
+        leave_count += thread_event_data[t].leave_count;
+        stored_events += thread_event_data[t].size;
+    }
 
     // Print event summary (matching Python output)
     printf("\nEvent Summary:\n");
     printf("Total number of events: %" PRIu64 "\n", total_events_read);
     printf("Event types and their counts:\n");
-    printf("  Enter: %" PRIu64 " events\n", event_data.enter_count);
-    printf("  Leave: %" PRIu64 " events\n", event_data.leave_count);
+    printf("  Enter: %" PRIu64 " events\n", enter_count);
+    printf("  Leave: %" PRIu64 " events\n", leave_count);
+    printf("Stored events: %zu\n", stored_events);
+    if (stored_events > 0) {
+        // Names are looked up only here, from the shared tables
+        const EventInfo* first = NULL;
+        for (int t = 0; t < number_of_readers && !first; t++) {
+            if (thread_event_data[t].size > 0) first = &thread_event_data[t].events[0];
+        }
+        const char* locname = RefTable_lookup(&location_table, first->location);
+        const char* regionname = RefTable_lookup(&region_table, first->region);
+        printf("First stored event: %s %s on %s at %" PRIu64 "\n",
+               event_type_name(first->type),
+               regionname ? regionname : "UnknownRegion",
+               locname ? locname : "UnknownLocation",
+               first->time);
+    }
     PrintUniqueLocationAndRegionStats(&all_ctx, false);
 
     // Free event_data
-    free_events_data(&event_data);
+    for (int t = 0; t < number_of_readers; t++) {
+        free_events_data(&thread_event_data[t]);
+    }
+    free(thread_event_data);
+    free_location_parts(parts, number_of_readers);
+    free(locations);
 
-    // Free lookup tables
-    StringTable_free(&string_table);
-    LocationNameTable_free(&location_table);
-    RegionNameTable_free(&region_table);
+    // Free lookup tables, their slots and names all live in the arena
+    Arena_free(&arena);
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
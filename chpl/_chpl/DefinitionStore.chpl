@@ -0,0 +1,589 @@
+// Copyright Hewlett Packard Enterprise Development LP.
+
+/*
+ * Dense, array-indexed tables for OTF2 global definitions
+ *
+ * OTF2 definition refs (strings, regions, location groups, metrics, metric
+ * members) are small integers handed out densely from zero, so they index
+ * plain arrays directly: a lookup is a bounds check and one load, with no
+ * hashing and no string copies. Names are resolved once, when the
+ * definitions are read, and lookups return const refs into the tables.
+ *
+ * Location refs are 64-bit and, depending on the measurement system, may
+ * encode rank and thread rather than being dense. Locations are therefore
+ * stored in registration order and the ref is mapped to that index; when the
+ * refs turn out to be dense (ref == index) the mapping is the identity and no
+ * hashing happens either.
+ *
+ * Usage example:
+ *   var defs = new DefinitionStore();
+ *   readGlobalDefinitions(reader, defs);
+ *   const ref loc = defs.location(locationRef);
+ *   writeln(loc.processName, " ", loc.name, " ", defs.regionName(regionRef));
+ *
+ *   // or, inside `on Locales[i]`, a copy local to that locale
+ *   const localDefs = loadGlobalDefinitions(tracePath);
+ */
+module DefinitionStore {
+  use OTF2;
+
+  // See https://perftools.pages.jsc.fz-juelich.de/cicd/otf2/tags/latest/html/group__records__definition.html#ClockProperties
+  record ClockProperties {
+    var timerResolution: uint(64);
+    var globalOffset: uint(64);
+    var traceLength: uint(64);
+    var realtimeTimestamp: uint(64);
+  }
+
+  proc timestampToSeconds(ts: OTF2_TimeStamp, clockProps: ClockProperties): real(64) {
+    if clockProps.timerResolution == 0 then
+      return 0.0;
+    // We use this start_time to normalize timestamps to start from zero
+    // We don't use a ProgramBegin event because each MPI rank will have it's own
+    // and we want a global start time
+    const start_time = clockProps.globalOffset;
+    if ts < start_time {
+      return -1.0 * ((start_time - ts):real(64) / clockProps.timerResolution);
+    }
+    return (ts - start_time):real(64) / clockProps.timerResolution;
+  }
+
+  // These records are not feature complete but sufficient for the current needs.
+  // The `defined` flags mark which slots of the dense tables hold a definition.
+  record Region {
+    var defined: bool;
+    var name: string;
+    var regionRole: OTF2_RegionRole;
+    var paradigm: OTF2_Paradigm;
+  }
+
+  record LocationGroup {
+    var defined: bool;
+    var name: string;
+    var creatingLocationGroup: string;
+    var locationGroupType: OTF2_LocationGroupType;
+  }
+
+  record Location {
+    var defined: bool;
+    var id: OTF2_LocationRef;
+    var name: string;
+    var group: OTF2_LocationGroupRef;
+    var locationType: OTF2_LocationType;
+    var numberOfEvents: uint(64);
+    // Resolved once all definitions are read: the name of the location group,
+    // and the name of the process, which is the creating location group if
+    // there is one (matching the Python tooling) and the group itself otherwise
+    var groupName: string;
+    var processName: string;
+    // File name reserved for this location's output by tools that write
+    // while reading (trace_to_csv --stream), empty if it does not get one
+    var callGraphFile: string;
+  }
+
+  record MetricMember {
+    var defined: bool;
+    var name: string;
+    var unit: string;
+    var metricType: OTF2_MetricType;
+    var mode: OTF2_MetricMode;
+    var valueType: OTF2_Type;
+  }
+
+  record MetricClass {
+    var defined: bool;
+    var numberOfMetrics: c_uint8;
+    // Members are stored flattened in DefinitionStore.classMembers
+    var firstMember: int;
+    // Set by a MetricClassRecorder definition
+    var hasRecorder: bool;
+    var recorder: OTF2_LocationRef;
+  }
+
+  record MetricInstance {
+    var defined: bool;
+    var metricClass: OTF2_MetricRef;
+    var recorder: OTF2_LocationRef;
+  }
+
+  // Returned by lookups of refs that were never defined
+  const unknownRegion = new Region(name="UnknownRegion");
+  const unknownLocation = new Location(name="UnknownLocation",
+                                       groupName="UnknownLocationGroup",
+                                       processName="UnknownLocationGroup");
+  const unknownLocationGroup = new LocationGroup(name="UnknownLocationGroup",
+                                                 creatingLocationGroup="None");
+  const unknownMetricMember = new MetricMember(name="UnknownMetricMember",
+                                               unit="UnknownUnit");
+
+  // Make index i valid in dom, doubling the capacity so appends stay amortized O(1)
+  private proc ensureCapacity(ref dom: domain(1), i: int) {
+    if i >= dom.size then
+      dom = {0..<max(i + 1, 2 * dom.size, 16)};
+  }
+
+  record DefinitionStore {
+    var clockProps: ClockProperties;
+
+    var stringDom: domain(1) = {0..<0};
+    var strings: [stringDom] string;
+    var stringDefined: [stringDom] bool;
+    var numStrings: int;
+
+    var regionDom: domain(1) = {0..<0};
+    var regions: [regionDom] Region;
+    var numRegions: int;
+
+    var locationGroupDom: domain(1) = {0..<0};
+    var locationGroups: [locationGroupDom] LocationGroup;
+    var numLocationGroups: int;
+
+    // Locations in registration order, see the module comment
+    var locationDom: domain(1) = {0..<0};
+    var locations: [locationDom] Location;
+    var numLocations: int;
+    var locationRefsAreDense: bool = true;
+    var locationIndexIds: domain(OTF2_LocationRef);
+    var locationIndexTable: [locationIndexIds] int;
+
+    var metricMemberDom: domain(1) = {0..<0};
+    var metricMembers: [metricMemberDom] MetricMember;
+    var numMetricMembers: int;
+
+    var metricClassDom: domain(1) = {0..<0};
+    var metricClasses: [metricClassDom] MetricClass;
+    var numMetricClasses: int;
+
+    var classMemberDom: domain(1) = {0..<0};
+    var classMembers: [classMemberDom] OTF2_MetricMemberRef;
+    var numClassMembers: int;
+
+    var metricInstanceDom: domain(1) = {0..<0};
+    var metricInstances: [metricInstanceDom] MetricInstance;
+    var numMetricInstances: int;
+
+    // --- Registration (called from the definition callbacks) ---
+
+    proc ref addString(self: OTF2_StringRef, name: string) {
+      const i = self: int;
+      ensureCapacity(stringDom, i);
+      if !stringDefined[i] then numStrings += 1;
+      strings[i] = name;
+      stringDefined[i] = true;
+    }
+
+    proc ref addRegion(self: OTF2_RegionRef, name: OTF2_StringRef,
+                       regionRole: OTF2_RegionRole, paradigm: OTF2_Paradigm) {
+      const i = self: int;
+      ensureCapacity(regionDom, i);
+      if !regions[i].defined then numRegions += 1;
+      regions[i] = new Region(defined=true,
+                              name=stringOr(name, "UnknownRegion"),
+                              regionRole=regionRole,
+                              paradigm=paradigm);
+    }
+
+    proc ref addLocationGroup(self: OTF2_LocationGroupRef, name: OTF2_StringRef,
+                              locationGroupType: OTF2_LocationGroupType,
+                              creatingLocationGroup: OTF2_LocationGroupRef) {
+      const i = self: int;
+      const creatingGroupName = if hasLocationGroup(creatingLocationGroup)
+                                  then locationGroups[creatingLocationGroup: int].name
+                                  else "None";
+      ensureCapacity(locationGroupDom, i);
+      if !locationGroups[i].defined then numLocationGroups += 1;
+      locationGroups[i] = new LocationGroup(defined=true,
+                                            name=stringOr(name, "UnknownGroup"),
+                                            creatingLocationGroup=creatingGroupName,
+                                            locationGroupType=locationGroupType);
+    }
+
+    proc ref addLocation(self: OTF2_LocationRef, name: OTF2_StringRef,
+                         locationType: OTF2_LocationType,
+                         numberOfEvents: uint(64),
+                         locationGroup: OTF2_LocationGroupRef) {
+      var i = locationIndex(self);
+      if i < 0 {
+        i = numLocations;
+        numLocations += 1;
+        ensureCapacity(locationDom, i);
+        if locationRefsAreDense && self != i: OTF2_LocationRef {
+          // First ref that doesn't match its index, switch to the mapped lookup
+          locationRefsAreDense = false;
+          for j in 0..<i {
+            locationIndexIds += locations[j].id;
+            locationIndexTable[locations[j].id] = j;
+          }
+        }
+        if !locationRefsAreDense {
+          locationIndexIds += self;
+          locationIndexTable[self] = i;
+        }
+      }
+      locations[i] = new Location(defined=true,
+                                  id=self,
+                                  name=stringOr(name, "UnknownLocation"),
+                                  group=locationGroup,
+                                  locationType=locationType,
+                                  numberOfEvents=numberOfEvents);
+    }
+
+    proc ref addMetricMember(self: OTF2_MetricMemberRef, name: OTF2_StringRef,
+                             metricType: OTF2_MetricType, mode: OTF2_MetricMode,
+                             valueType: OTF2_Type, unit: OTF2_StringRef) {
+      const i = self: int;
+      ensureCapacity(metricMemberDom, i);
+      if !metricMembers[i].defined then numMetricMembers += 1;
+      metricMembers[i] = new MetricMember(defined=true,
+                                          name=stringOr(name, "UnknownMetricMember"),
+                                          unit=stringOr(unit, "UnknownUnit"),
+                                          metricType=metricType,
+                                          mode=mode,
+                                          valueType=valueType);
+    }
+
+    proc ref addMetricClass(self: OTF2_MetricRef, numberOfMetrics: c_uint8,
+                            members: c_ptrConst(OTF2_MetricMemberRef)) {
+      const i = self: int;
+      const first = numClassMembers;
+      const n = numberOfMetrics: int;
+      if n > 0 {
+        ensureCapacity(classMemberDom, first + n - 1);
+        for m in 0..<n do classMembers[first + m] = members[m];
+        numClassMembers += n;
+      }
+      ensureCapacity(metricClassDom, i);
+      if !metricClasses[i].defined then numMetricClasses += 1;
+      metricClasses[i] = new MetricClass(defined=true,
+                                         numberOfMetrics=numberOfMetrics,
+                                         firstMember=first);
+    }
+
+    proc ref addMetricInstance(self: OTF2_MetricRef, metricClass: OTF2_MetricRef,
+                               recorder: OTF2_LocationRef) {
+      const i = self: int;
+      ensureCapacity(metricInstanceDom, i);
+      if !metricInstances[i].defined then numMetricInstances += 1;
+      metricInstances[i] = new MetricInstance(defined=true,
+                                              metricClass=metricClass,
+                                              recorder=recorder);
+    }
+
+    proc ref addMetricClassRecorder(metric: OTF2_MetricRef, recorder: OTF2_LocationRef) {
+      if !hasMetricClass(metric) then return;
+      ref mc = metricClasses[metric: int];
+      mc.hasRecorder = true;
+      mc.recorder = recorder;
+    }
+
+    // Resolve the group and process names of every location. Location groups
+    // may be defined after the locations that reference them, so this runs
+    // once all global definitions are read.
+    proc ref finalize() {
+      forall i in 0..<numLocations with (ref this) {
+        ref loc = locations[i];
+        if hasLocationGroup(loc.group) {
+          const ref lg = locationGroups[loc.group: int];
+          loc.groupName = lg.name;
+          loc.processName = if lg.creatingLocationGroup != "None" && lg.creatingLocationGroup != ""
+                              then lg.creatingLocationGroup
+                              else lg.name;
+        } else {
+          loc.groupName = "UnknownLocationGroup";
+          loc.processName = "UnknownLocationGroup";
+        }
+      }
+    }
+
+    // Rebuild the mapping from location refs to indices for a store whose
+    // locations[0..<numLocations] were filled directly (see TraceCache)
+    proc ref indexLocations() {
+      locationRefsAreDense = && reduce [i in 0..<numLocations] locations[i].id == i: OTF2_LocationRef;
+      locationIndexIds.clear();
+      if !locationRefsAreDense {
+        for i in 0..<numLocations {
+          locationIndexIds += locations[i].id;
+          locationIndexTable[locations[i].id] = i;
+        }
+      }
+    }
+
+    // --- Lookups ---
+
+    inline proc hasString(s: OTF2_StringRef): bool {
+      return s < stringDom.size && stringDefined[s: int];
+    }
+
+    // The string for s, or fallback if it is undefined or empty
+    proc stringOr(s: OTF2_StringRef, fallback: string): string {
+      return if hasString(s) && strings[s: int] != "" then strings[s: int] else fallback;
+    }
+
+    inline proc hasRegion(r: OTF2_RegionRef): bool {
+      return r < regionDom.size && regions[r: int].defined;
+    }
+
+    inline proc region(r: OTF2_RegionRef) const ref : Region {
+      if hasRegion(r) then return regions[r: int];
+      return unknownRegion;
+    }
+
+    inline proc regionName(r: OTF2_RegionRef) const ref : string {
+      return region(r).name;
+    }
+
+    inline proc hasLocationGroup(g: OTF2_LocationGroupRef): bool {
+      return g < locationGroupDom.size && locationGroups[g: int].defined;
+    }
+
+    inline proc locationGroup(g: OTF2_LocationGroupRef) const ref : LocationGroup {
+      if hasLocationGroup(g) then return locationGroups[g: int];
+      return unknownLocationGroup;
+    }
+
+    // Dense index of a location ref in registration order, -1 if undefined
+    inline proc locationIndex(l: OTF2_LocationRef): int {
+      if locationRefsAreDense then
+        return if l < numLocations: OTF2_LocationRef then l: int else -1;
+      return if locationIndexIds.contains(l) then locationIndexTable[l] else -1;
+    }
+
+    inline proc hasLocation(l: OTF2_LocationRef): bool {
+      return locationIndex(l) >= 0;
+    }
+
+    inline proc location(l: OTF2_LocationRef) const ref : Location {
+      const i = locationIndex(l);
+      if i >= 0 then return locations[i];
+      return unknownLocation;
+    }
+
+    inline proc locationName(l: OTF2_LocationRef) const ref : string {
+      return location(l).name;
+    }
+
+    inline proc hasMetricMember(m: OTF2_MetricMemberRef): bool {
+      return m < metricMemberDom.size && metricMembers[m: int].defined;
+    }
+
+    inline proc metricMember(m: OTF2_MetricMemberRef) const ref : MetricMember {
+      if hasMetricMember(m) then return metricMembers[m: int];
+      return unknownMetricMember;
+    }
+
+    inline proc hasMetricClass(m: OTF2_MetricRef): bool {
+      return m < metricClassDom.size && metricClasses[m: int].defined;
+    }
+
+    inline proc hasMetricInstance(m: OTF2_MetricRef): bool {
+      return m < metricInstanceDom.size && metricInstances[m: int].defined;
+    }
+
+    // Member i of metric class m
+    inline proc metricClassMember(m: OTF2_MetricRef, i: int): OTF2_MetricMemberRef {
+      return classMembers[metricClasses[m: int].firstMember + i];
+    }
+
+    // Metric events reference either a metric class or an instance of one
+    inline proc metricClassOf(m: OTF2_MetricRef): OTF2_MetricRef {
+      return if hasMetricInstance(m) then metricInstances[m: int].metricClass else m;
+    }
+
+    // Upper bound on the metric refs (classes and instances share the ref space)
+    inline proc metricRefBound(): int {
+      return max(metricClassDom.size, metricInstanceDom.size);
+    }
+
+    // --- Iteration over the defined refs ---
+
+    iter locationRefs(): OTF2_LocationRef {
+      for i in 0..<numLocations do yield locations[i].id;
+    }
+
+    iter regionRefs(): OTF2_RegionRef {
+      for r in regionDom do if regions[r].defined then yield r: OTF2_RegionRef;
+    }
+
+    iter locationGroupRefs(): OTF2_LocationGroupRef {
+      for g in locationGroupDom do if locationGroups[g].defined then yield g: OTF2_LocationGroupRef;
+    }
+
+    iter metricMemberRefs(): OTF2_MetricMemberRef {
+      for m in metricMemberDom do if metricMembers[m].defined then yield m: OTF2_MetricMemberRef;
+    }
+
+    iter metricClassRefs(): OTF2_MetricRef {
+      for m in metricClassDom do if metricClasses[m].defined then yield m: OTF2_MetricRef;
+    }
+
+    iter metricInstanceRefs(): OTF2_MetricRef {
+      for m in metricInstanceDom do if metricInstances[m].defined then yield m: OTF2_MetricRef;
+    }
+  }
+
+  // --- Global definition callbacks, userData is a c_ptr(DefinitionStore) ---
+
+  proc registerClockProperties(userData: c_ptr(void),
+                               timerResolution: uint(64),
+                               globalOffset: uint(64),
+                               traceLength: uint(64),
+                               realtimeTimestamp: uint(64)): OTF2_CallbackCode {
+    var defsPtr = userData: c_ptr(DefinitionStore);
+    if defsPtr == nil then return OTF2_CALLBACK_ERROR;
+    ref clockProps = defsPtr.deref().clockProps;
+    clockProps.timerResolution = timerResolution;
+    clockProps.globalOffset = globalOffset;
+    clockProps.traceLength = traceLength;
+    clockProps.realtimeTimestamp = realtimeTimestamp;
+    return OTF2_CALLBACK_SUCCESS;
+  }
+
+  proc GlobDefString_Register(userData: c_ptr(void),
+                              strRef: OTF2_StringRef,
+                              strName: c_ptrConst(c_uchar)):
+                              OTF2_CallbackCode {
+    var defsPtr = userData: c_ptr(DefinitionStore);
+    if defsPtr == nil then return OTF2_CALLBACK_ERROR;
+    if strName != nil {
+      try! defsPtr.deref().addString(strRef, string.createCopyingBuffer(strName));
+    } else {
+      defsPtr.deref().addString(strRef, "UnknownString");
+    }
+    return OTF2_CALLBACK_SUCCESS;
+  }
+
+  proc GlobDefLocationGroup_Register(userData: c_ptr(void),
+                                     self : OTF2_LocationGroupRef,
+                                     name : OTF2_StringRef,
+                                     locationGroupType : OTF2_LocationGroupType,
+                                     systemTreeParent : OTF2_SystemTreeNodeRef,
+                                     creatingLocationGroup : OTF2_LocationGroupRef): OTF2_CallbackCode {
+    var defsPtr = userData: c_ptr(DefinitionStore);
+    if defsPtr == nil then return OTF2_CALLBACK_ERROR;
+    defsPtr.deref().addLocationGroup(self, name, locationGroupType, creatingLocationGroup);
+    return OTF2_CALLBACK_SUCCESS;
+  }
+
+  proc GlobDefLocation_Register(userData: c_ptr(void),
+                                location: OTF2_LocationRef,
+                                name: OTF2_StringRef,
+                                locationType: OTF2_LocationType,
+                                numberOfEvents: c_uint64,
+                                locationGroup: OTF2_LocationGroupRef):
+                                OTF2_CallbackCode {
+    var defsPtr = userData: c_ptr(DefinitionStore);
+    if defsPtr == nil then return OTF2_CALLBACK_ERROR;
+    defsPtr.deref().addLocation(location, name, locationType, numberOfEvents, locationGroup);
+    return OTF2_CALLBACK_SUCCESS;
+  }
+
+  proc GlobDefRegion_Register(userData: c_ptr(void),
+                              region: OTF2_RegionRef,
+                              name: OTF2_StringRef,
+                              canonicalName: OTF2_StringRef,
+                              description: OTF2_StringRef,
+                              regionRole: OTF2_RegionRole,
+                              paradigm: OTF2_Paradigm,
+                              regionFlags: OTF2_RegionFlag,
+                              sourceFile: OTF2_StringRef,
+                              beginLineNumber: c_uint32,
+                              endLineNumber: c_uint32):
+                              OTF2_CallbackCode {
+    var defsPtr = userData: c_ptr(DefinitionStore);
+    if defsPtr == nil then return OTF2_CALLBACK_ERROR;
+    defsPtr.deref().addRegion(region, name, regionRole, paradigm);
+    return OTF2_CALLBACK_SUCCESS;
+  }
+
+  proc GlobDefMetricMember_Register(userData: c_ptr(void),
+                                    self: OTF2_MetricMemberRef,
+                                    name: OTF2_StringRef,
+                                    description: OTF2_StringRef,
+                                    metricType: OTF2_MetricType,
+                                    mode: OTF2_MetricMode,
+                                    valueType: OTF2_Type,
+                                    base: OTF2_Base,
+                                    exponent: c_int64,
+                                    unit: OTF2_StringRef): OTF2_CallbackCode {
+    var defsPtr = userData: c_ptr(DefinitionStore);
+    if defsPtr == nil then return OTF2_CALLBACK_ERROR;
+    defsPtr.deref().addMetricMember(self, name, metricType, mode, valueType, unit);
+    return OTF2_CALLBACK_SUCCESS;
+  }
+
+  proc GlobDefMetricClass_Register(userData: c_ptr(void),
+                                   self: OTF2_MetricRef,
+                                   numberOfMetrics: c_uint8,
+                                   metricMembers: c_ptrConst(OTF2_MetricMemberRef),
+                                   metricOccurrence: OTF2_MetricOccurrence,
+                                   recorderKind: OTF2_RecorderKind): OTF2_CallbackCode {
+    var defsPtr = userData: c_ptr(DefinitionStore);
+    if defsPtr == nil then return OTF2_CALLBACK_ERROR;
+    defsPtr.deref().addMetricClass(self, numberOfMetrics, metricMembers);
+    return OTF2_CALLBACK_SUCCESS;
+  }
+
+  proc GlobDefMetricInstance_Register(userData: c_ptr(void),
+                                      self: OTF2_MetricRef,
+                                      metricClass: OTF2_MetricRef,
+                                      recorder: OTF2_LocationRef,
+                                      metricScope: OTF2_MetricScope,
+                                      scope: c_uint64): OTF2_CallbackCode {
+    var defsPtr = userData: c_ptr(DefinitionStore);
+    if defsPtr == nil then return OTF2_CALLBACK_ERROR;
+    defsPtr.deref().addMetricInstance(self, metricClass, recorder);
+    return OTF2_CALLBACK_SUCCESS;
+  }
+
+  proc GlobDefMetricClassRecorder_Register(userData: c_ptr(void),
+                                           metric: OTF2_MetricRef,
+                                           recorder: OTF2_LocationRef): OTF2_CallbackCode {
+    var defsPtr = userData: c_ptr(DefinitionStore);
+    if defsPtr == nil then return OTF2_CALLBACK_ERROR;
+    defsPtr.deref().addMetricClassRecorder(metric, recorder);
+    return OTF2_CALLBACK_SUCCESS;
+  }
+
+  // Register all definition callbacks above, read the global definitions of
+  // the archive into defs and resolve the derived names.
+  // Returns the number of definitions read.
+  proc readGlobalDefinitions(reader: c_ptr(OTF2_Reader), ref defs: DefinitionStore): c_uint64 {
+    var globalDefReader = OTF2_Reader_GetGlobalDefReader(reader);
+    var defCallbacks = OTF2_GlobalDefReaderCallbacks_New();
+    OTF2_GlobalDefReaderCallbacks_SetClockPropertiesCallback(defCallbacks, c_ptrTo(registerClockProperties): c_fn_ptr);
+    OTF2_GlobalDefReaderCallbacks_SetStringCallback(defCallbacks, c_ptrTo(GlobDefString_Register): c_fn_ptr);
+    OTF2_GlobalDefReaderCallbacks_SetLocationGroupCallback(defCallbacks, c_ptrTo(GlobDefLocationGroup_Register): c_fn_ptr);
+    OTF2_GlobalDefReaderCallbacks_SetLocationCallback(defCallbacks, c_ptrTo(GlobDefLocation_Register): c_fn_ptr);
+    OTF2_GlobalDefReaderCallbacks_SetRegionCallback(defCallbacks, c_ptrTo(GlobDefRegion_Register): c_fn_ptr);
+    OTF2_GlobalDefReaderCallbacks_SetMetricMemberCallback(defCallbacks, c_ptrTo(GlobDefMetricMember_Register): c_fn_ptr);
+    OTF2_GlobalDefReaderCallbacks_SetMetricClassCallback(defCallbacks, c_ptrTo(GlobDefMetricClass_Register): c_fn_ptr);
+    OTF2_GlobalDefReaderCallbacks_SetMetricInstanceCallback(defCallbacks, c_ptrTo(GlobDefMetricInstance_Register): c_fn_ptr);
+    OTF2_GlobalDefReaderCallbacks_SetMetricClassRecorderCallback(defCallbacks, c_ptrTo(GlobDefMetricClassRecorder_Register): c_fn_ptr);
+
+    OTF2_Reader_RegisterGlobalDefCallbacks(reader,
+                                           globalDefReader,
+                                           defCallbacks,
+                                           c_ptrTo(defs): c_ptr(void));
+    OTF2_GlobalDefReaderCallbacks_Delete(defCallbacks);
+
+    var definitionsRead: c_uint64 = 0;
+    OTF2_Reader_ReadAllGlobalDefinitions(reader, globalDefReader, c_ptrTo(definitionsRead));
+    defs.finalize();
+    return definitionsRead;
+  }
+
+  // Open the archive at path, read its global definitions into a new store
+  // and close it again. On multi-locale runs every locale calls this to build
+  // its own copy of the tables, so event callbacks only touch local memory
+  // and nothing has to be copied element by element from locale 0.
+  proc loadGlobalDefinitions(path: string): DefinitionStore {
+    var defs = new DefinitionStore();
+    var reader = OTF2_Reader_Open(path.c_str());
+    if reader == nil then
+      halt("Failed to open trace ", path, " on locale ", here.id);
+    OTF2_Reader_SetSerialCollectiveCallbacks(reader);
+    readGlobalDefinitions(reader, defs);
+    OTF2_Reader_Close(reader);
+    return defs;
+  }
+}
@@ -0,0 +1,146 @@
+// Copyright Hewlett Packard Enterprise Development LP.
+
+/*
+ * Event-count-weighted partitioning of OTF2 locations across readers
+ *
+ * Every Location definition carries the number of events recorded for that
+ * location. Handing out equal *numbers* of locations to each reader ignores
+ * that, and on real traces a few locations (usually the master threads of
+ * each rank) hold most of the events. The helpers in this module use the
+ * event counts as weights instead.
+ *
+ *  - lptPartition: static greedy bin-packing (Longest Processing Time first).
+ *    Locations are sorted by descending weight and each one is placed in the
+ *    currently lightest bin. Useful when the assignment has to be fixed up
+ *    front, e.g. one reader per locale.
+ *
+ *  - LocationWorkQueue: dynamic scheduling. Locations are handed out
+ *    heaviest first in batches whose weight shrinks with the remaining work
+ *    (guided self-scheduling), so tasks that finish early keep pulling the
+ *    leftover light locations and wall time tracks total work rather than
+ *    the heaviest static bin.
+ *
+ * Usage example:
+ *   const parts = lptPartition(locationArray, locationWeights, numReaders);
+ *   // or
+ *   var queue = new LocationWorkQueue(locationArray, locationWeights, numReaders);
+ *   coforall i in 0..<numReaders do
+ *     for batch in queue.batches() do
+ *       readLocations(queue.locationsIn(batch));
+ */
+module LocationPartition {
+  use List;
+  use Sort;
+  use OTF2_GeneralDefinitions;
+
+  // Fixed cost charged to every location on top of its event count, so that
+  // locations without events still account for opening their event file
+  param perLocationCost: uint(64) = 1;
+
+  record weightedLocation {
+    var loc: OTF2_LocationRef;
+    var weight: uint(64);
+  }
+
+  // Heaviest first, ties broken by location ref so the result is deterministic
+  record heavierFirstComparator : relativeComparator {}
+  proc heavierFirstComparator.compare(x: weightedLocation, y: weightedLocation): int {
+    if x.weight > y.weight then return -1;
+    else if x.weight < y.weight then return 1;
+    else if x.loc < y.loc then return -1;
+    else if x.loc > y.loc then return 1;
+    else return 0;
+  }
+
+  // Pair each location with its weight and sort heaviest first
+  proc sortByWeight(const ref locs: [] OTF2_LocationRef,
+                    const ref weights: [] uint(64)): [] weightedLocation {
+    if locs.size != weights.size then
+      halt("sortByWeight: got ", locs.size, " locations but ", weights.size, " weights");
+    const n = locs.size;
+    var order: [0..<n] weightedLocation;
+    for (w, l, c) in zip(order, locs, weights) {
+      w = new weightedLocation(l, c + perLocationCost);
+    }
+    sort(order, comparator = new heavierFirstComparator());
+    return order;
+  }
+
+  // Static LPT bin-packing of locations into numParts bins
+  proc lptPartition(const ref locs: [] OTF2_LocationRef,
+                    const ref weights: [] uint(64),
+                    numParts: int): [] list(OTF2_LocationRef) {
+    if numParts < 1 then
+      halt("lptPartition: numParts must be positive, got ", numParts);
+    var parts: [0..<numParts] list(OTF2_LocationRef);
+    var load: [0..<numParts] uint(64);
+    for wl in sortByWeight(locs, weights) {
+      // numParts is small (tasks or locales), a linear scan is cheaper than a heap
+      var lightest = 0;
+      for p in 1..<numParts {
+        if load[p] < load[lightest] then lightest = p;
+      }
+      parts[lightest].pushBack(wl.loc);
+      load[lightest] += wl.weight;
+    }
+    return parts;
+  }
+
+  // Shared queue of locations for dynamic scheduling across tasks
+  class LocationWorkQueue {
+    const numTasks: int;
+    const n: int;
+    const order: [0..<n] weightedLocation;
+    // remaining[i] is the total weight of order[i..]
+    const remaining: [0..n] uint(64);
+    var cursor: atomic int;
+
+    proc init(const ref locs: [] OTF2_LocationRef,
+              const ref weights: [] uint(64),
+              numTasks: int) {
+      this.numTasks = max(numTasks, 1);
+      this.n = locs.size;
+      this.order = sortByWeight(locs, weights);
+      var rem: [0..n] uint(64);
+      for i in 0..<n by -1 do rem[i] = rem[i+1] + order[i].weight;
+      this.remaining = rem;
+    }
+
+    // Claim the next batch of positions in the queue, empty when exhausted.
+    // A batch holds roughly remaining / (2 * numTasks) weight and at least one
+    // location, so heavy locations are handed out alone and early, and the
+    // light tail is handed out in progressively smaller pieces.
+    proc claimBatch(): range {
+      var lo = cursor.read();
+      while lo < n {
+        const target = max(remaining[lo] / (2 * numTasks): uint(64), 1: uint(64));
+        var hi = lo;
+        var acc: uint(64) = 0;
+        do {
+          acc += order[hi].weight;
+          hi += 1;
+        } while hi < n && acc < target;
+        // On failure lo is updated to the current cursor and we retry
+        if cursor.compareExchange(lo, hi) then
+          return lo..<hi;
+      }
+      return 0..<0;
+    }
+
+    iter batches(): range {
+      while true {
+        const batch = claimBatch();
+        if batch.size == 0 then break;
+        yield batch;
+      }
+    }
+
+    proc locationsIn(batch: range): [] OTF2_LocationRef {
+      return [i in batch] order[i].loc;
+    }
+
+    proc totalWeight(): uint(64) {
+      return remaining[0];
+    }
+  }
+}
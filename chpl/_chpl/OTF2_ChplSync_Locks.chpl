@@ -2,10 +2,16 @@
 
 /*
  * Chapel Sync Variable-based Locking for OTF2
- * 
+ *
  * This module provides Chapel sync variable-based locking callbacks for OTF2
  * to enable safe parallel reading of OTF2 files in Chapel.
- * 
+ *
+ * Every OTF2 lock is a heap-allocated OTF2_LockObject owned by OTF2: it is
+ * created by the create callback and deleted by the destroy callback, which
+ * OTF2 calls when the reader (or archive) is closed. The sync variable is
+ * full while the lock is free, so lock and unlock are a readFE/writeEF pair
+ * that blocks the Chapel task, not the worker thread.
+ *
  * Usage example:
  *   var reader = OTF2_Reader_Open(...);
  *   otf2ChplSyncReaderSetLockingCallbacks(reader);
@@ -22,28 +28,22 @@ module OTF2_ChplSync_Locks {
 
   // Chapel sync variable-based lock object
   // Note: Using OTF2 naming convention to match C API expectations
-  record OTF2_LockObject {
-    var syncVar: sync bool;
-    proc init (){}
+  class OTF2_LockObject {
+    // Full (true) while the lock is free
+    var syncVar: sync bool = true;
+  }
+
+  private inline proc lockObjectOf(lock: OTF2_Lock): unmanaged OTF2_LockObject? {
+    return lock: unmanaged OTF2_LockObject?;
   }
 
   // Create a new lock using Chapel sync variables
   // Note: userData parameter is required by C API but unused in this implementation
   export proc otf2ChplLockCreate(userData: c_ptr(void),
                           ref lock: OTF2_Lock): OTF2_CallbackCode {
-    writeln("=========================");
-    writeln("Created LOCK IN CHAPEL");
-
-    // Create a new lock object - Chapel handles memory management
-    ref lockObj = new OTF2_LockObject();
-
-    // Initialize the sync variable as unlocked (full)
-    lockObj.syncVar.writeEF(true);
-
-    // Set the lock pointer to point to our lock object
-    lock = c_ptrTo(lockObj): OTF2_Lock;
-
-    writeln("=========================");
+    // Freed by otf2ChplLockDestroy
+    const lockObj = new unmanaged OTF2_LockObject();
+    lock = lockObj: OTF2_Lock;
     return OTF2_CALLBACK_SUCCESS;
   }
 
@@ -51,17 +51,9 @@ module OTF2_ChplSync_Locks {
   // Note: userData parameter is required by C API but unused in this implementation
   export proc otf2ChplLockDestroy(userData: c_ptr(void),
                            in lock: OTF2_Lock): OTF2_CallbackCode {
-    writeln("=========================");
-    writeln("Destroyed LOCK IN CHAPEL");
-
-    if lock == nil {
-      writeln("LOCK IS nil");
-      return OTF2_CALLBACK_ERROR;
-    }
-
-    // Chapel will handle memory cleanup automatically
-    // No explicit deallocation needed
-    writeln("=========================");
+    const lockObj = lockObjectOf(lock);
+    if lockObj == nil then return OTF2_CALLBACK_ERROR;
+    delete lockObj;
     return OTF2_CALLBACK_SUCCESS;
   }
 
@@ -69,24 +61,9 @@ module OTF2_ChplSync_Locks {
   // Note: userData parameter is required by C API but unused in this implementation
   export proc otf2ChplLockLock(userData: c_ptr(void),
                         in lock: OTF2_Lock): OTF2_CallbackCode {
-    writeln("=========================");
-    writeln("Acquiring LOCK IN CHAPEL");
-    if lock == nil {
-      writeln("LOCK IS nil");
-      return OTF2_CALLBACK_ERROR;
-    }
-
-    // lock is already a pointer to OTF2_LockObject
-    ref lockObj = (lock:c_ptr(OTF2_LockObject)).deref();
-    ref lockSyncVar = lockObj.syncVar;
-
-
-    writeln("About to call readFE() to acquire lock...");
-    // Read from the sync variable to lock
-    var val = lockSyncVar.readFE();
-    writeln("Successfully acquired lock, read value: ", val);
-
-    writeln("=========================");
+    const lockObj = lockObjectOf(lock);
+    if lockObj == nil then return OTF2_CALLBACK_ERROR;
+    lockObj!.syncVar.readFE();
     return OTF2_CALLBACK_SUCCESS;
   }
 
@@ -94,34 +71,33 @@ module OTF2_ChplSync_Locks {
   // Note: userData parameter is required by C API but unused in this implementation
   export proc otf2ChplLockUnlock(userData: c_ptr(void),
                           in lock: OTF2_Lock): OTF2_CallbackCode {
-    writeln("=========================");
-    writeln("Releasing LOCK IN CHAPEL");
-    if lock == nil {
-      writeln("LOCK IS nil");
-      return OTF2_CALLBACK_ERROR;
-    }
-
-    // lock is already a pointer to OTF2_LockObject
-    ref lockObj = (lock:c_ptr(OTF2_LockObject)).deref();
-    ref lockSyncVar = lockObj.syncVar;
-
-    writeln("About to call writeEF(true) to release lock...");
-    // write to sync var to unlock
-    lockSyncVar.writeEF(true);
-    writeln("Successfully released lock");
-
-    writeln("=========================");
+    const lockObj = lockObjectOf(lock);
+    if lockObj == nil then return OTF2_CALLBACK_ERROR;
+    lockObj!.syncVar.writeEF(true);
     return OTF2_CALLBACK_SUCCESS;
   }
 
-  // Chapel locking callbacks structure
-  ref otf2ChplLockingCallbacks = new OTF2_LockingCallbacks(
-    otf2_release = nil,  // No release callback needed
-    otf2_create = c_ptrTo(otf2ChplLockCreate):OTF2_Locking_Create,
-    otf2_destroy = c_ptrTo(otf2ChplLockDestroy):OTF2_Locking_Destroy,
-    otf2_lock = c_ptrTo(otf2ChplLockLock):OTF2_Locking_Lock,
-    otf2_unlock = c_ptrTo(otf2ChplLockUnlock):OTF2_Locking_Unlock
-  );
+  // Free the callbacks of newLockingCallbacks, which are their own userData.
+  // OTF2 calls this when the reader or archive they were set on is closed.
+  export proc otf2ChplLockRelease(userData: c_ptr(void)) {
+    deallocate(userData);
+  }
+
+  // Locking callbacks allocated on the calling locale. OTF2 keeps the
+  // pointer for as long as the reader is open, so it has to point to memory
+  // of the locale using the reader (a module-level variable lives on locale
+  // 0) and stay valid until otf2ChplLockRelease frees it.
+  private proc newLockingCallbacks(): c_ptr(OTF2_LockingCallbacks) {
+    var callbacks = allocate(OTF2_LockingCallbacks, 1);
+    callbacks.deref() = new OTF2_LockingCallbacks(
+      otf2_release = c_ptrTo(otf2ChplLockRelease):OTF2_Locking_Release,
+      otf2_create = c_ptrTo(otf2ChplLockCreate):OTF2_Locking_Create,
+      otf2_destroy = c_ptrTo(otf2ChplLockDestroy):OTF2_Locking_Destroy,
+      otf2_lock = c_ptrTo(otf2ChplLockLock):OTF2_Locking_Lock,
+      otf2_unlock = c_ptrTo(otf2ChplLockUnlock):OTF2_Locking_Unlock
+    );
+    return callbacks;
+  }
 
   // Set locking callbacks for an OTF2 archive
   proc otf2ChplSyncArchiveSetLockingCallbacks(archive: c_ptr(OTF2_Archive)): OTF2_ErrorCode {
@@ -129,20 +105,24 @@ module OTF2_ChplSync_Locks {
       return OTF2_ERROR_INVALID_ARGUMENT;
     }
 
-    return OTF2_Archive_SetLockingCallbacks(archive,
-                                           c_ptrTo(otf2ChplLockingCallbacks),
-                                           nil);
+    const callbacks = newLockingCallbacks();
+    const status = OTF2_Archive_SetLockingCallbacks(archive, callbacks, callbacks: c_ptr(void));
+    if status != OTF2_SUCCESS then deallocate(callbacks);
+    return status;
   }
 
-  // Set locking callbacks for an OTF2 reader
+  // Set locking callbacks for an OTF2 reader. Call this right after opening
+  // the reader, before any definition or event file is opened, and do not
+  // share the reader between tasks unless it returns OTF2_SUCCESS.
   proc otf2ChplSyncReaderSetLockingCallbacks(reader: c_ptr(OTF2_Reader)): OTF2_ErrorCode {
     if reader == nil {
       return OTF2_ERROR_INVALID_ARGUMENT;
     }
 
-    return OTF2_Reader_SetLockingCallbacks(reader,
-                                          c_ptrTo(otf2ChplLockingCallbacks),
-                                          nil);
+    const callbacks = newLockingCallbacks();
+    const status = OTF2_Reader_SetLockingCallbacks(reader, callbacks, callbacks: c_ptr(void));
+    if status != OTF2_SUCCESS then deallocate(callbacks);
+    return status;
   }
 
 }
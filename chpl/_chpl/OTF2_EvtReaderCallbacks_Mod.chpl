@@ -88,5 +88,10 @@ module OTF2_EvtReaderCallbacks_Mod {
     mpiCollectiveEndCallback: c_fn_ptr
   ): OTF2_ErrorCode;
 
+  extern proc OTF2_EvtReaderCallbacks_SetMetricCallback(
+    evtReaderCallbacks: c_ptr(OTF2_EvtReaderCallbacks),
+    metricCallback: c_fn_ptr
+  ): OTF2_ErrorCode;
+
   /// There's like 200 more TODO callbacks to add
 }
\ No newline at end of file
@@ -71,6 +71,20 @@ module OTF2_GeneralDefinitions {
 
   // Paradigms
   extern type OTF2_Paradigm = c_uint8;
+  extern const OTF2_PARADIGM_UNKNOWN: OTF2_Paradigm;
+  extern const OTF2_PARADIGM_USER: OTF2_Paradigm;
+  extern const OTF2_PARADIGM_COMPILER: OTF2_Paradigm;
+  extern const OTF2_PARADIGM_OPENMP: OTF2_Paradigm;
+  extern const OTF2_PARADIGM_MPI: OTF2_Paradigm;
+  extern const OTF2_PARADIGM_CUDA: OTF2_Paradigm;
+  extern const OTF2_PARADIGM_MEASUREMENT_SYSTEM: OTF2_Paradigm;
+  extern const OTF2_PARADIGM_PTHREAD: OTF2_Paradigm;
+  extern const OTF2_PARADIGM_SHMEM: OTF2_Paradigm;
+  extern const OTF2_PARADIGM_OPENACC: OTF2_Paradigm;
+  extern const OTF2_PARADIGM_OPENCL: OTF2_Paradigm;
+  extern const OTF2_PARADIGM_SAMPLING: OTF2_Paradigm;
+  extern const OTF2_PARADIGM_NONE: OTF2_Paradigm;
+  extern const OTF2_PARADIGM_HIP: OTF2_Paradigm;
 
   // Comm refs
   extern type OTF2_CommRef = c_uint32;
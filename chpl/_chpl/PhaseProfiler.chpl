@@ -0,0 +1,252 @@
+// Copyright Hewlett Packard Enterprise Development LP.
+
+/*
+ * Phase timing and reader counters for the OTF2 programs
+ *
+ * A Profiler records where a run spends its time: the wall time of each
+ * phase (opening the archive, definitions, event reading, merge, output),
+ * and for every reader task its wall time, the locations and events it
+ * read, the events each callback type saw and the size of the event files
+ * behind them. finish() writes all of it as JSON together with the peak
+ * resident set size of every locale, so task skew, merge cost and output
+ * cost can be compared between runs.
+ *
+ * The profiler lives on locale 0. Reader tasks count events in their own
+ * callback contexts and report them once, with addTask, when they are done;
+ * the callbacks never touch the profiler.
+ *
+ * Usage example:
+ *   profiler.enable("otf2_read_events_parallel", profilePath);
+ *   profiler.phase("open");
+ *   ...
+ *   profiler.phase("read events");
+ *   coforall i in 0..<numReaders {
+ *     ...
+ *     if profiler.enabled then profiler.addTask(new taskProfile(...));
+ *   }
+ *   profiler.finish();   // writes profilePath, if one was given
+ */
+module PhaseProfiler {
+  use Time;
+  use List;
+  use IO;
+  use Path;
+  use FileSystem;
+  use Sort;
+  use OTF2_GeneralDefinitions;
+
+  // Events seen by each callback type
+  record eventCounts {
+    var enter: uint(64);
+    var leave: uint(64);
+    var metric: uint(64);
+
+    proc total: uint(64) {
+      return enter + leave + metric;
+    }
+  }
+
+  operator +=(ref lhs: eventCounts, const ref rhs: eventCounts) {
+    lhs.enter += rhs.enter;
+    lhs.leave += rhs.leave;
+    lhs.metric += rhs.metric;
+  }
+
+  // What one reader task did
+  record taskProfile {
+    var localeId: int;
+    var task: int;
+    var seconds: real;
+    var locations: int;
+    // Events returned by the OTF2 reader, of any type
+    var events: uint(64);
+    var callbacks: eventCounts;
+    var bytesRead: uint(64);
+  }
+
+  record phaseTime {
+    var name: string;
+    var localeId: int;
+    var seconds: real;
+  }
+
+  record localeAndTaskComparator : keyComparator {}
+  proc localeAndTaskComparator.key(t: taskProfile) {
+    return (t.localeId, t.task);
+  }
+
+  class Profiler {
+    var program: string;
+    // Where finish() writes the JSON, nothing is written when empty
+    var path: string;
+    var phases: list(phaseTime);
+    var tasks: list(taskProfile);
+    // Guards phases and tasks, full while free
+    var lock: sync bool = true;
+    var total: stopwatch;
+    var current: stopwatch;
+    var currentPhase: string;
+
+    proc enabled: bool {
+      return path != "";
+    }
+
+    // Start timing the run; the JSON goes to path unless it is empty
+    proc enable(program: string, path: string) {
+      this.program = program;
+      this.path = path;
+      total.clear();
+      total.start();
+    }
+
+    // End the current phase, if any, and start timing the next one
+    proc phase(name: string) {
+      endPhase();
+      currentPhase = name;
+      current.clear();
+      current.start();
+    }
+
+    // End the current phase and return its wall time
+    proc endPhase(): real {
+      if currentPhase == "" then return 0.0;
+      const seconds = current.elapsed();
+      current.stop();
+      addPhase(currentPhase, seconds);
+      currentPhase = "";
+      return seconds;
+    }
+
+    // Record a phase timed elsewhere, e.g. on another locale
+    proc addPhase(name: string, seconds: real) {
+      const p = new phaseTime(name, here.id, seconds);
+      on this {
+        lock.readFE();
+        phases.pushBack(p);
+        lock.writeEF(true);
+      }
+    }
+
+    proc addTask(t: taskProfile) {
+      on this {
+        lock.readFE();
+        tasks.pushBack(t);
+        lock.writeEF(true);
+      }
+    }
+
+    // End the last phase and write the profile, if enabled
+    proc finish() throws {
+      endPhase();
+      total.stop();
+      if !enabled then return;
+      writeJSON();
+    }
+
+    proc writeJSON() throws {
+      var peakRss: [0..<numLocales] int;
+      coforall loc in Locales with (ref peakRss) do on loc do
+        peakRss[loc.id] = peakRssKb();
+
+      var byTask = tasks.toArray();
+      sort(byTask, comparator=new localeAndTaskComparator());
+
+      var events: uint(64) = 0;
+      var callbacks: eventCounts;
+      var bytesRead: uint(64) = 0;
+      var minSeconds = 0.0, maxSeconds = 0.0, sumSeconds = 0.0;
+      for (t, i) in zip(byTask, 0..) {
+        events += t.events;
+        callbacks += t.callbacks;
+        bytesRead += t.bytesRead;
+        minSeconds = if i == 0 then t.seconds else min(minSeconds, t.seconds);
+        maxSeconds = max(maxSeconds, t.seconds);
+        sumSeconds += t.seconds;
+      }
+      const meanSeconds = if byTask.size > 0 then sumSeconds / byTask.size else 0.0;
+
+      var f = open(path, ioMode.cw);
+      var w = f.writer(locking=false);
+      w.writeln("{");
+      w.writeln('  "program": ', jsonString(program), ",");
+      w.writeln('  "locales": ', numLocales, ",");
+      w.writeln('  "totalSeconds": ', total.elapsed(), ",");
+      w.writeln('  "phases": [');
+      for (p, i) in zip(phases, 0..) {
+        w.write('    {"name": ', jsonString(p.name), ', "locale": ', p.localeId,
+                ', "seconds": ', p.seconds, "}");
+        w.writeln(if i < phases.size - 1 then "," else "");
+      }
+      w.writeln("  ],");
+      w.writeln('  "tasks": [');
+      for (t, i) in zip(byTask, 0..) {
+        w.write('    {"locale": ', t.localeId, ', "task": ', t.task,
+                ', "seconds": ', t.seconds, ', "locations": ', t.locations,
+                ', "events": ', t.events, ', "callbacks": ', countsJSON(t.callbacks),
+                ', "bytesRead": ', t.bytesRead, "}");
+        w.writeln(if i < byTask.size - 1 then "," else "");
+      }
+      w.writeln("  ],");
+      w.writeln('  "summary": {');
+      w.writeln('    "tasks": ', byTask.size, ",");
+      w.writeln('    "events": ', events, ",");
+      w.writeln('    "callbacks": ', countsJSON(callbacks), ",");
+      w.writeln('    "bytesRead": ', bytesRead, ",");
+      w.writeln('    "eventsPerSecond": ', rate(events, total.elapsed()), ",");
+      w.writeln('    "bytesPerSecond": ', rate(bytesRead, total.elapsed()), ",");
+      w.writeln('    "taskSecondsMin": ', minSeconds, ",");
+      w.writeln('    "taskSecondsMean": ', meanSeconds, ",");
+      w.writeln('    "taskSecondsMax": ', maxSeconds, ",");
+      // Slowest task over the mean, 1 when the readers are balanced
+      w.writeln('    "taskSkew": ', if meanSeconds > 0.0 then maxSeconds / meanSeconds else 0.0);
+      w.writeln("  },");
+      w.writeln('  "peakRssKb": [', ", ".join([r in peakRss] r: string), "]");
+      w.writeln("}");
+      w.close();
+      f.close();
+    }
+  }
+
+  // The profiler of this program
+  var profiler = new Profiler();
+
+  // Size of the event file of a location. The event files of an archive
+  // with anchor file dir/traces.otf2 are dir/traces/<location>.evt; a
+  // missing file counts as empty.
+  proc eventFileBytes(trace: string, loc: OTF2_LocationRef): uint(64) {
+    const (dir, anchor) = splitPath(trace);
+    const archive = if anchor.endsWith(".otf2") then anchor[0..<anchor.size - 5] else anchor;
+    try {
+      return getFileSize(joinPath(dir, archive, loc: string + ".evt")): uint(64);
+    } catch {
+      return 0;
+    }
+  }
+
+  // Peak resident set size of this process in kB, -1 where /proc is missing
+  proc peakRssKb(): int {
+    try {
+      var f = open("/proc/self/status", ioMode.r);
+      var r = f.reader(locking=false);
+      for line in r.lines() {
+        if line.startsWith("VmHWM:") then
+          return line.replace("VmHWM:", "").replace("kB", "").strip(): int;
+      }
+    } catch {
+    }
+    return -1;
+  }
+
+  private proc rate(count: uint(64), seconds: real): real {
+    return if seconds > 0.0 then count / seconds else 0.0;
+  }
+
+  private proc countsJSON(const ref c: eventCounts): string {
+    return '{"enter": ' + c.enter: string + ', "leave": ' + c.leave: string +
+           ', "metric": ' + c.metric: string + "}";
+  }
+
+  private proc jsonString(s: string): string {
+    return '"' + s.replace("\\", "\\\\").replace('"', '\\"') + '"';
+  }
+}
@@ -0,0 +1,97 @@
+// Copyright Hewlett Packard Enterprise Development LP.
+
+/*
+ * Time window of the events to extract
+ *
+ * A window is given in seconds on the same scale as timestampToSeconds, i.e.
+ * relative to the global offset of the trace clock. It is resolved once
+ * against the clock properties into a range of raw OTF2 ticks, so the
+ * callbacks compare each event timestamp with two integers and only convert
+ * to seconds for the events they keep.
+ *
+ * Both a location's local event reader and the global event reader deliver
+ * events in time order, so a callback seeing an event past the end can
+ * return OTF2_CALLBACK_INTERRUPT: no later event of that reader is in the
+ * window either.
+ *
+ * Usage example:
+ *   const window = new timeWindow(start, end, defs.clockProps);
+ *   if window.isAfter(time) then return OTF2_CALLBACK_INTERRUPT;
+ *   if window.isBefore(time) then ...   // only rebuild the call stack
+ *   if window.endsBefore(time) then ... // a leave that closes nothing inside
+ */
+module TimeWindow {
+  use DefinitionStore;
+  use OTF2_GeneralDefinitions;
+  import Math.inf;
+
+  record timeWindow {
+    // Bounds in seconds, -inf/inf when open
+    var start: real = -inf;
+    var end: real = inf;
+    // The same bounds in ticks: timestampToSeconds(ts) lies in [start, end]
+    // exactly when startTicks <= ts <= endTicks
+    var startTicks: OTF2_TimeStamp = 0;
+    var endTicks: OTF2_TimeStamp = max(OTF2_TimeStamp);
+
+    proc init() {}
+
+    proc init(start: real, end: real, const ref clockProps: ClockProperties) {
+      this.start = start;
+      this.end = end;
+      if clockProps.timerResolution == 0 {
+        // Every timestamp maps to 0 seconds, so the window keeps all or nothing
+        const keepsAll = start <= 0.0 && 0.0 <= end;
+        this.startTicks = if keepsAll then 0 else max(OTF2_TimeStamp);
+        this.endTicks = if keepsAll then max(OTF2_TimeStamp) else 0;
+      } else {
+        this.startTicks = secondsToTicks(start, clockProps, roundUp=true);
+        this.endTicks = secondsToTicks(end, clockProps, roundUp=false);
+      }
+    }
+
+    inline proc isBefore(ts: OTF2_TimeStamp): bool {
+      return ts < startTicks;
+    }
+
+    // True if a region left at ts has no time inside the window: it ends at
+    // or before the start, and getIntervalsBetween would drop it as well
+    inline proc endsBefore(ts: OTF2_TimeStamp): bool {
+      return hasStart && ts <= startTicks;
+    }
+
+    inline proc isAfter(ts: OTF2_TimeStamp): bool {
+      return ts > endTicks;
+    }
+
+    proc hasStart: bool {
+      return start > -inf;
+    }
+
+    proc hasEnd: bool {
+      return end < inf;
+    }
+
+    proc isBounded: bool {
+      return hasStart || hasEnd;
+    }
+  }
+
+  // The first (roundUp) or last tick at or inside the given number of seconds
+  // after the global offset, saturated to the range of OTF2_TimeStamp. The
+  // offset is added as an integer, real arithmetic would lose the low bits of
+  // large absolute timestamps.
+  private proc secondsToTicks(seconds: real, const ref clockProps: ClockProperties,
+                              roundUp: bool): OTF2_TimeStamp {
+    const maxTicks = max(OTF2_TimeStamp);
+    const offset = clockProps.globalOffset;
+    const scaled = seconds * clockProps.timerResolution;
+    const delta = if roundUp then ceil(scaled) else floor(scaled);
+    if delta >= 0.0 {
+      if delta >= (maxTicks - offset): real then return maxTicks;
+      return offset + delta: OTF2_TimeStamp;
+    }
+    if -delta >= offset: real then return 0;
+    return offset - (-delta): OTF2_TimeStamp;
+  }
+}
@@ -0,0 +1,717 @@
+// Copyright Hewlett Packard Enterprise Development LP.
+
+/*
+ * Sidecar cache of what was decoded from a trace
+ *
+ * Every run of a reader decodes the global definitions and all event buffers
+ * of the archive again. With --cache the programs keep what they decoded in
+ * a binary sidecar next to the anchor file (dir/traces.otf2 ->
+ * dir/traces.otf2cache), and later runs map that file into memory instead
+ * of decoding the archive:
+ *
+ *  - the global definitions, as the DefinitionStore tables
+ *  - per location: its event count, the size and modification time of its
+ *    event file, and the offsets of its blocks in the sidecar
+ *  - the event totals of a complete read (events, enters, leaves)
+ *  - per location, the call graph intervals as columns (starts, ends,
+ *    depths, regions) and its metric series as one encoded blob, together
+ *    with a key of the options they were extracted with
+ *
+ * A sidecar is only used while the size and modification time of the anchor
+ * file, the global definition file and every event file are the ones
+ * recorded in it; otherwise openTraceCache ignores it and the next run that
+ * writes one replaces it. Writers put the new sidecar in place by renaming,
+ * so a reader never maps a partial one. Sections a run does not produce are
+ * carried over from the previous sidecar, e.g. the call graphs of
+ * trace_to_csv when otf2_read_events adds the event totals.
+ *
+ * Layout, in 64-bit words of host byte order unless noted:
+ *   header    magic, version, (size, mtime) of the anchor and of the .def file
+ *   sections  definitions, interval columns, metric blobs, intervals key,
+ *             location table (entryWords per location); strings are a length
+ *             word and the bytes, and every section is padded to 8 bytes
+ *   footer    section offsets, number of locations, totals, magic
+ *
+ * Usage example:
+ *   var stamps = stampTrace(tracePath);      // before reading definitions
+ *   var cache = openTraceCache(tracePath);   // nil if missing or stale
+ *   if cache != nil && cache!.hasTotals then
+ *     writeln(cache!.eventsRead, " events");
+ *
+ *   stamps.stampEvents(tracePath, defs);     // before reading events
+ *   var w = createTraceCacheWriter(tracePath, defs, stamps);
+ *   w.setTotals(eventsRead, enterCount, leaveCount);
+ *   w.finish(cache.borrow());
+ */
+module TraceCache {
+  use OTF2;
+  use IO;
+  use Path;
+  use FileSystem;
+  use DefinitionStore;
+  import OS.POSIX;
+
+  require "sys/mman.h";
+  private extern proc mmap(addr: c_ptr(void), length: c_size_t, prot: c_int,
+                           flags: c_int, fd: c_int, offset: c_long): c_ptr(void);
+  private extern proc munmap(addr: c_ptr(void), length: c_size_t): c_int;
+  private extern const PROT_READ: c_int;
+  private extern const MAP_PRIVATE: c_int;
+  private extern const MAP_FAILED: c_ptr(void);
+
+  // "FOTF2CCH" as a little-endian word
+  private const cacheMagic: uint(64) = 0x4843433246544f46;
+  // Bump whenever the layout changes, older sidecars are then ignored
+  private const cacheVersion: uint(64) = 1;
+  private param headerWords = 6;
+  private param footerWords = 10;
+
+  // Location table entry: words per location and their meaning
+  private param entryWords = 9;
+  private param refField = 0;
+  private param eventsField = 1;
+  private param evtStampField = 2;   // size, then mtime
+  private param flagsField = 4;
+  private param intervalsField = 5;  // offset, then count
+  private param metricsField = 7;    // offset, then bytes
+
+  private param hasCallGraphFlag: uint(64) = 1;
+  private param inStartOrderFlag: uint(64) = 2;
+  private param hasMetricsFlag: uint(64) = 4;
+
+  // Size and modification time (ns) of a file, -1 for both if it is missing
+  record fileStamp {
+    var size: int = -1;
+    var mtimeNs: int = -1;
+  }
+
+  proc stampOf(path: string): fileStamp {
+    var st: POSIX.struct_stat;
+    if POSIX.stat(path.c_str(), c_ptrTo(st)) != 0 then return new fileStamp();
+    return new fileStamp(size=st.st_size: int,
+                         mtimeNs=st.st_mtim.tv_sec: int * 1_000_000_000 + st.st_mtim.tv_nsec: int);
+  }
+
+  // Directory and archive name of the anchor file dir/<archive>.otf2
+  private proc archiveOf(trace: string): (string, string) {
+    const (dir, anchor) = splitPath(trace);
+    const archive = if anchor.endsWith(".otf2") then anchor[0..<anchor.size - 5] else anchor;
+    return (dir, archive);
+  }
+
+  private proc definitionFile(trace: string): string {
+    const (dir, archive) = archiveOf(trace);
+    return joinPath(dir, archive + ".def");
+  }
+
+  private proc eventFile(trace: string, loc: OTF2_LocationRef): string {
+    const (dir, archive) = archiveOf(trace);
+    return joinPath(dir, archive, loc: string + ".evt");
+  }
+
+  // Stamps of the files of an archive, taken before they are decoded so a
+  // sidecar never vouches for a file that changed while it was read. The
+  // event files are stamped per location, in DefinitionStore order.
+  record traceStamps {
+    var anchor: fileStamp;
+    var definitions: fileStamp;
+    var eventDom: domain(1);
+    var events: [eventDom] fileStamp;
+  }
+
+  // Stamp the anchor and the definition file of trace; call before reading
+  // the definitions
+  proc stampTrace(trace: string): traceStamps {
+    var stamps: traceStamps;
+    stamps.anchor = stampOf(trace);
+    stamps.definitions = stampOf(definitionFile(trace));
+    return stamps;
+  }
+
+  // Stamp the event file of every location of defs; call before reading the
+  // events
+  proc ref traceStamps.stampEvents(trace: string, const ref defs: DefinitionStore) {
+    eventDom = {0..<defs.numLocations};
+    forall i in eventDom do events[i] = stampOf(eventFile(trace, defs.locations[i].id));
+  }
+
+  // Where the sidecar of the archive with the given anchor file lives
+  proc cachePath(trace: string): string {
+    const (dir, archive) = archiveOf(trace);
+    return joinPath(dir, archive + ".otf2cache");
+  }
+
+  private inline proc padded(n: int): int {
+    return (n + 7) / 8 * 8;
+  }
+
+  // A sidecar mapped into memory and checked against its archive, see
+  // openTraceCache. The definitions and the key are decoded while
+  // validating, the location blocks are read straight from the mapping; the
+  // file is unmapped when the object is deleted.
+  class MappedTraceCache {
+    const path: string;
+    const base: c_ptr(uint(8));
+    const size: int;
+    // From the footer
+    var definitionsOffset: int;
+    var keyOffset: int;
+    var locationsOffset: int;
+    var numLocations: int;
+    // Events of a complete, unwindowed read of all locations
+    var hasTotals: bool;
+    var eventsRead: uint(64);
+    var enterCount: uint(64);
+    var leaveCount: uint(64);
+    // True if the location blocks hold call graphs and metrics, extracted
+    // with the options described by intervalsKey()
+    var hasIntervals: bool;
+    var defs: DefinitionStore;
+    var key: string;
+    // Set by a read outside the mapping, which makes validate reject it
+    var outOfRange: bool;
+
+    deinit {
+      munmap(base: c_ptr(void), size: c_size_t);
+    }
+
+    // True if the n bytes at pos are inside the mapping, flags them otherwise
+    inline proc inRange(pos: int, n: int): bool {
+      if pos < 0 || n < 0 || pos > size - n {
+        outOfRange = true;
+        return false;
+      }
+      return true;
+    }
+
+    // The word at byte offset pos, 0 outside the mapping
+    inline proc word(pos: int): uint(64) {
+      var x: uint(64);
+      if !inRange(pos, 8) then return 0;
+      POSIX.memcpy(c_ptrTo(x): c_ptr(void), (base + pos): c_ptrConst(void), 8: c_size_t);
+      return x;
+    }
+
+    // The word at pos, advancing pos past it
+    inline proc next(ref pos: int): uint(64) {
+      const x = word(pos);
+      pos += 8;
+      return x;
+    }
+
+    proc nextString(ref pos: int): string {
+      const n = next(pos): int;
+      if !inRange(pos, n) then return "";
+      const s = try! string.createCopyingBuffer(base + pos, n, policy=decodePolicy.replace);
+      pos += padded(n);
+      return s;
+    }
+
+    // A table size at pos whose entries take at least minWords words each,
+    // 0 if that many do not fit in the rest of the mapping
+    proc nextCount(ref pos: int, minWords: int): int {
+      const n = next(pos): int;
+      if n < 0 || n > (size - pos) / (8 * minWords) {
+        outOfRange = true;
+        return 0;
+      }
+      return n;
+    }
+
+    inline proc entry(i: int, field: int): uint(64) {
+      return word(locationsOffset + 8 * (entryWords * i + field));
+    }
+
+    proc stampAt(pos: int): fileStamp {
+      return new fileStamp(size=word(pos): int, mtimeNs=word(pos + 8): int);
+    }
+
+    // Read the footer, compare every recorded file stamp with the archive,
+    // decode the definitions and key, and check that every section and block
+    // lies inside the mapping, so a truncated or corrupted sidecar is
+    // rejected instead of read past its end
+    proc validate(trace: string): bool {
+      if word(0) != cacheMagic || word(8) != cacheVersion then return false;
+      if stampAt(16) != stampOf(trace) || stampAt(32) != stampOf(definitionFile(trace)) then
+        return false;
+
+      var pos = size - 8 * footerWords;
+      definitionsOffset = next(pos): int;
+      keyOffset = next(pos): int;
+      locationsOffset = next(pos): int;
+      numLocations = next(pos): int;
+      hasTotals = next(pos) != 0;
+      eventsRead = next(pos);
+      enterCount = next(pos);
+      leaveCount = next(pos);
+      hasIntervals = next(pos) != 0;
+      if next(pos) != cacheMagic then return false;
+      const footerOffset = size - 8 * footerWords;
+      const headerBytes = 8 * headerWords;
+      if numLocations < 0 || numLocations > footerOffset / (8 * entryWords) ||
+         locationsOffset < headerBytes ||
+         locationsOffset > footerOffset - 8 * entryWords * numLocations then
+        return false;
+      for offset in (definitionsOffset, keyOffset) do
+        if offset < headerBytes || offset > footerOffset then return false;
+
+      for i in 0..<numLocations {
+        const evtStamp = stampAt(locationsOffset + 8 * (entryWords * i + evtStampField));
+        if evtStamp != stampOf(eventFile(trace, entry(i, refField))) then return false;
+        const n = intervalCount(i);
+        if n < 0 || n > size / 24 || !inRange(entry(i, intervalsField): int, 24 * n) ||
+           !inRange(entry(i, metricsField): int, metricsBytes(i)) then
+          return false;
+      }
+
+      defs = readDefinitions();
+      var keyPos = keyOffset;
+      key = nextString(keyPos);
+      return !outOfRange && defs.numLocations == numLocations;
+    }
+
+    // True if the archive files were the ones in stamps when this sidecar
+    // was written
+    proc matches(const ref stamps: traceStamps): bool {
+      if stampAt(16) != stamps.anchor || stampAt(32) != stamps.definitions ||
+         stamps.eventDom.size != numLocations then
+        return false;
+      for i in 0..<numLocations do
+        if stampAt(locationsOffset + 8 * (entryWords * i + evtStampField)) != stamps.events[i] then
+          return false;
+      return true;
+    }
+
+    // The global definitions, as readGlobalDefinitions left them
+    proc definitions() const ref : DefinitionStore {
+      return defs;
+    }
+
+    // Decode the definitions section, see TraceCacheWriter.writeDefinitions.
+    // Reads outside the mapping yield zeros and set outOfRange.
+    proc readDefinitions(): DefinitionStore {
+      var defs = new DefinitionStore();
+      var pos = definitionsOffset;
+
+      defs.clockProps.timerResolution = next(pos);
+      defs.clockProps.globalOffset = next(pos);
+      defs.clockProps.traceLength = next(pos);
+      defs.clockProps.realtimeTimestamp = next(pos);
+
+      defs.stringDom = {0..<nextCount(pos, 2)};
+      for s in defs.stringDom {
+        defs.stringDefined[s] = next(pos) != 0;
+        defs.strings[s] = nextString(pos);
+        if defs.stringDefined[s] then defs.numStrings += 1;
+      }
+
+      defs.regionDom = {0..<nextCount(pos, 4)};
+      for region in defs.regions {
+        region.defined = next(pos) != 0;
+        region.name = nextString(pos);
+        region.regionRole = next(pos): OTF2_RegionRole;
+        region.paradigm = next(pos): OTF2_Paradigm;
+        if region.defined then defs.numRegions += 1;
+      }
+
+      defs.locationGroupDom = {0..<nextCount(pos, 4)};
+      for group in defs.locationGroups {
+        group.defined = next(pos) != 0;
+        group.name = nextString(pos);
+        group.creatingLocationGroup = nextString(pos);
+        group.locationGroupType = next(pos): OTF2_LocationGroupType;
+        if group.defined then defs.numLocationGroups += 1;
+      }
+
+      defs.numLocations = nextCount(pos, 7);
+      defs.locationDom = {0..<defs.numLocations};
+      for loc in defs.locations {
+        loc.defined = true;
+        loc.id = next(pos);
+        loc.name = nextString(pos);
+        loc.group = next(pos): OTF2_LocationGroupRef;
+        loc.locationType = next(pos): OTF2_LocationType;
+        loc.numberOfEvents = next(pos);
+        loc.groupName = nextString(pos);
+        loc.processName = nextString(pos);
+      }
+      defs.indexLocations();
+
+      defs.metricMemberDom = {0..<nextCount(pos, 6)};
+      for member in defs.metricMembers {
+        member.defined = next(pos) != 0;
+        member.name = nextString(pos);
+        member.unit = nextString(pos);
+        member.metricType = next(pos): OTF2_MetricType;
+        member.mode = next(pos): OTF2_MetricMode;
+        member.valueType = next(pos): OTF2_Type;
+        if member.defined then defs.numMetricMembers += 1;
+      }
+
+      defs.metricClassDom = {0..<nextCount(pos, 5)};
+      for mc in defs.metricClasses {
+        mc.defined = next(pos) != 0;
+        mc.numberOfMetrics = next(pos): c_uint8;
+        mc.firstMember = next(pos): int;
+        mc.hasRecorder = next(pos) != 0;
+        mc.recorder = next(pos);
+        if mc.defined then defs.numMetricClasses += 1;
+      }
+
+      defs.numClassMembers = nextCount(pos, 1);
+      defs.classMemberDom = {0..<defs.numClassMembers};
+      for m in defs.classMembers do m = next(pos): OTF2_MetricMemberRef;
+
+      defs.metricInstanceDom = {0..<nextCount(pos, 3)};
+      for mi in defs.metricInstances {
+        mi.defined = next(pos) != 0;
+        mi.metricClass = next(pos): OTF2_MetricRef;
+        mi.recorder = next(pos);
+        if mi.defined then defs.numMetricInstances += 1;
+      }
+      return defs;
+    }
+
+    // The options the call graphs and metrics were extracted with
+    proc intervalsKey(): string {
+      return key;
+    }
+
+    // --- Location blocks, by index in DefinitionStore order ---
+
+    // Events of location i, as in its definition
+    proc numberOfEvents(i: int): uint(64) {
+      return entry(i, eventsField);
+    }
+
+    proc hasCallGraph(i: int): bool {
+      return (entry(i, flagsField) & hasCallGraphFlag) != 0;
+    }
+
+    proc intervalsInStartOrder(i: int): bool {
+      return (entry(i, flagsField) & inStartOrderFlag) != 0;
+    }
+
+    proc intervalCount(i: int): int {
+      return entry(i, intervalsField + 1): int;
+    }
+
+    proc hasMetrics(i: int): bool {
+      return (entry(i, flagsField) & hasMetricsFlag) != 0;
+    }
+
+    proc metricsBytes(i: int): int {
+      return entry(i, metricsField + 1): int;
+    }
+
+    // Copy the intervalCount(i) intervals of location i into the start of
+    // the given columns, which must be at least that long
+    proc copyIntervals(i: int, ref starts: [] real, ref ends: [] real,
+                       ref depths: [] int(32), ref regions: [] uint(32)) {
+      const n = intervalCount(i);
+      if n == 0 then return;
+      var pos = entry(i, intervalsField): int;
+      copyOut(c_ptrTo(starts[starts.domain.low]), pos, 8 * n);
+      copyOut(c_ptrTo(ends[ends.domain.low]), pos, 8 * n);
+      copyOut(c_ptrTo(depths[depths.domain.low]), pos, 4 * n);
+      copyOut(c_ptrTo(regions[regions.domain.low]), pos, 4 * n);
+    }
+
+    // Copy the metricsBytes(i) bytes of the metric blob of location i into
+    // the start of data
+    proc copyMetrics(i: int, ref data: [] uint(8)) {
+      const n = metricsBytes(i);
+      if n == 0 then return;
+      var pos = entry(i, metricsField): int;
+      copyOut(c_ptrTo(data[data.domain.low]), pos, n);
+    }
+
+    private proc copyOut(dst: c_ptr(void), ref pos: int, n: int) {
+      POSIX.memcpy(dst, (base + pos): c_ptrConst(void), n: c_size_t);
+      pos += n;
+    }
+  }
+
+  // Map the sidecar of trace. Returns nil if there is none, if it is not a
+  // sidecar of this version, if it is truncated or corrupted, or if the
+  // archive changed since it was written.
+  proc openTraceCache(trace: string): owned MappedTraceCache? {
+    const path = cachePath(trace);
+    const fd = POSIX.open(path.c_str(), POSIX.O_RDONLY);
+    if fd < 0 then return nil;
+    var st: POSIX.struct_stat;
+    const size = if POSIX.fstat(fd, c_ptrTo(st)) == 0 then st.st_size: int else 0;
+    var p: c_ptr(void) = nil;
+    if size >= 8 * (headerWords + footerWords) then
+      p = mmap(nil, size: c_size_t, PROT_READ, MAP_PRIVATE, fd, 0);
+    POSIX.close(fd);
+    if p == nil || p == MAP_FAILED then return nil;
+
+    var cache = new MappedTraceCache(path, p: c_ptr(uint(8)), size);
+    if !cache.validate(trace) then return nil;
+    return cache;
+  }
+
+  // Writes a new sidecar section by section, see createTraceCacheWriter.
+  // The current sidecar is only replaced when finish() renames the new one
+  // over it.
+  class TraceCacheWriter {
+    const trace: string;
+    const tmpPath: string;
+    const numLocations: int;
+    // Of the files the results were decoded from, see traceStamps
+    const stamps: traceStamps;
+    var outfile: file;
+    var writer: fileWriter(locking=false);
+    var definitionsOffset: int;
+    // Location table, filled as the definitions and blocks are written
+    var locationRefs: [0..<numLocations] OTF2_LocationRef;
+    var locationEvents: [0..<numLocations] uint(64);
+    var flags: [0..<numLocations] uint(64);
+    var intervalsOffset: [0..<numLocations] int;
+    var intervalCount: [0..<numLocations] int;
+    var metricsOffset: [0..<numLocations] int;
+    var metricsBytes: [0..<numLocations] int;
+    var hasIntervals: bool;
+    var intervalsKey: string;
+    var hasTotals: bool;
+    var eventsRead: uint(64);
+    var enterCount: uint(64);
+    var leaveCount: uint(64);
+
+    proc init(trace: string, numLocations: int, const ref stamps: traceStamps) throws {
+      this.trace = trace;
+      this.tmpPath = cachePath(trace) + ".tmp";
+      this.numLocations = numLocations;
+      this.stamps = stamps;
+      init this;
+      outfile = open(tmpPath, ioMode.cw);
+      writer = outfile.writer(locking=false);
+    }
+
+    proc putWord(x) throws {
+      writer.writeBinary(x: uint(64));
+    }
+
+    proc putString(s: string) throws {
+      putWord(s.numBytes);
+      writer.writeBinary(s: bytes);
+      pad();
+    }
+
+    proc putStamp(stamp: fileStamp) throws {
+      putWord(stamp.size);
+      putWord(stamp.mtimeNs);
+    }
+
+    proc pad() throws {
+      while writer.offset() % 8 != 0 do writer.writeBinary(0: uint(8));
+    }
+
+    proc writeHeader(const ref defs: DefinitionStore) throws {
+      putWord(cacheMagic);
+      putWord(cacheVersion);
+      putStamp(stamps.anchor);
+      putStamp(stamps.definitions);
+      definitionsOffset = writer.offset();
+      writeDefinitions(defs);
+    }
+
+    // In the order MappedTraceCache.readDefinitions reads them
+    proc writeDefinitions(const ref defs: DefinitionStore) throws {
+      putWord(defs.clockProps.timerResolution);
+      putWord(defs.clockProps.globalOffset);
+      putWord(defs.clockProps.traceLength);
+      putWord(defs.clockProps.realtimeTimestamp);
+
+      putWord(defs.stringDom.size);
+      for s in defs.stringDom {
+        putWord(defs.stringDefined[s]);
+        putString(defs.strings[s]);
+      }
+
+      putWord(defs.regionDom.size);
+      for region in defs.regions {
+        putWord(region.defined);
+        putString(region.name);
+        putWord(region.regionRole);
+        putWord(region.paradigm);
+      }
+
+      putWord(defs.locationGroupDom.size);
+      for group in defs.locationGroups {
+        putWord(group.defined);
+        putString(group.name);
+        putString(group.creatingLocationGroup);
+        putWord(group.locationGroupType);
+      }
+
+      putWord(defs.numLocations);
+      for i in 0..<defs.numLocations {
+        const ref loc = defs.locations[i];
+        locationRefs[i] = loc.id;
+        locationEvents[i] = loc.numberOfEvents;
+        putWord(loc.id);
+        putString(loc.name);
+        putWord(loc.group);
+        putWord(loc.locationType);
+        putWord(loc.numberOfEvents);
+        putString(loc.groupName);
+        putString(loc.processName);
+      }
+
+      putWord(defs.metricMemberDom.size);
+      for member in defs.metricMembers {
+        putWord(member.defined);
+        putString(member.name);
+        putString(member.unit);
+        putWord(member.metricType);
+        putWord(member.mode);
+        putWord(member.valueType);
+      }
+
+      putWord(defs.metricClassDom.size);
+      for mc in defs.metricClasses {
+        putWord(mc.defined);
+        putWord(mc.numberOfMetrics);
+        putWord(mc.firstMember);
+        putWord(mc.hasRecorder);
+        putWord(mc.recorder);
+      }
+
+      putWord(defs.numClassMembers);
+      for i in 0..<defs.numClassMembers do putWord(defs.classMembers[i]);
+
+      putWord(defs.metricInstanceDom.size);
+      for mi in defs.metricInstances {
+        putWord(mi.defined);
+        putWord(mi.metricClass);
+        putWord(mi.recorder);
+      }
+    }
+
+    // Store the call graph of location i: its first n intervals as columns,
+    // and whether they are in start order (see Timeline)
+    proc addIntervals(i: int, const ref starts: [] real, const ref ends: [] real,
+                      const ref depths: [] int(32), const ref regions: [] uint(32),
+                      n: int, inStartOrder: bool) throws {
+      flags[i] |= hasCallGraphFlag;
+      if inStartOrder then flags[i] |= inStartOrderFlag;
+      intervalsOffset[i] = writer.offset();
+      intervalCount[i] = n;
+      if n > 0 {
+        writer.writeBinary(starts[starts.domain.low..#n]);
+        writer.writeBinary(ends[ends.domain.low..#n]);
+        writer.writeBinary(depths[depths.domain.low..#n]);
+        writer.writeBinary(regions[regions.domain.low..#n]);
+      }
+      pad();
+      hasIntervals = true;
+    }
+
+    // Store the first n bytes of data as the metric blob of location i
+    proc addMetrics(i: int, const ref data: [] uint(8), n: int) throws {
+      flags[i] |= hasMetricsFlag;
+      metricsOffset[i] = writer.offset();
+      metricsBytes[i] = n;
+      if n > 0 then writer.writeBinary(data[data.domain.low..#n]);
+      pad();
+      hasIntervals = true;
+    }
+
+    // The options the stored call graphs and metrics were extracted with
+    proc setIntervalsKey(key: string) {
+      intervalsKey = key;
+    }
+
+    // Event totals of a complete, unwindowed read of all locations
+    proc setTotals(eventsRead: uint(64), enterCount: uint(64), leaveCount: uint(64)) {
+      hasTotals = true;
+      this.eventsRead = eventsRead;
+      this.enterCount = enterCount;
+      this.leaveCount = leaveCount;
+    }
+
+    // Take over the blocks of location i from old, byte for byte
+    proc copyBlocks(old: borrowed MappedTraceCache, i: int) throws {
+      flags[i] = old.entry(i, flagsField);
+      intervalsOffset[i] = writer.offset();
+      intervalCount[i] = old.intervalCount(i);
+      const intervalBytes = 24 * intervalCount[i];
+      if intervalBytes > 0 then
+        writer.writeBinary(old.base + old.entry(i, intervalsField): int, intervalBytes);
+      metricsOffset[i] = writer.offset();
+      metricsBytes[i] = old.metricsBytes(i);
+      if metricsBytes[i] > 0 then
+        writer.writeBinary(old.base + old.entry(i, metricsField): int, metricsBytes[i]);
+      pad();
+    }
+
+    // Write the remaining sections and put the sidecar in place. What this
+    // run did not store is carried over from old, the sidecar it replaces,
+    // if old was written for the same files.
+    proc finish(old: borrowed MappedTraceCache?) throws {
+      if old != nil && old!.matches(stamps) {
+        const o = old!;
+        if !hasTotals && o.hasTotals then
+          setTotals(o.eventsRead, o.enterCount, o.leaveCount);
+        if !hasIntervals && o.hasIntervals && o.numLocations == numLocations {
+          for i in 0..<numLocations do copyBlocks(o, i);
+          setIntervalsKey(o.intervalsKey());
+          hasIntervals = true;
+        }
+      }
+
+      const keyOffset = writer.offset();
+      putString(intervalsKey);
+
+      const locationsOffset = writer.offset();
+      for i in 0..<numLocations {
+        putWord(locationRefs[i]);
+        putWord(locationEvents[i]);
+        putStamp(stamps.events[i]);
+        putWord(flags[i]);
+        putWord(intervalsOffset[i]);
+        putWord(intervalCount[i]);
+        putWord(metricsOffset[i]);
+        putWord(metricsBytes[i]);
+      }
+
+      putWord(definitionsOffset);
+      putWord(keyOffset);
+      putWord(locationsOffset);
+      putWord(numLocations);
+      putWord(hasTotals);
+      putWord(eventsRead);
+      putWord(enterCount);
+      putWord(leaveCount);
+      putWord(hasIntervals);
+      putWord(cacheMagic);
+
+      writer.close();
+      outfile.close();
+      rename(tmpPath, cachePath(trace));
+    }
+  }
+
+  // Start a new sidecar for trace with the given definitions. stamps must
+  // have been taken before the definitions and events were read, see
+  // stampTrace and stampEvents.
+  proc createTraceCacheWriter(trace: string, const ref defs: DefinitionStore,
+                              const ref stamps: traceStamps): owned TraceCacheWriter throws {
+    var w = new TraceCacheWriter(trace, defs.numLocations, stamps);
+    w.writeHeader(defs);
+    return w;
+  }
+
+  // Record the totals of a complete read of trace in its sidecar, keeping
+  // the rest of old
+  proc writeTotalsToCache(trace: string, const ref defs: DefinitionStore,
+                          const ref stamps: traceStamps,
+                          eventsRead: uint(64), enterCount: uint(64), leaveCount: uint(64),
+                          old: borrowed MappedTraceCache?) throws {
+    var w = createTraceCacheWriter(trace, defs, stamps);
+    w.setTotals(eventsRead, enterCount, leaveCount);
+    w.finish(old);
+  }
+}
@@ -5,79 +5,11 @@ module Otf2ReadEvents {
   use OTF2;
   use Time;
   use List;
-
-  // --- Definition context (mirrors parallel version) ---
-  record DefCallbackContext {
-    var locationIds: domain(OTF2_LocationRef);
-    var locationTable: [locationIds] string;
-    var regionIds: domain(OTF2_RegionRef);
-    var regionTable: [regionIds] string;
-    var stringIds: domain(OTF2_StringRef);
-    var stringTable: [stringIds] string;
-  }
-
-  // --- Definition callbacks ---
-  proc GlobDefString_Register(userData: c_ptr(void),
-                              strRef: OTF2_StringRef,
-                              strName: c_ptrConst(c_uchar)):
-                              OTF2_CallbackCode {
-    var ctxPtr = userData: c_ptr(DefCallbackContext);
-    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
-    ref ctx = ctxPtr.deref();
-    // Add string to the lookup table
-    ctx.stringIds += strRef;
-    if strName != nil {
-      try! ctx.stringTable[strRef] = string.createCopyingBuffer(strName);
-    } else {
-      ctx.stringTable[strRef] = "UnknownString";
-    }
-    // writeln("Registered string: ", ctx.stringTable[str]);
-    return OTF2_CALLBACK_SUCCESS;
-  }
-
-  proc GlobDefLocation_Register(userData: c_ptr(void),
-                                location: OTF2_LocationRef,
-                                name: OTF2_StringRef,
-                                locationType: OTF2_LocationType,
-                                numberOfEvents: c_uint64,
-                                locationGroup: OTF2_LocationGroupRef):
-                                OTF2_CallbackCode {
-    // Get the reference to the context record
-    var ctxPtr = userData: c_ptr(DefCallbackContext);
-    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
-    ref ctx = ctxPtr.deref();
-    // Lookup name in string table
-    const locName = if ctx.stringIds.contains(name) then ctx.stringTable[name] else "UnknownLocation";
-    ctx.locationIds += location;
-    ctx.locationTable[location] = locName;
-    // writeln("Registered location: ", ctx.locationTable[location]);
-    return OTF2_CALLBACK_SUCCESS;
-  }
-
-  proc GlobDefRegion_Register(userData: c_ptr(void),
-                              region: OTF2_RegionRef,
-                              name: OTF2_StringRef,
-                              canonicalName: OTF2_StringRef,
-                              description: OTF2_StringRef,
-                              regionRole: OTF2_RegionRole,
-                              paradigm: OTF2_Paradigm,
-                              regionFlags: OTF2_RegionFlag,
-                              sourceFile: OTF2_StringRef,
-                              beginLineNumber: c_uint32,
-                              endLineNumber: c_uint32):
-                              OTF2_CallbackCode {
-    // Get the reference to the context record
-    var ctxPtr = userData: c_ptr(DefCallbackContext);
-    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
-    ref ctx = ctxPtr.deref();
-    // Lookup name in string table
-    const regionName = if ctx.stringIds.contains(name) then ctx.stringTable[name] else "UnknownRegion";
-    // Add region to the lookup table
-    ctx.regionIds += region;
-    ctx.regionTable[region] = regionName;
-    // writeln("Registered region: ", regionName);
-    return OTF2_CALLBACK_SUCCESS;
-  }
+  use DefinitionStore;
+  use TimeWindow;
+  use PhaseProfiler;
+  use TraceCache;
+  import Math.inf;
 
   // --- Event data structures (aligned with parallel implementation) ---
   record EventInfo {
@@ -94,8 +26,12 @@ module Otf2ReadEvents {
   }
 
   record EvtCallbackContext {
-    var defContext: DefCallbackContext;
+    var defContext: DefinitionStore;
     var eventData: AllEventsData;
+    // Only events in this window are stored and counted
+    var window: timeWindow;
+    // Every event the callbacks see, for --profile
+    var callbacks: eventCounts;
   }
 
   // --- Event callbacks (now operate on EvtCallbackContext) ---
@@ -110,11 +46,15 @@ module Otf2ReadEvents {
     ref ctx = ctxPtr.deref();
     ref defCtx = ctx.defContext;
     ref evd = ctx.eventData;
+    ctx.callbacks.enter += 1;
+    // Events come in time order, nothing after this one is in the window
+    if ctx.window.isAfter(time) then return OTF2_CALLBACK_INTERRUPT;
+    if ctx.window.isBefore(time) then return OTF2_CALLBACK_SUCCESS;
     // Increment enter count
     evd.enterCount += 1;
     // Get location and region names
-    const locname = if defCtx.locationIds.contains(location) then defCtx.locationTable[location] else "UnknownLocation";
-    const regionname = if defCtx.regionIds.contains(region) then defCtx.regionTable[region] else "UnknownRegion";
+    const ref locname = defCtx.locationName(location);
+    const ref regionname = defCtx.regionName(region);
     // Add event to all_event_data
     evd.events.pushBack(new EventInfo(time, locname, "Enter", regionname));
     return OTF2_CALLBACK_SUCCESS;
@@ -132,20 +72,58 @@ module Otf2ReadEvents {
     ref ctx = ctxPtr.deref();
     ref defCtx = ctx.defContext;
     ref evd = ctx.eventData;
+    ctx.callbacks.leave += 1;
+    if ctx.window.isAfter(time) then return OTF2_CALLBACK_INTERRUPT;
+    if ctx.window.isBefore(time) then return OTF2_CALLBACK_SUCCESS;
     evd.leaveCount += 1;
-    const locname = if defCtx.locationIds.contains(location) then defCtx.locationTable[location] else "UnknownLocation";
-    const regionname = if defCtx.regionIds.contains(region) then defCtx.regionTable[region] else "UnknownRegion";
+    const ref locname = defCtx.locationName(location);
+    const ref regionname = defCtx.regionName(region);
     evd.events.pushBack(new EventInfo(time, locname, "Leave", regionname));
     return OTF2_CALLBACK_SUCCESS;
   }
-  // Config constant for command-line argument
+  // Config constants for command-line arguments
   // Usage: ./otf2_read_events --tracePath=/path/to/traces.otf2
+  //        ./otf2_read_events --tracePath=/path/to/traces.otf2 --start=10.0 --end=12.5
   config const tracePath: string = "/workspace/scorep-traces/frontier-hpl-run-using-2-ranks-with-craypm/traces.otf2";
+  // Time window in seconds (as from timestampToSeconds), unbounded by default
+  config const start: real = -inf;
+  config const end: real = inf;
+  // Write phase timings and reader counters as JSON to this file
+  // Usage: ./otf2_read_events --profile=profile.json
+  config const profile: string = "";
+  // Take the definitions and event totals from the sidecar <trace>cache
+  // when it matches the archive, and keep them there after a full read
+  // Usage: ./otf2_read_events --cache
+  config const cache: bool = false;
 
   proc main() {
+    if start > end {
+      writeln("Invalid time window: start ", start, " is after end ", end);
+      return;
+    }
+
+    profiler.enable("otf2_read_events", profile);
+    profiler.phase("open");
     var sw: stopwatch;
     sw.start();
 
+    // Totals are only kept for complete reads
+    const unwindowed = start == -inf && end == inf;
+    var traceCache: owned MappedTraceCache?;
+    var stamps: traceStamps;
+    if cache {
+      stamps = stampTrace(tracePath);
+      traceCache = openTraceCache(tracePath);
+    }
+    if traceCache != nil && traceCache!.hasTotals && unwindowed {
+      profiler.phase("read cache");
+      const defCtx = traceCache!.definitions();
+      writeln("Read definitions and event totals from ", cachePath(tracePath),
+              " in ", sw.elapsed(), " seconds");
+      report(defCtx, traceCache!.eventsRead, traceCache!.enterCount, traceCache!.leaveCount);
+      return;
+    }
+
     var reader = OTF2_Reader_Open(tracePath.c_str());
     if reader == nil {
       writeln("Failed to open trace");
@@ -156,6 +134,7 @@ module Otf2ReadEvents {
     writef("Time taken to open OTF2 archive: %.2dr seconds\n", openTime);
     sw.clear(); // Restart stopwatch for next timing
 
+    profiler.phase("global definitions");
     OTF2_Reader_SetSerialCollectiveCallbacks(reader);
 
     var numberOfLocations: c_uint64 = 0;
@@ -163,29 +142,18 @@ module Otf2ReadEvents {
     writeln("Number of locations: ", numberOfLocations);
 
     // Definition context & callbacks
-    var defCtx = new DefCallbackContext();
-    var globalDefReader = OTF2_Reader_GetGlobalDefReader(reader);
-    var defCallbacks = OTF2_GlobalDefReaderCallbacks_New();
-    OTF2_GlobalDefReaderCallbacks_SetStringCallback(defCallbacks, c_ptrTo(GlobDefString_Register): c_fn_ptr);
-    OTF2_GlobalDefReaderCallbacks_SetLocationCallback(defCallbacks, c_ptrTo(GlobDefLocation_Register): c_fn_ptr);
-    OTF2_GlobalDefReaderCallbacks_SetRegionCallback(defCallbacks, c_ptrTo(GlobDefRegion_Register): c_fn_ptr);
-
-    OTF2_Reader_RegisterGlobalDefCallbacks(reader,
-                                           globalDefReader,
-                                           defCallbacks,
-                                           c_ptrTo(defCtx): c_ptr(void));
-    OTF2_GlobalDefReaderCallbacks_Delete(defCallbacks);
-
-    var definitionsRead: c_uint64 = 0;
-    OTF2_Reader_ReadAllGlobalDefinitions(reader, globalDefReader, c_ptrTo(definitionsRead));
+    var defCtx = new DefinitionStore();
+    const definitionsRead = readGlobalDefinitions(reader, defCtx);
     writeln("Global definitions read: ", definitionsRead);
 
     const defReadTime = sw.elapsed();
     writef("Time taken to read global definitions: %.2dr seconds\n", defReadTime);
     sw.clear(); // Restart stopwatch for next timing
+    if cache then stamps.stampEvents(tracePath, defCtx);
 
+    profiler.phase("local definitions");
     // Select all locations
-    for loc in defCtx.locationIds {
+    for loc in defCtx.locationRefs() {
       // writeln("Selecting location ", loc);
       OTF2_Reader_SelectLocation(reader, loc);
     }
@@ -196,7 +164,7 @@ module Otf2ReadEvents {
 
     OTF2_Reader_OpenEvtFiles(reader);
 
-    for loc in defCtx.locationIds {
+    for loc in defCtx.locationRefs() {
       if successfulOpenDefFiles {
         var defReader = OTF2_Reader_GetDefReader(reader, loc);
         if defReader != nil {
@@ -216,8 +184,10 @@ module Otf2ReadEvents {
     sw.clear();
     if successfulOpenDefFiles then OTF2_Reader_CloseDefFiles(reader);
 
+    profiler.phase("read events");
     // Event reading setup with new event context
-    var evtCtx = new EvtCallbackContext(defCtx);
+    var evtCtx = new EvtCallbackContext(defContext=defCtx,
+                                        window=new timeWindow(start, end, defCtx.clockProps));
     var globalEvtReader = OTF2_Reader_GetGlobalEvtReader(reader);
     var evtCallbacks = OTF2_GlobalEvtReaderCallbacks_New();
     OTF2_GlobalEvtReaderCallbacks_SetEnterCallback(evtCallbacks,
@@ -239,7 +209,15 @@ module Otf2ReadEvents {
     const evtReadTime = sw.elapsed();
     writeln("Time taken to read events: ", evtReadTime, " seconds");
     sw.clear();
-
+    if profiler.enabled then
+      profiler.addTask(new taskProfile(localeId=here.id, task=0, seconds=evtReadTime,
+                                       locations=defCtx.numLocations,
+                                       events=totalEventsRead,
+                                       callbacks=evtCtx.callbacks,
+                                       bytesRead=+ reduce (for l in defCtx.locationRefs()
+                                                             do eventFileBytes(tracePath, l))));
+
+    profiler.phase("close");
     OTF2_Reader_CloseGlobalEvtReader(reader, globalEvtReader);
     OTF2_Reader_CloseEvtFiles(reader);
     OTF2_Reader_Close(reader);
@@ -247,38 +225,56 @@ module Otf2ReadEvents {
     sw.stop();
     writeln("Total time: ", openTime + defReadTime + markTime + evtReadTime + closeTime, " seconds");
 
-
-    // Print event summary
     ref data = evtCtx.eventData;
+    if cache && unwindowed {
+      profiler.phase("write cache");
+      try {
+        writeTotalsToCache(tracePath, defCtx, stamps, totalEventsRead,
+                           data.enterCount, data.leaveCount, traceCache.borrow());
+        writeln("Wrote trace cache ", cachePath(tracePath));
+      } catch e {
+        writeln("Failed to write trace cache ", cachePath(tracePath), ": ", e);
+      }
+    }
+
+    report(defCtx, totalEventsRead, data.enterCount, data.leaveCount);
+  }
+
+  // Print the event summary and stats and write the profile
+  proc report(const ref defCtx: DefinitionStore, totalEventsRead: uint(64),
+              enterCount: uint(64), leaveCount: uint(64)) {
     writeln("Event Summary:");
     writeln(" Total number of events: ", totalEventsRead);
     writeln(" Event types and their counts:");
-    writeln("  Enter: ", data.enterCount, " events");
-    writeln("  Leave: ", data.leaveCount, " events");
+    writeln("  Enter: ", enterCount, " events");
+    writeln("  Leave: ", leaveCount, " events");
 
     // Print the stats for unique locations
     printUniqueLocationAndRegionStats(defCtx, false);
+
+    try {
+      profiler.finish();
+    } catch e {
+      writeln("Failed to write profile ", profile, ": ", e);
+    }
   }
 
 
-  proc printUniqueLocationAndRegionStats(defCtx: DefCallbackContext, verbose: bool) {
-    writeln("Total Unique Locations: ", defCtx.locationIds.size);
+  proc printUniqueLocationAndRegionStats(const ref defCtx: DefinitionStore, verbose: bool) {
+    writeln("Total Unique Locations: ", defCtx.numLocations);
     if verbose {
       writeln("Unique Locations:");
-      for locId in defCtx.locationIds {
-        const locName = defCtx.locationTable[locId];
-        if locName != "" {
-          writeln(locName);
-        }
+      for loc in defCtx.locationRefs() {
+        writeln(defCtx.locationName(loc));
       }
     }
 
     // Print the stats for unique regions
-    writeln("Total Unique Regions: ", defCtx.regionIds.size);
+    writeln("Total Unique Regions: ", defCtx.numRegions);
     if verbose {
       writeln("Unique Regions:");
-      for regionId in defCtx.regionIds {
-        writeln(defCtx.regionTable[regionId]);
+      for region in defCtx.regionRefs() {
+        writeln(defCtx.regionName(region));
       }
     }
   }
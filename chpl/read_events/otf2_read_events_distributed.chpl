@@ -6,81 +6,12 @@ module Otf2ReadEvents {
   use Time;
   use List;
   use Sort;
-
-  // Defs are read in serial, so only one instance of this needs to exist,
-  // but copies will be made to make the tables available to each reader
-  record DefCallbackContext {
-    var locationIds: domain(OTF2_LocationRef);
-    var locationTable: [locationIds] string;
-    var regionIds: domain(OTF2_RegionRef);
-    var regionTable: [regionIds] string;
-    var stringIds: domain(OTF2_StringRef);
-    var stringTable: [stringIds] string;
-  }
-
-  // --- Definition callback: register strings, locations and regions ---
-  proc GlobDefString_Register(userData: c_ptr(void),
-                               strRef: OTF2_StringRef,
-                               strName: c_ptrConst(c_uchar)):
-                               OTF2_CallbackCode {
-    // Get the reference to the context record
-    var ctxPtr = userData: c_ptr(DefCallbackContext);
-    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
-    ref ctx = ctxPtr.deref();
-    // Add string to the lookup table
-    ctx.stringIds += strRef;
-    if strName != nil {
-      try! ctx.stringTable[strRef] = string.createCopyingBuffer(strName);
-    } else {
-      ctx.stringTable[strRef] = "UnknownString";
-    }
-    // writeln("Registered string: ", ctx.stringTable[str]);
-    return OTF2_CALLBACK_SUCCESS;
-  }
-
-  proc GlobDefLocation_Register(userData: c_ptr(void),
-                                location: OTF2_LocationRef,
-                                name: OTF2_StringRef,
-                                locationType: OTF2_LocationType,
-                                numberOfEvents: c_uint64,
-                                locationGroup: OTF2_LocationGroupRef):
-                                OTF2_CallbackCode {
-    // Get the reference to the context record
-    var ctxPtr = userData: c_ptr(DefCallbackContext);
-    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
-    ref ctx = ctxPtr.deref();
-    // Lookup name in string table
-    const locName = if ctx.stringIds.contains(name) then ctx.stringTable[name] else "UnknownLocation";
-    ctx.locationIds += location;
-    ctx.locationTable[location] = locName;
-    // writeln("Registered location: ", ctx.locationTable[location]);
-    return OTF2_CALLBACK_SUCCESS;
-  }
-
-  proc GlobDefRegion_Register(userData: c_ptr(void),
-                              region: OTF2_RegionRef,
-                              name: OTF2_StringRef,
-                              canonicalName: OTF2_StringRef,
-                              description: OTF2_StringRef,
-                              regionRole: OTF2_RegionRole,
-                              paradigm: OTF2_Paradigm,
-                              regionFlags: OTF2_RegionFlag,
-                              sourceFile: OTF2_StringRef,
-                              beginLineNumber: c_uint32,
-                              endLineNumber: c_uint32):
-                              OTF2_CallbackCode {
-    // Get the reference to the context record
-    var ctxPtr = userData: c_ptr(DefCallbackContext);
-    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
-    ref ctx = ctxPtr.deref();
-    // Lookup name in string table
-    const regionName = if ctx.stringIds.contains(name) then ctx.stringTable[name] else "UnknownRegion";
-    // Add region to the lookup table
-    ctx.regionIds += region;
-    ctx.regionTable[region] = regionName;
-    // writeln("Registered region: ", regionName);
-    return OTF2_CALLBACK_SUCCESS;
-  }
+  use LocationPartition;
+  use DefinitionStore;
+  use TimeWindow;
+  use PhaseProfiler;
+  use TraceCache;
+  import Math.inf;
 
   // --- Event data structures ---
   record EventInfo {
@@ -105,8 +36,126 @@ module Otf2ReadEvents {
   // Each reader will have it's own instance of this record
   // we will have to merge the AllEventsData from all readers at the end
   record EvtCallbackContext {
-    var defContext: DefCallbackContext;
+    var defContext: DefinitionStore;
     var eventData: AllEventsData;
+    // Only events in this window are stored and counted
+    var window: timeWindow;
+    // Every event the callbacks see, for --profile
+    var callbacks: eventCounts;
+  }
+
+  // --- Aggregate mode ---
+  // Instead of shipping every event to locale 0, each locale reduces its
+  // events into a RegionSummary and only that is shipped. Its size depends
+  // on the number of regions, not on the number of events.
+
+  // Per-region totals, indexed by region ref. The last slot collects
+  // events on undefined regions. Times are in timer ticks.
+  record RegionSummary {
+    var dom: domain(1);
+    var enterCount: uint;
+    var leaveCount: uint;
+    var calls: [dom] uint;
+    var inclusive: [dom] int(64);
+    var exclusive: [dom] int(64);
+    var maxDepth: int;
+
+    inline proc slot(const ref defs: DefinitionStore, region: OTF2_RegionRef): int {
+      return if defs.hasRegion(region) then region: int else dom.size - 1;
+    }
+
+    proc ref merge(const ref other: RegionSummary) {
+      enterCount += other.enterCount;
+      leaveCount += other.leaveCount;
+      calls += other.calls;
+      inclusive += other.inclusive;
+      exclusive += other.exclusive;
+      maxDepth = max(maxDepth, other.maxDepth);
+    }
+  }
+
+  // An open region on a location's call stack
+  record Frame {
+    var slot: int;
+    var start: OTF2_TimeStamp;
+    // Time spent in regions called from this one, for the exclusive time
+    var childTime: int(64);
+  }
+
+  record AggregateContext {
+    var defContext: DefinitionStore;
+    var summary = new RegionSummary({0..defContext.regionDom.size});
+    // Call stack of each location, by DefinitionStore location index
+    var stacks: [0..<defContext.numLocations] list(Frame);
+    // Only time inside this window is summarized. Regions entered before it
+    // are kept on the stacks with their start moved to the window start.
+    var window: timeWindow;
+    // Every event the callbacks see, for --profile
+    var callbacks: eventCounts;
+
+    // Pop the innermost frame of location l and account it as ending at time
+    proc ref closeFrame(l: int, time: OTF2_TimeStamp) {
+      ref stack = stacks[l];
+      const frame = stack.popBack();
+      const duration = time: int(64) - frame.start: int(64);
+      summary.calls[frame.slot] += 1;
+      summary.inclusive[frame.slot] += duration;
+      summary.exclusive[frame.slot] += duration - frame.childTime;
+      if !stack.isEmpty() then stack.last.childTime += duration;
+    }
+
+    // Close the frames still open at the end of the window
+    proc ref closeAtWindowEnd() {
+      if !window.hasEnd then return;
+      for l in stacks.domain do
+        while !stacks[l].isEmpty() do closeFrame(l, window.endTicks);
+    }
+  }
+
+  proc Enter_aggregate(location: OTF2_LocationRef,
+                       time: OTF2_TimeStamp,
+                       userData: c_ptr(void),
+                       attributes: c_ptr(OTF2_AttributeList),
+                       region: OTF2_RegionRef): OTF2_CallbackCode {
+    var ctxPtr = userData: c_ptr(AggregateContext);
+    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
+    ref ctx = ctxPtr.deref();
+    ref summary = ctx.summary;
+    ctx.callbacks.enter += 1;
+    // Events come in time order, nothing after this one is in the window
+    if ctx.window.isAfter(time) then return OTF2_CALLBACK_INTERRUPT;
+    const before = ctx.window.isBefore(time);
+    if !before then summary.enterCount += 1;
+    const l = ctx.defContext.locationIndex(location);
+    if l < 0 then return OTF2_CALLBACK_SUCCESS;
+    ref stack = ctx.stacks[l];
+    const frameStart = if before then ctx.window.startTicks else time;
+    stack.pushBack(new Frame(summary.slot(ctx.defContext, region), frameStart, 0));
+    summary.maxDepth = max(summary.maxDepth, stack.size);
+    return OTF2_CALLBACK_SUCCESS;
+  }
+
+  proc Leave_aggregate(location: OTF2_LocationRef,
+                       time: OTF2_TimeStamp,
+                       userData: c_ptr(void),
+                       attributes: c_ptr(OTF2_AttributeList),
+                       region: OTF2_RegionRef): OTF2_CallbackCode {
+    var ctxPtr = userData: c_ptr(AggregateContext);
+    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
+    ref ctx = ctxPtr.deref();
+    ref summary = ctx.summary;
+    ctx.callbacks.leave += 1;
+    if ctx.window.isAfter(time) then return OTF2_CALLBACK_INTERRUPT;
+    const before = ctx.window.isBefore(time);
+    if !before then summary.leaveCount += 1;
+    const l = ctx.defContext.locationIndex(location);
+    if l < 0 then return OTF2_CALLBACK_SUCCESS;
+    ref stack = ctx.stacks[l];
+    if stack.isEmpty() then return OTF2_CALLBACK_SUCCESS;
+    // Regions left before or at the window start do not count
+    if ctx.window.endsBefore(time) then stack.popBack();
+    else ctx.closeFrame(l, time);
+    return OTF2_CALLBACK_SUCCESS;
   }
 
   // --- Event callbacks ---
@@ -122,11 +171,15 @@ module Otf2ReadEvents {
     ref ctx = ctxPtr.deref();
     ref defContext = ctx.defContext;
     ref allEventsData = ctx.eventData;
+    ctx.callbacks.enter += 1;
+    // Events come in time order, nothing after this one is in the window
+    if ctx.window.isAfter(time) then return OTF2_CALLBACK_INTERRUPT;
+    if ctx.window.isBefore(time) then return OTF2_CALLBACK_SUCCESS;
     // Increment enter event count
     allEventsData.enterCount += 1;
     // Get location and region names
-    const locname = if defContext.locationIds.contains(location) then defContext.locationTable[location] else "UnknownLocation";
-    const regionname = if defContext.regionIds.contains(region) then defContext.regionTable[region] else "UnknownRegion";
+    const ref locname = defContext.locationName(location);
+    const ref regionname = defContext.regionName(region);
     // Add event to allEventsData
     allEventsData.events.pushBack(new EventInfo(time, locname, "Enter", regionname));
     //writeln("Debug: Exiting Enter_store_and_count with enterCount=", allEventsData.enterCount);
@@ -145,27 +198,201 @@ module Otf2ReadEvents {
     ref ctx = ctxPtr.deref();
     ref defContext = ctx.defContext;
     ref allEventsData = ctx.eventData;
+    ctx.callbacks.leave += 1;
+    if ctx.window.isAfter(time) then return OTF2_CALLBACK_INTERRUPT;
+    if ctx.window.isBefore(time) then return OTF2_CALLBACK_SUCCESS;
     // Increment leave event count
     allEventsData.leaveCount += 1;
     // Get location and region names
-    const locname = if defContext.locationIds.contains(location) then defContext.locationTable[location] else "UnknownLocation";
-    const regionname = if defContext.regionIds.contains(region) then defContext.regionTable[region] else "UnknownRegion";
+    const ref locname = defContext.locationName(location);
+    const ref regionname = defContext.regionName(region);
     // Add event to allEventsData
     allEventsData.events.pushBack(new EventInfo(time, locname, "Leave", regionname));
     //writeln("Debug: Exiting Leave_store_and_count with leaveCount=", allEventsData.leaveCount);
     return OTF2_CALLBACK_SUCCESS;
   }
 
+  // The local event readers pass the position of the event in its
+  // location's stream as well, which is not needed here
+  proc Enter_aggregate_local(location: OTF2_LocationRef,
+                             time: OTF2_TimeStamp,
+                             eventPosition: c_uint64,
+                             userData: c_ptr(void),
+                             attributes: c_ptr(OTF2_AttributeList),
+                             region: OTF2_RegionRef): OTF2_CallbackCode {
+    return Enter_aggregate(location, time, userData, attributes, region);
+  }
+
+  proc Leave_aggregate_local(location: OTF2_LocationRef,
+                             time: OTF2_TimeStamp,
+                             eventPosition: c_uint64,
+                             userData: c_ptr(void),
+                             attributes: c_ptr(OTF2_AttributeList),
+                             region: OTF2_RegionRef): OTF2_CallbackCode {
+    return Leave_aggregate(location, time, userData, attributes, region);
+  }
+
+  proc Enter_store_and_count_local(location: OTF2_LocationRef,
+                                   time: OTF2_TimeStamp,
+                                   eventPosition: c_uint64,
+                                   userData: c_ptr(void),
+                                   attributes: c_ptr(OTF2_AttributeList),
+                                   region: OTF2_RegionRef): OTF2_CallbackCode {
+    return Enter_store_and_count(location, time, userData, attributes, region);
+  }
+
+  proc Leave_store_and_count_local(location: OTF2_LocationRef,
+                                   time: OTF2_TimeStamp,
+                                   eventPosition: c_uint64,
+                                   userData: c_ptr(void),
+                                   attributes: c_ptr(OTF2_AttributeList),
+                                   region: OTF2_RegionRef): OTF2_CallbackCode {
+    return Leave_store_and_count(location, time, userData, attributes, region);
+  }
+
   // Config constant for command-line argument
   // Usage: ./otf2_read_events_distributed --tracePath=/path/to/traces.otf2
   config const tracePath: string = "/workspace/scorep-traces/frontier-hpl-run-using-2-ranks-with-craypm/traces.otf2";
+  // Reduce events to per-region summaries on each locale (see RegionSummary)
+  // instead of gathering every event on locale 0
+  config const aggregate: bool = true;
+  // Number of regions listed in the aggregate report
+  config const topRegions: int = 20;
+  // Read the global definitions on every locale instead of copying the
+  // tables of locale 0 over, see loadGlobalDefinitions
+  config const localDefinitions: bool = true;
+  // Time window in seconds (as from timestampToSeconds), unbounded by default
+  // Usage: ./otf2_read_events_distributed --start=10.0 --end=12.5
+  config const start: real = -inf;
+  config const end: real = inf;
+  // Read through the global event reader instead of one local reader per
+  // location. Events are reduced per location, so the time order across
+  // locations the global reader provides is not needed.
+  // Usage: ./otf2_read_events_distributed --globalReader=true
+  config const globalReader: bool = false;
+  // Write phase timings and per-locale reader counters as JSON to this file
+  // Usage: ./otf2_read_events_distributed --profile=profile.json
+  config const profile: string = "";
+  // Take the definitions and event totals from the sidecar <trace>cache
+  // when it matches the archive, and keep them there after a full read.
+  // Only --aggregate=false can skip reading, the region summary is not kept.
+  // Usage: ./otf2_read_events_distributed --cache --aggregate=false
+  config const cache: bool = false;
+
+  // Open a reader on the given locations and feed their events to the
+  // enter/leave callbacks with ctxPtr as userData. The callbacks have the
+  // local event reader signature, or the global one with --globalReader.
+  // Reading stops when a callback interrupts it at the end of the time
+  // window. Returns the events read.
+  proc readLocationEvents(const ref myLocations, i: int,
+                          enterCallback: c_fn_ptr, leaveCallback: c_fn_ptr,
+                          ctxPtr: c_ptr(void)): c_uint64 {
+    // Each task will have its own reader
+    var reader = OTF2_Reader_Open(tracePath.c_str());
+    if reader == nil {
+      writeln("Failed to open trace file");
+      return 0;
+    }
+    OTF2_Reader_SetSerialCollectiveCallbacks(reader);
+
+    var sw_inner: stopwatch;
+    sw_inner.start();
+
+    // Select locations for this task
+    for loc in myLocations {
+      OTF2_Reader_SelectLocation(reader, loc);
+    }
+
+    OTF2_Reader_OpenEvtFiles(reader);
+
+    var totalEventsRead: c_uint64 = 0;
+    if globalReader {
+      for loc in myLocations {
+        // Mark file to be read by Global Reader later
+        var _evtReader = OTF2_Reader_GetEvtReader(reader, loc);
+      }
+
+      const markTime = sw_inner.elapsed();
+      writeln("Time taken to mark all local event files for reading: ", markTime, " seconds");
+      sw_inner.clear();
+
+      var globalEvtReader = OTF2_Reader_GetGlobalEvtReader(reader);
+      var evtCallbacks = OTF2_GlobalEvtReaderCallbacks_New();
+
+      OTF2_GlobalEvtReaderCallbacks_SetEnterCallback(evtCallbacks, enterCallback);
+      OTF2_GlobalEvtReaderCallbacks_SetLeaveCallback(evtCallbacks, leaveCallback);
+
+      OTF2_Reader_RegisterGlobalEvtCallbacks(reader,
+                                            globalEvtReader,
+                                            evtCallbacks,
+                                            ctxPtr);
+
+      OTF2_GlobalEvtReaderCallbacks_Delete(evtCallbacks);
+
+      OTF2_Reader_ReadAllGlobalEvents(reader,
+                                      globalEvtReader,
+                                      c_ptrTo(totalEventsRead));
+      OTF2_Reader_CloseGlobalEvtReader(reader, globalEvtReader);
+    } else {
+      // Every location is decoded on its own, no merge across locations
+      var evtCallbacks = OTF2_EvtReaderCallbacks_New();
+      OTF2_EvtReaderCallbacks_SetEnterCallback(evtCallbacks, enterCallback);
+      OTF2_EvtReaderCallbacks_SetLeaveCallback(evtCallbacks, leaveCallback);
+
+      for loc in myLocations {
+        var evtReader = OTF2_Reader_GetEvtReader(reader, loc);
+        if evtReader == nil then continue;
+        OTF2_Reader_RegisterEvtCallbacks(reader, evtReader, evtCallbacks, ctxPtr);
+        var eventsRead: c_uint64 = 0;
+        OTF2_Reader_ReadAllLocalEvents(reader, evtReader, c_ptrTo(eventsRead));
+        totalEventsRead += eventsRead;
+        OTF2_Reader_CloseEvtReader(reader, evtReader);
+      }
+
+      OTF2_EvtReaderCallbacks_Delete(evtCallbacks);
+    }
+
+    const evtReadTime = sw_inner.elapsed();
+    writeln("Time taken to read events (task ", i, "): ", evtReadTime, " seconds");
+    OTF2_Reader_CloseEvtFiles(reader);
+    OTF2_Reader_Close(reader);
+    return totalEventsRead;
+  }
 
   proc main() {
     //writeln("Debug: Starting main");
+    if start > end {
+      writeln("Invalid time window: start ", start, " is after end ", end);
+      return;
+    }
+    profiler.enable("otf2_read_events_distributed", profile);
+    profiler.phase("open");
     var sw: stopwatch;
 
     sw.start();
 
+    // Totals are only kept for complete reads
+    const unwindowed = start == -inf && end == inf;
+    var traceCache: owned MappedTraceCache?;
+    var stamps: traceStamps;
+    if cache {
+      stamps = stampTrace(tracePath);
+      traceCache = openTraceCache(tracePath);
+    }
+    if traceCache != nil && traceCache!.hasTotals && unwindowed && !aggregate {
+      profiler.phase("read cache");
+      const defCtx = traceCache!.definitions();
+      writeln("Read definitions and event totals from ", cachePath(tracePath),
+              " in ", sw.elapsed(), " seconds");
+      report(defCtx, traceCache!.eventsRead, traceCache!.enterCount, traceCache!.leaveCount);
+      try {
+        profiler.finish();
+      } catch e {
+        writeln("Failed to write profile ", profile, ": ", e);
+      }
+      return;
+    }
+
     var initial_reader = OTF2_Reader_Open(tracePath.c_str());
     if initial_reader == nil {
       writeln("Failed to open trace file");
@@ -175,50 +402,27 @@ module Otf2ReadEvents {
     const openTime = sw.elapsed();
     writef("Time taken to open initial OTF2 archive: %.2dr seconds\n", openTime);
 
+    profiler.phase("global definitions");
     OTF2_Reader_SetSerialCollectiveCallbacks(initial_reader);
 
     var numberOfLocations: c_uint64 = 0;
     OTF2_Reader_GetNumberOfLocations(initial_reader, c_ptrTo(numberOfLocations));
     writeln("Number of locations: ", numberOfLocations);
 
-    // We create a single data context record for all readers
-    // In order for this to work, the data structures within this record must be parSafe
-    // I have set parSafe=true for the lists and domains.
-    var defCtx = new DefCallbackContext();
-
-    // Definition callbacks setup
-    var globalDefReader : c_ptr(OTF2_GlobalDefReader) = OTF2_Reader_GetGlobalDefReader(initial_reader);
-    var defCallbacks : c_ptr(OTF2_GlobalDefReaderCallbacks) = OTF2_GlobalDefReaderCallbacks_New();
-
-    // Register string callbacks first since locations and regions depend on strings
-    OTF2_GlobalDefReaderCallbacks_SetStringCallback(defCallbacks,
-                                                    c_ptrTo(GlobDefString_Register): c_fn_ptr);
-    OTF2_GlobalDefReaderCallbacks_SetLocationCallback(defCallbacks,
-                                                      c_ptrTo(GlobDefLocation_Register): c_fn_ptr);
-    OTF2_GlobalDefReaderCallbacks_SetRegionCallback(defCallbacks,
-                                                    c_ptrTo(GlobDefRegion_Register): c_fn_ptr);
-
-
-    OTF2_Reader_RegisterGlobalDefCallbacks(initial_reader,
-                                          globalDefReader,
-                                          defCallbacks,
-                                          c_ptrTo(defCtx): c_ptr(void));
-
-    OTF2_GlobalDefReaderCallbacks_Delete(defCallbacks);
-
-    var definitionsRead: c_uint64 = 0;
-    OTF2_Reader_ReadAllGlobalDefinitions(initial_reader,
-                                         globalDefReader,
-                                         c_ptrTo(definitionsRead));
+    // Definitions for locale 0. The other locales read their own copy, or
+    // copy this one with --localDefinitions=false
+    var defCtx = new DefinitionStore();
+    const definitionsRead = readGlobalDefinitions(initial_reader, defCtx);
     writeln("Global definitions read: ", definitionsRead);
 
     const defReadTime = sw.elapsed();
     writef("Time taken to read global definitions: %.2dr seconds\n", defReadTime);
     sw.clear(); // Restart stopwatch for next timing
+    if cache then stamps.stampEvents(tracePath, defCtx);
 
-    // Convert associative domain to array for distribution
-    // This can and should be optimized in some other way perhaps.
-    const locationArray : [0..<numberOfLocations] uint = for l in defCtx.locationIds do l;
+    // Location refs in definition order, for distribution
+    const locationArray : [0..<numberOfLocations] uint = for l in defCtx.locationRefs() do l;
+    const locationWeights = [l in locationArray] defCtx.location(l).numberOfEvents;
     const totalLocs = locationArray.size;
     writeln("Total locations: ", totalLocs);
     writeln("SANITY CHECK:", totalLocs == numberOfLocations);
@@ -227,6 +431,7 @@ module Otf2ReadEvents {
     writeln("Time taken to convert location IDs to array: ", locToArrayTime, " seconds");
     sw.clear();
 
+    profiler.phase("local definitions");
     // Select locations to read definitions from, in this case, all
     for loc in locationArray {
       OTF2_Reader_SelectLocation(initial_reader, loc);
@@ -272,109 +477,122 @@ module Otf2ReadEvents {
 
     // Allocate per-reader event contexts that we'll merge after parallel region
     var evtContexts: [0..<numberOfReaders] EvtCallbackContext;
-
-    coforall i in 0..<numberOfReaders with (+ reduce totalEventsReadAcrossReaders, ref defCtx, ref evtContexts) do on Locales[i] {
-      // Each task will have its own reader
-      var reader = OTF2_Reader_Open(tracePath.c_str());
-
-      if reader != nil {
-        OTF2_Reader_SetSerialCollectiveCallbacks(reader);
-
-        var sw_inner: stopwatch;
-        sw_inner.start();
-
-        var numLocationsToReadForThisTask = totalLocs / numberOfReaders;
-        const low = i * numLocationsToReadForThisTask;
-        const high = if i == numberOfReaders - 1 then totalLocs
-                     else (i + 1) * numLocationsToReadForThisTask;
-
-        // Select locations for this task
-        for locIdx in low..<high {
-          const loc = locationArray[locIdx];
-          // writeln("Task ", i, " selecting location ", loc);
-          OTF2_Reader_SelectLocation(reader, loc);
-        }
-
-        // Open files, read local defs per location
-        // const successfulOpenDefFiles =
-        //                     OTF2_Reader_OpenDefFiles(reader) == OTF2_SUCCESS;
-
-        OTF2_Reader_OpenEvtFiles(reader);
-
-        for locIdx in low..<high {
-          const loc = locationArray[locIdx];
-          // Mark file to be read by Global Reader later
-          var _evtReader = OTF2_Reader_GetEvtReader(reader, loc);
-        }
-
-        const markTime = sw_inner.elapsed();
-        writeln("Time taken to mark all local event files for reading: ", markTime, " seconds");
-        sw_inner.clear();
-
-        // if successfulOpenDefFiles {
-        //   OTF2_Reader_CloseDefFiles(reader);
-        // }
-
-        var globalEvtReader = OTF2_Reader_GetGlobalEvtReader(reader);
-        var evtCallbacks = OTF2_GlobalEvtReaderCallbacks_New();
+    // In aggregate mode only these per-reader summaries reach locale 0
+    var summaries: [0..<numberOfReaders] RegionSummary;
+
+    // One fixed bin of locations per locale, balanced by event count (LPT)
+    const parts = lptPartition(locationArray, locationWeights, numberOfReaders);
+
+    profiler.phase("read events");
+    coforall i in 0..<numberOfReaders with (+ reduce totalEventsReadAcrossReaders, ref defCtx, ref evtContexts, ref summaries) do on Locales[i] {
+      // Copy this locale's bin over once instead of reading it remotely twice
+      const myLocations = parts[i];
+
+      // Definitions in this locale's memory, so the callbacks never go remote
+      var sw_defs: stopwatch;
+      sw_defs.start();
+      // A matching sidecar is mapped and decoded instead where there is one
+      var localCache: owned MappedTraceCache?;
+      if traceCache != nil && localDefinitions && here.id != 0 then
+        localCache = openTraceCache(tracePath);
+      const localDefs = if !localDefinitions || here.id == 0 then defCtx
+                        else if localCache != nil then localCache!.definitions()
+                        else loadGlobalDefinitions(tracePath);
+      writeln("Time taken to get definitions on locale ", here.id, ": ", sw_defs.elapsed(), " seconds");
+      const window = new timeWindow(start, end, localDefs.clockProps);
+      const profiling = profiler.enabled;
+      if profiling then profiler.addPhase("locale definitions", sw_defs.elapsed());
+      var sw_read: stopwatch;
+      sw_read.start();
+      var eventsRead: c_uint64 = 0;
+      var callbacks: eventCounts;
+
+      if aggregate {
+        var localCtx = new AggregateContext(localDefs, window=window);
+        eventsRead =
+          readLocationEvents(myLocations, i,
+                             if globalReader then c_ptrTo(Enter_aggregate): c_fn_ptr
+                                             else c_ptrTo(Enter_aggregate_local): c_fn_ptr,
+                             if globalReader then c_ptrTo(Leave_aggregate): c_fn_ptr
+                                             else c_ptrTo(Leave_aggregate_local): c_fn_ptr,
+                             c_ptrTo(localCtx): c_ptr(void));
+        localCtx.closeAtWindowEnd();
+        callbacks = localCtx.callbacks;
+        // Ship the compact summary, the call stacks stay here
+        summaries[i] = localCtx.summary;
+      } else {
         // Local context for this task; copied into shared array after reading events
-        var localEvtCtx = new EvtCallbackContext(defCtx);
-        ref evtCtx = localEvtCtx;
-
-        OTF2_GlobalEvtReaderCallbacks_SetEnterCallback(evtCallbacks,
-                                                      c_ptrTo(Enter_store_and_count): c_fn_ptr);
-        OTF2_GlobalEvtReaderCallbacks_SetLeaveCallback(evtCallbacks,
-                                                      c_ptrTo(Leave_store_and_count): c_fn_ptr);
-
-
-        OTF2_Reader_RegisterGlobalEvtCallbacks(reader,
-                                              globalEvtReader,
-                                              evtCallbacks,
-                                              c_ptrTo(evtCtx): c_ptr(void));
-
-        OTF2_GlobalEvtReaderCallbacks_Delete(evtCallbacks);
-
-        var totalEventsRead: c_uint64 = 0;
-        OTF2_Reader_ReadAllGlobalEvents(reader,
-                                        globalEvtReader,
-                                        c_ptrTo(totalEventsRead));
-        totalEventsReadAcrossReaders += totalEventsRead;
-
-        const evtReadTime = sw_inner.elapsed();
-        writeln("Time taken to read events (task ", i, "): ", evtReadTime, " seconds");
-        sw_inner.clear();
-        OTF2_Reader_CloseGlobalEvtReader(reader, globalEvtReader);
-        OTF2_Reader_CloseEvtFiles(reader);
-        OTF2_Reader_Close(reader);
-        const closeTime = sw_inner.elapsed();
-        sw_inner.stop();
-        sw_inner.clear();
+        var localEvtCtx = new EvtCallbackContext(defContext=localDefs, window=window);
+        eventsRead =
+          readLocationEvents(myLocations, i,
+                             if globalReader then c_ptrTo(Enter_store_and_count): c_fn_ptr
+                                             else c_ptrTo(Enter_store_and_count_local): c_fn_ptr,
+                             if globalReader then c_ptrTo(Leave_store_and_count): c_fn_ptr
+                                             else c_ptrTo(Leave_store_and_count_local): c_fn_ptr,
+                             c_ptrTo(localEvtCtx): c_ptr(void));
+        callbacks = localEvtCtx.callbacks;
         // Copy local context with accumulated events into global array slot
         evtContexts[i] = localEvtCtx;
-      } else {
-        writeln("Failed to open trace file");
       }
+      totalEventsReadAcrossReaders += eventsRead;
+      if profiling then
+        profiler.addTask(new taskProfile(localeId=here.id, task=0, seconds=sw_read.elapsed(),
+                                         locations=myLocations.size, events=eventsRead,
+                                         callbacks=callbacks,
+                                         bytesRead=+ reduce (for l in myLocations
+                                                               do eventFileBytes(tracePath, l))));
     }
     sw.stop();
     writeln("Total time: ", sw.elapsed(), " seconds");
 
-
+    profiler.phase("merge");
     // --- Merge per-reader contexts into a single aggregated structure ---
     var aggEnterEvents : uint = 0;
     var aggLeaveEvents : uint = 0;
-    var allEventDataList : list(EventInfo);
-    for i in 0..<numberOfReaders {
-      const ctx = evtContexts[i];
-      aggEnterEvents += ctx.eventData.enterCount;
-      aggLeaveEvents += ctx.eventData.leaveCount;
-      allEventDataList.pushBack(ctx.eventData.events);
+    var total = new RegionSummary({0..defCtx.regionDom.size});
+    if aggregate {
+      for i in 0..<numberOfReaders do total.merge(summaries[i]);
+      aggEnterEvents = total.enterCount;
+      aggLeaveEvents = total.leaveCount;
+    } else {
+      var allEventDataList : list(EventInfo);
+      for i in 0..<numberOfReaders {
+        const ctx = evtContexts[i];
+        aggEnterEvents += ctx.eventData.enterCount;
+        aggLeaveEvents += ctx.eventData.leaveCount;
+        allEventDataList.pushBack(ctx.eventData.events);
+      }
+      const totalMerged = allEventDataList.size;
+      // TODO, write a comparator and sort the list
+    }
+
+    if cache && unwindowed {
+      profiler.phase("write cache");
+      try {
+        writeTotalsToCache(tracePath, defCtx, stamps, totalEventsReadAcrossReaders,
+                           aggEnterEvents, aggLeaveEvents, traceCache.borrow());
+        writeln("Wrote trace cache ", cachePath(tracePath));
+      } catch e {
+        writeln("Failed to write trace cache ", cachePath(tracePath), ": ", e);
+      }
+    }
+
+    report(defCtx, totalEventsReadAcrossReaders, aggEnterEvents, aggLeaveEvents);
+
+    if aggregate then printRegionSummary(defCtx, total);
+
+    try {
+      profiler.finish();
+    } catch e {
+      writeln("Failed to write profile ", profile, ": ", e);
     }
-    const totalMerged = allEventDataList.size;
-    // TODO, write a comparator and sort the list
+  }
 
-    // Report aggregated counts
+  // Report aggregated counts and stats
+  proc report(const ref defCtx: DefinitionStore, totalEventsRead: uint(64),
+              aggEnterEvents: uint(64), aggLeaveEvents: uint(64)) {
     writeln("Event Summary:");
-    writeln(" Total number of events: ", totalEventsReadAcrossReaders);
+    writeln(" Total number of events: ", totalEventsRead);
     writeln(" Event types and their counts:");
     writeln("  Aggregated Enter events: ", aggEnterEvents);
     writeln("  Aggregated Leave events: ", aggLeaveEvents);
@@ -383,25 +601,43 @@ module Otf2ReadEvents {
     printUniqueLocationAndRegionStats(defCtx, false);
   }
 
+  // Regions with the most exclusive time, from the aggregate mode
+  proc printRegionSummary(const ref defCtx: DefinitionStore, const ref summary: RegionSummary) {
+    const res = max(defCtx.clockProps.timerResolution, 1): real;
+    var order: [summary.dom] (int(64), int);
+    forall (o, r) in zip(order, summary.dom) do o = (-summary.exclusive[r], r);
+    sort(order);
+
+    writeln("Region Summary (max call depth ", summary.maxDepth, "):");
+    writef(" %-40s %12s %14s %14s\n", "Region", "Calls", "Inclusive (s)", "Exclusive (s)");
+    var shown = 0;
+    for (_, r) in order {
+      if shown >= topRegions then break;
+      if summary.calls[r] == 0 then continue;
+      const name = if r == summary.dom.high then "UnknownRegion"
+                   else defCtx.regionName(r: OTF2_RegionRef);
+      writef(" %-40s %12u %14.6dr %14.6dr\n", name, summary.calls[r],
+             summary.inclusive[r] / res, summary.exclusive[r] / res);
+      shown += 1;
+    }
+  }
+
 
-  proc printUniqueLocationAndRegionStats(defCtx: DefCallbackContext, verbose: bool) {
-    writeln("Total Unique Locations: ", defCtx.locationIds.size);
+  proc printUniqueLocationAndRegionStats(const ref defCtx: DefinitionStore, verbose: bool) {
+    writeln("Total Unique Locations: ", defCtx.numLocations);
     if verbose {
       writeln("Unique Locations:");
-      for locId in defCtx.locationIds {
-        const locName = defCtx.locationTable[locId];
-        if locName != "" {
-          writeln(locName);
-        }
+      for loc in defCtx.locationRefs() {
+        writeln(defCtx.locationName(loc));
       }
     }
 
     // Print the stats for unique regions
-    writeln("Total Unique Regions: ", defCtx.regionIds.size);
+    writeln("Total Unique Regions: ", defCtx.numRegions);
     if verbose {
       writeln("Unique Regions:");
-      for regionId in defCtx.regionIds {
-        writeln(defCtx.regionTable[regionId]);
+      for region in defCtx.regionRefs() {
+        writeln(defCtx.regionName(region));
       }
     }
   }
@@ -6,81 +6,12 @@ module Otf2ReadEvents {
   use Time;
   use List;
   use Sort;
-
-  // Defs are read in serial, so only one instance of this needs to exist,
-  // but copies will be made to make the tables available to each reader
-  record DefCallbackContext {
-    var locationIds: domain(OTF2_LocationRef);
-    var locationTable: [locationIds] string;
-    var regionIds: domain(OTF2_RegionRef);
-    var regionTable: [regionIds] string;
-    var stringIds: domain(OTF2_StringRef);
-    var stringTable: [stringIds] string;
-  }
-
-  // --- Definition callback: register strings, locations and regions ---
-  proc GlobDefString_Register(userData: c_ptr(void),
-                               strRef: OTF2_StringRef,
-                               strName: c_ptrConst(c_uchar)):
-                               OTF2_CallbackCode {
-    // Get the reference to the context record
-    var ctxPtr = userData: c_ptr(DefCallbackContext);
-    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
-    ref ctx = ctxPtr.deref();
-    // Add string to the lookup table
-    ctx.stringIds += strRef;
-    if strName != nil {
-      try! ctx.stringTable[strRef] = string.createCopyingBuffer(strName);
-    } else {
-      ctx.stringTable[strRef] = "UnknownString";
-    }
-    // writeln("Registered string: ", ctx.stringTable[str]);
-    return OTF2_CALLBACK_SUCCESS;
-  }
-
-  proc GlobDefLocation_Register(userData: c_ptr(void),
-                                location: OTF2_LocationRef,
-                                name: OTF2_StringRef,
-                                locationType: OTF2_LocationType,
-                                numberOfEvents: c_uint64,
-                                locationGroup: OTF2_LocationGroupRef):
-                                OTF2_CallbackCode {
-    // Get the reference to the context record
-    var ctxPtr = userData: c_ptr(DefCallbackContext);
-    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
-    ref ctx = ctxPtr.deref();
-    // Lookup name in string table
-    const locName = if ctx.stringIds.contains(name) then ctx.stringTable[name] else "UnknownLocation";
-    ctx.locationIds += location;
-    ctx.locationTable[location] = locName;
-    // writeln("Registered location: ", ctx.locationTable[location]);
-    return OTF2_CALLBACK_SUCCESS;
-  }
-
-  proc GlobDefRegion_Register(userData: c_ptr(void),
-                              region: OTF2_RegionRef,
-                              name: OTF2_StringRef,
-                              canonicalName: OTF2_StringRef,
-                              description: OTF2_StringRef,
-                              regionRole: OTF2_RegionRole,
-                              paradigm: OTF2_Paradigm,
-                              regionFlags: OTF2_RegionFlag,
-                              sourceFile: OTF2_StringRef,
-                              beginLineNumber: c_uint32,
-                              endLineNumber: c_uint32):
-                              OTF2_CallbackCode {
-    // Get the reference to the context record
-    var ctxPtr = userData: c_ptr(DefCallbackContext);
-    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
-    ref ctx = ctxPtr.deref();
-    // Lookup name in string table
-    const regionName = if ctx.stringIds.contains(name) then ctx.stringTable[name] else "UnknownRegion";
-    // Add region to the lookup table
-    ctx.regionIds += region;
-    ctx.regionTable[region] = regionName;
-    // writeln("Registered region: ", regionName);
-    return OTF2_CALLBACK_SUCCESS;
-  }
+  use LocationPartition;
+  use DefinitionStore;
+  use TimeWindow;
+  use PhaseProfiler;
+  use TraceCache;
+  import Math.inf;
 
   // --- Event data structures ---
   record EventInfo {
@@ -105,8 +36,12 @@ module Otf2ReadEvents {
   // Each reader will have it's own instance of this record
   // we will have to merge the AllEventsData from all readers at the end
   record EvtCallbackContext {
-    var defContext: DefCallbackContext;
+    var defContext: DefinitionStore;
     var eventData: AllEventsData;
+    // Only events in this window are stored and counted
+    var window: timeWindow;
+    // Every event the callbacks see, for --profile
+    var callbacks: eventCounts;
   }
 
   // --- Event callbacks ---
@@ -122,11 +57,15 @@ module Otf2ReadEvents {
     ref ctx = ctxPtr.deref();
     ref defContext = ctx.defContext;
     ref allEventsData = ctx.eventData;
+    ctx.callbacks.enter += 1;
+    // Events come in time order, nothing after this one is in the window
+    if ctx.window.isAfter(time) then return OTF2_CALLBACK_INTERRUPT;
+    if ctx.window.isBefore(time) then return OTF2_CALLBACK_SUCCESS;
     // Increment enter event count
     allEventsData.enterCount += 1;
     // Get location and region names
-    const locname = if defContext.locationIds.contains(location) then defContext.locationTable[location] else "UnknownLocation";
-    const regionname = if defContext.regionIds.contains(region) then defContext.regionTable[region] else "UnknownRegion";
+    const ref locname = defContext.locationName(location);
+    const ref regionname = defContext.regionName(region);
     // Add event to allEventsData
     allEventsData.events.pushBack(new EventInfo(time, locname, "Enter", regionname));
     //writeln("Debug: Exiting Enter_store_and_count with enterCount=", allEventsData.enterCount);
@@ -145,28 +84,181 @@ module Otf2ReadEvents {
     ref ctx = ctxPtr.deref();
     ref defContext = ctx.defContext;
     ref allEventsData = ctx.eventData;
+    ctx.callbacks.leave += 1;
+    if ctx.window.isAfter(time) then return OTF2_CALLBACK_INTERRUPT;
+    if ctx.window.isBefore(time) then return OTF2_CALLBACK_SUCCESS;
     // Increment leave event count
     allEventsData.leaveCount += 1;
     // Get location and region names
-    const locname = if defContext.locationIds.contains(location) then defContext.locationTable[location] else "UnknownLocation";
-    const regionname = if defContext.regionIds.contains(region) then defContext.regionTable[region] else "UnknownRegion";
+    const ref locname = defContext.locationName(location);
+    const ref regionname = defContext.regionName(region);
     // Add event to allEventsData
     allEventsData.events.pushBack(new EventInfo(time, locname, "Leave", regionname));
     //writeln("Debug: Exiting Leave_store_and_count with leaveCount=", allEventsData.leaveCount);
     return OTF2_CALLBACK_SUCCESS;
   }
 
+  // The local event readers pass the position of the event in its
+  // location's stream as well, which is not needed here
+  proc Enter_store_and_count_local(location: OTF2_LocationRef,
+                                   time: OTF2_TimeStamp,
+                                   eventPosition: c_uint64,
+                                   userData: c_ptr(void),
+                                   attributes: c_ptr(OTF2_AttributeList),
+                                   region: OTF2_RegionRef): OTF2_CallbackCode {
+    return Enter_store_and_count(location, time, userData, attributes, region);
+  }
+
+  proc Leave_store_and_count_local(location: OTF2_LocationRef,
+                                   time: OTF2_TimeStamp,
+                                   eventPosition: c_uint64,
+                                   userData: c_ptr(void),
+                                   attributes: c_ptr(OTF2_AttributeList),
+                                   region: OTF2_RegionRef): OTF2_CallbackCode {
+    return Leave_store_and_count(location, time, userData, attributes, region);
+  }
+
   // Config constant for command-line argument
   // Usage: ./otf2_read_events_parallel --tracePath=/path/to/traces.otf2
   config const tracePath: string = "/workspace/scorep-traces/frontier-hpl-run-using-2-ranks-with-craypm/traces.otf2";
+  // How locations are assigned to reader tasks
+  // Usage: ./otf2_read_events_parallel --schedule=static
+  //   static:  one fixed bin per task, balanced by event count (LPT)
+  //   dynamic: tasks pull batches from a shared queue, heaviest first
+  config const schedule: string = "dynamic";
+  // Time window in seconds (as from timestampToSeconds), unbounded by default
+  // Usage: ./otf2_read_events_parallel --start=10.0 --end=12.5
+  config const start: real = -inf;
+  config const end: real = inf;
+  // Read through the global event reader instead of one local reader per
+  // location. Each location's events are only counted and stored, so the
+  // time order across locations the global reader provides is not needed.
+  // Usage: ./otf2_read_events_parallel --globalReader=true
+  config const globalReader: bool = false;
+  // Write phase timings and per-task counters as JSON to this file
+  // Usage: ./otf2_read_events_parallel --profile=profile.json
+  config const profile: string = "";
+  // Take the definitions and event totals from the sidecar <trace>cache
+  // when it matches the archive, and keep them there after a full read
+  // Usage: ./otf2_read_events_parallel --cache
+  config const cache: bool = false;
+
+  // Report what reader task i did to the profiler
+  proc profileTask(i: int, seconds: real, locations: int, events: c_uint64,
+                   const ref evtCtx: EvtCallbackContext, bytesRead: uint(64)) {
+    profiler.addTask(new taskProfile(localeId=here.id, task=i, seconds=seconds,
+                                     locations=locations, events=events,
+                                     callbacks=evtCtx.callbacks, bytesRead=bytesRead));
+  }
+
+  // Open a reader on the trace, read the events of the given locations and
+  // accumulate them into evtCtx. Each location is decoded on its own by a
+  // local event reader unless --globalReader asks for the global reader,
+  // which merges the locations into one time order first.
+  // Reading stops at the first event past the end of the time window.
+  // Returns the number of events read.
+  proc readEventsForLocations(const ref locs, ref evtCtx: EvtCallbackContext): c_uint64 {
+    if locs.size == 0 then return 0;
+
+    var reader = OTF2_Reader_Open(tracePath.c_str());
+    if reader == nil {
+      writeln("Failed to open trace file");
+      return 0;
+    }
+    OTF2_Reader_SetSerialCollectiveCallbacks(reader);
+
+    // Select locations for this batch
+    for loc in locs {
+      OTF2_Reader_SelectLocation(reader, loc);
+    }
+
+    OTF2_Reader_OpenEvtFiles(reader);
+
+    var totalEventsRead: c_uint64 = 0;
+    if globalReader {
+      for loc in locs {
+        // Mark file to be read by Global Reader later
+        var _evtReader = OTF2_Reader_GetEvtReader(reader, loc);
+      }
+
+      var globalEvtReader = OTF2_Reader_GetGlobalEvtReader(reader);
+      var evtCallbacks = OTF2_GlobalEvtReaderCallbacks_New();
+
+      OTF2_GlobalEvtReaderCallbacks_SetEnterCallback(evtCallbacks,
+                                                    c_ptrTo(Enter_store_and_count): c_fn_ptr);
+      OTF2_GlobalEvtReaderCallbacks_SetLeaveCallback(evtCallbacks,
+                                                    c_ptrTo(Leave_store_and_count): c_fn_ptr);
+
+      OTF2_Reader_RegisterGlobalEvtCallbacks(reader,
+                                            globalEvtReader,
+                                            evtCallbacks,
+                                            c_ptrTo(evtCtx): c_ptr(void));
+
+      OTF2_GlobalEvtReaderCallbacks_Delete(evtCallbacks);
+
+      OTF2_Reader_ReadAllGlobalEvents(reader,
+                                      globalEvtReader,
+                                      c_ptrTo(totalEventsRead));
+
+      OTF2_Reader_CloseGlobalEvtReader(reader, globalEvtReader);
+    } else {
+      var evtCallbacks = OTF2_EvtReaderCallbacks_New();
+      OTF2_EvtReaderCallbacks_SetEnterCallback(evtCallbacks,
+                                               c_ptrTo(Enter_store_and_count_local): c_fn_ptr);
+      OTF2_EvtReaderCallbacks_SetLeaveCallback(evtCallbacks,
+                                               c_ptrTo(Leave_store_and_count_local): c_fn_ptr);
+
+      for loc in locs {
+        var evtReader = OTF2_Reader_GetEvtReader(reader, loc);
+        if evtReader == nil then continue;
+        OTF2_Reader_RegisterEvtCallbacks(reader,
+                                         evtReader,
+                                         evtCallbacks,
+                                         c_ptrTo(evtCtx): c_ptr(void));
+        var eventsRead: c_uint64 = 0;
+        OTF2_Reader_ReadAllLocalEvents(reader, evtReader, c_ptrTo(eventsRead));
+        totalEventsRead += eventsRead;
+        OTF2_Reader_CloseEvtReader(reader, evtReader);
+      }
+
+      OTF2_EvtReaderCallbacks_Delete(evtCallbacks);
+    }
+
+    OTF2_Reader_CloseEvtFiles(reader);
+    OTF2_Reader_Close(reader);
+    return totalEventsRead;
+  }
 
 
   proc main() {
     //writeln("Debug: Starting main");
+    if start > end {
+      writeln("Invalid time window: start ", start, " is after end ", end);
+      return;
+    }
+    profiler.enable("otf2_read_events_parallel", profile);
+    profiler.phase("open");
     var sw: stopwatch;
 
     sw.start();
 
+    // Totals are only kept for complete reads
+    const unwindowed = start == -inf && end == inf;
+    var traceCache: owned MappedTraceCache?;
+    var stamps: traceStamps;
+    if cache {
+      stamps = stampTrace(tracePath);
+      traceCache = openTraceCache(tracePath);
+    }
+    if traceCache != nil && traceCache!.hasTotals && unwindowed {
+      profiler.phase("read cache");
+      const defCtx = traceCache!.definitions();
+      writeln("Read definitions and event totals from ", cachePath(tracePath),
+              " in ", sw.elapsed(), " seconds");
+      report(defCtx, traceCache!.eventsRead, traceCache!.enterCount, traceCache!.leaveCount);
+      return;
+    }
+
     var initial_reader = OTF2_Reader_Open(tracePath.c_str());
     if initial_reader == nil {
       writeln("Failed to open trace file");
@@ -176,50 +268,27 @@ module Otf2ReadEvents {
     const openTime = sw.elapsed();
     writef("Time taken to open initial OTF2 archive: %.2dr seconds\n", openTime);
 
+    profiler.phase("global definitions");
     OTF2_Reader_SetSerialCollectiveCallbacks(initial_reader);
 
     var numberOfLocations: c_uint64 = 0;
     OTF2_Reader_GetNumberOfLocations(initial_reader, c_ptrTo(numberOfLocations));
     writeln("Number of locations: ", numberOfLocations);
 
-    // We create a single data context record for all readers
-    // In order for this to work, the data structures within this record must be parSafe
-    // I have set parSafe=true for the lists and domains.
-    var defCtx = new DefCallbackContext();
-
-    // Definition callbacks setup
-    var globalDefReader : c_ptr(OTF2_GlobalDefReader) = OTF2_Reader_GetGlobalDefReader(initial_reader);
-    var defCallbacks : c_ptr(OTF2_GlobalDefReaderCallbacks) = OTF2_GlobalDefReaderCallbacks_New();
-
-    // Register string callbacks first since locations and regions depend on strings
-    OTF2_GlobalDefReaderCallbacks_SetStringCallback(defCallbacks,
-                                                    c_ptrTo(GlobDefString_Register): c_fn_ptr);
-    OTF2_GlobalDefReaderCallbacks_SetLocationCallback(defCallbacks,
-                                                      c_ptrTo(GlobDefLocation_Register): c_fn_ptr);
-    OTF2_GlobalDefReaderCallbacks_SetRegionCallback(defCallbacks,
-                                                    c_ptrTo(GlobDefRegion_Register): c_fn_ptr);
-
-
-    OTF2_Reader_RegisterGlobalDefCallbacks(initial_reader,
-                                          globalDefReader,
-                                          defCallbacks,
-                                          c_ptrTo(defCtx): c_ptr(void));
-
-    OTF2_GlobalDefReaderCallbacks_Delete(defCallbacks);
-
-    var definitionsRead: c_uint64 = 0;
-    OTF2_Reader_ReadAllGlobalDefinitions(initial_reader,
-                                         globalDefReader,
-                                         c_ptrTo(definitionsRead));
+    // We create a single definition store for all readers
+    // It is only read once the definitions are loaded, so the readers can share copies of it
+    var defCtx = new DefinitionStore();
+    const definitionsRead = readGlobalDefinitions(initial_reader, defCtx);
     writeln("Global definitions read: ", definitionsRead);
 
     const defReadTime = sw.elapsed();
     writef("Time taken to read global definitions: %.2dr seconds\n", defReadTime);
     sw.clear(); // Restart stopwatch for next timing
+    if cache then stamps.stampEvents(tracePath, defCtx);
 
-    // Convert associative domain to array for distribution
-    // This can and should be optimized in some other way perhaps.
-    const locationArray : [0..<numberOfLocations] uint = for l in defCtx.locationIds do l;
+    // Location refs in definition order, for distribution
+    const locationArray : [0..<numberOfLocations] uint = for l in defCtx.locationRefs() do l;
+    const locationWeights = [l in locationArray] defCtx.location(l).numberOfEvents;
     const totalLocs = locationArray.size;
     writeln("Total locations: ", totalLocs);
     writeln("SANITY CHECK:", totalLocs == numberOfLocations);
@@ -228,6 +297,7 @@ module Otf2ReadEvents {
     writeln("Time taken to convert location IDs to array: ", locToArrayTime, " seconds");
     sw.clear();
 
+    profiler.phase("local definitions");
     // Select locations to read definitions from, in this case, all
     for loc in locationArray {
       OTF2_Reader_SelectLocation(initial_reader, loc);
@@ -266,6 +336,9 @@ module Otf2ReadEvents {
     const numberOfReaders = here.maxTaskPar;
     writeln("Number of readers: ", numberOfReaders);
 
+    // Resolved once, every context gets a copy
+    const window = new timeWindow(start, end, defCtx.clockProps);
+
     // Alternatively, we could also put this inside the coforall
     // and then each task would have its own context
     // And we can merge it back later
@@ -274,92 +347,52 @@ module Otf2ReadEvents {
     // Allocate per-reader event contexts that we'll merge after parallel region
     var evtContexts: [0..<numberOfReaders] EvtCallbackContext;
 
-    coforall i in 0..<numberOfReaders with (+ reduce totalEventsReadAcrossReaders, ref defCtx, ref evtContexts) {
-      // Each task will have its own reader
-      var reader = OTF2_Reader_Open(tracePath.c_str());
-
-      if reader != nil {
-        OTF2_Reader_SetSerialCollectiveCallbacks(reader);
-
+    profiler.phase("read events");
+    if schedule == "static" {
+      // Each task gets one fixed bin of locations, balanced by event count
+      const parts = lptPartition(locationArray, locationWeights, numberOfReaders);
+      coforall i in 0..<numberOfReaders with (+ reduce totalEventsReadAcrossReaders, ref defCtx, ref evtContexts) {
         var sw_inner: stopwatch;
         sw_inner.start();
-
-        var numLocationsToReadForThisTask = totalLocs / numberOfReaders;
-        const low = i * numLocationsToReadForThisTask;
-        const high = if i == numberOfReaders - 1 then totalLocs
-                     else (i + 1) * numLocationsToReadForThisTask;
-
-        // Select locations for this task
-        for locIdx in low..<high {
-          const loc = locationArray[locIdx];
-          // writeln("Task ", i, " selecting location ", loc);
-          OTF2_Reader_SelectLocation(reader, loc);
-        }
-
-        // Open files, read local defs per location
-        // const successfulOpenDefFiles =
-        //                     OTF2_Reader_OpenDefFiles(reader) == OTF2_SUCCESS;
-
-        OTF2_Reader_OpenEvtFiles(reader);
-
-        for locIdx in low..<high {
-          const loc = locationArray[locIdx];
-          // Mark file to be read by Global Reader later
-          var _evtReader = OTF2_Reader_GetEvtReader(reader, loc);
-        }
-
-        const markTime = sw_inner.elapsed();
-        writeln("Time taken to mark all local event files for reading: ", markTime, " seconds");
-        sw_inner.clear();
-
-        // if successfulOpenDefFiles {
-        //   OTF2_Reader_CloseDefFiles(reader);
-        // }
-
-        var globalEvtReader = OTF2_Reader_GetGlobalEvtReader(reader);
-        var evtCallbacks = OTF2_GlobalEvtReaderCallbacks_New();
         // Local context for this task; copied into shared array after reading events
-        var localEvtCtx = new EvtCallbackContext(defCtx);
-        ref evtCtx = localEvtCtx;
-
-        OTF2_GlobalEvtReaderCallbacks_SetEnterCallback(evtCallbacks,
-                                                      c_ptrTo(Enter_store_and_count): c_fn_ptr);
-        OTF2_GlobalEvtReaderCallbacks_SetLeaveCallback(evtCallbacks,
-                                                      c_ptrTo(Leave_store_and_count): c_fn_ptr);
-
-
-        OTF2_Reader_RegisterGlobalEvtCallbacks(reader,
-                                              globalEvtReader,
-                                              evtCallbacks,
-                                              c_ptrTo(evtCtx): c_ptr(void));
-
-        OTF2_GlobalEvtReaderCallbacks_Delete(evtCallbacks);
-
-        var totalEventsRead: c_uint64 = 0;
-        OTF2_Reader_ReadAllGlobalEvents(reader,
-                                        globalEvtReader,
-                                        c_ptrTo(totalEventsRead));
-        totalEventsReadAcrossReaders += totalEventsRead;
-
-        const evtReadTime = sw_inner.elapsed();
-        writeln("Time taken to read events (task ", i, "): ", evtReadTime, " seconds");
-        sw_inner.clear();
-        OTF2_Reader_CloseGlobalEvtReader(reader, globalEvtReader);
-        OTF2_Reader_CloseEvtFiles(reader);
-        OTF2_Reader_Close(reader);
-        const closeTime = sw_inner.elapsed();
-        sw_inner.stop();
-        sw_inner.clear();
+        var localEvtCtx = new EvtCallbackContext(defContext=defCtx, window=window);
+        const eventsRead = readEventsForLocations(parts[i], localEvtCtx);
+        totalEventsReadAcrossReaders += eventsRead;
+        writeln("Time taken to read events (task ", i, "): ", sw_inner.elapsed(), " seconds");
+        if profiler.enabled then
+          profileTask(i, sw_inner.elapsed(), parts[i].size, eventsRead, localEvtCtx,
+                      + reduce (for l in parts[i] do eventFileBytes(tracePath, l)));
         // Copy local context with accumulated events into global array slot
         evtContexts[i] = localEvtCtx;
-      } else {
-        writeln("Failed to open trace file");
+      }
+    } else {
+      // Tasks pull batches of locations, heaviest first, until none are left
+      const workQueue = new LocationWorkQueue(locationArray, locationWeights, numberOfReaders);
+      coforall i in 0..<numberOfReaders with (+ reduce totalEventsReadAcrossReaders, ref defCtx, ref evtContexts) {
+        var sw_inner: stopwatch;
+        sw_inner.start();
+        var localEvtCtx = new EvtCallbackContext(defContext=defCtx, window=window);
+        var eventsRead: c_uint64 = 0;
+        var locationsRead = 0;
+        var bytesRead: uint(64) = 0;
+        for batch in workQueue.batches() {
+          const locs = workQueue.locationsIn(batch);
+          eventsRead += readEventsForLocations(locs, localEvtCtx);
+          locationsRead += locs.size;
+          if profiler.enabled then
+            for l in locs do bytesRead += eventFileBytes(tracePath, l);
+        }
+        totalEventsReadAcrossReaders += eventsRead;
+        writeln("Time taken to read events (task ", i, "): ", sw_inner.elapsed(), " seconds");
+        if profiler.enabled then
+          profileTask(i, sw_inner.elapsed(), locationsRead, eventsRead, localEvtCtx, bytesRead);
+        evtContexts[i] = localEvtCtx;
       }
     }
     sw.stop();
     writeln("Total time: ", sw.elapsed(), " seconds");
 
-
+    profiler.phase("merge");
     // --- Merge per-reader contexts into a single aggregated structure ---
     var aggEnterEvents : uint = 0;
     var aggLeaveEvents : uint = 0;
@@ -373,36 +406,55 @@ module Otf2ReadEvents {
     const totalMerged = allEventDataList.size;
     // TODO, write a comparator and sort the list
 
-    // Report aggregated counts
+    if cache && unwindowed {
+      profiler.phase("write cache");
+      try {
+        writeTotalsToCache(tracePath, defCtx, stamps, totalEventsReadAcrossReaders,
+                           aggEnterEvents, aggLeaveEvents, traceCache.borrow());
+        writeln("Wrote trace cache ", cachePath(tracePath));
+      } catch e {
+        writeln("Failed to write trace cache ", cachePath(tracePath), ": ", e);
+      }
+    }
+
+    report(defCtx, totalEventsReadAcrossReaders, aggEnterEvents, aggLeaveEvents);
+  }
+
+  // Report aggregated counts and stats and write the profile
+  proc report(const ref defCtx: DefinitionStore, totalEventsRead: uint(64),
+              aggEnterEvents: uint(64), aggLeaveEvents: uint(64)) {
     writeln("Event Summary:");
-    writeln(" Total number of events: ", totalEventsReadAcrossReaders);
+    writeln(" Total number of events: ", totalEventsRead);
     writeln(" Event types and their counts:");
     writeln("  Aggregated Enter events: ", aggEnterEvents);
     writeln("  Aggregated Leave events: ", aggLeaveEvents);
 
     // Print the stats for unique locations
     printUniqueLocationAndRegionStats(defCtx, false);
+
+    try {
+      profiler.finish();
+    } catch e {
+      writeln("Failed to write profile ", profile, ": ", e);
+    }
   }
 
 
-  proc printUniqueLocationAndRegionStats(defCtx: DefCallbackContext, verbose: bool) {
-    writeln("Total Unique Locations: ", defCtx.locationIds.size);
+  proc printUniqueLocationAndRegionStats(const ref defCtx: DefinitionStore, verbose: bool) {
+    writeln("Total Unique Locations: ", defCtx.numLocations);
     if verbose {
       writeln("Unique Locations:");
-      for locId in defCtx.locationIds {
-        const locName = defCtx.locationTable[locId];
-        if locName != "" {
-          writeln(locName);
-        }
+      for loc in defCtx.locationRefs() {
+        writeln(defCtx.locationName(loc));
       }
     }
 
     // Print the stats for unique regions
-    writeln("Total Unique Regions: ", defCtx.regionIds.size);
+    writeln("Total Unique Regions: ", defCtx.numRegions);
     if verbose {
       writeln("Unique Regions:");
-      for regionId in defCtx.regionIds {
-        writeln(defCtx.regionTable[regionId]);
+      for region in defCtx.regionRefs() {
+        writeln(defCtx.regionName(region));
       }
     }
   }
@@ -71,7 +71,11 @@ module Otf2Read {
     //writeln("Calling OTF2_Reader_SetSerialCollectiveCallbacks");
     OTF2_Reader_SetSerialCollectiveCallbacks(reader);
 
-    otf2ChplSyncReaderSetLockingCallbacks(reader);
+    if otf2ChplSyncReaderSetLockingCallbacks(reader) != OTF2_SUCCESS {
+      writeln("Failed to set locking callbacks");
+      OTF2_Reader_Close(reader);
+      return;
+    }
 
     var number_of_locations: c_uint64 = 0;
     //writeln("Calling OTF2_Reader_GetNumberOfLocations");
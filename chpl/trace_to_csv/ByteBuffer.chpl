@@ -0,0 +1,109 @@
+// Copyright Hewlett Packard Enterprise Development LP.
+
+/*
+ * Growable byte buffer for the binary output writers
+ *
+ * Values are appended in little-endian byte order and the buffer is written
+ * to a fileWriter in one call, so encoders can build whole pages or blocks in
+ * memory and reuse the same storage for the next one via clear().
+ */
+module ByteBufferModule {
+  use IO;
+  use CTypes;
+  import OS.POSIX.memcpy;
+
+  record byteBuffer {
+    var dom: domain(1) = {0..<0};
+    var data: [dom] uint(8);
+    var size: int;
+    // Capacity of the first allocation; small for buffers kept in bulk
+    var minCapacity: int = 4096;
+
+    // Make room for n more bytes, doubling the capacity
+    inline proc ref reserve(n: int) {
+      if size + n > dom.size then
+        dom = {0..<max(size + n, 2 * dom.size, minCapacity)};
+    }
+
+    inline proc ref clear() {
+      size = 0;
+    }
+
+    inline proc isEmpty(): bool {
+      return size == 0;
+    }
+
+    inline proc ref append(b: uint(8)) {
+      reserve(1);
+      data[size] = b;
+      size += 1;
+    }
+
+    proc ref append(const ref s: string) {
+      const n = s.numBytes;
+      if n == 0 then return;
+      reserve(n);
+      memcpy(c_ptrTo(data[size]), s.c_str(): c_ptrConst(void), n: c_size_t);
+      size += n;
+    }
+
+    proc ref append(const ref other: byteBuffer) {
+      if other.size == 0 then return;
+      reserve(other.size);
+      memcpy(c_ptrTo(data[size]), c_ptrToConst(other.data[0]), other.size: c_size_t);
+      size += other.size;
+    }
+
+    inline proc ref appendLE32(x: uint(32)) {
+      reserve(4);
+      for i in 0..<4 do data[size + i] = (x >> (8 * i)): uint(8);
+      size += 4;
+    }
+
+    inline proc ref appendLE64(x: uint(64)) {
+      reserve(8);
+      for i in 0..<8 do data[size + i] = (x >> (8 * i)): uint(8);
+      size += 8;
+    }
+
+    inline proc ref appendReal(x: real) {
+      appendLE64(x.transmute(uint(64)));
+    }
+
+    // Unsigned LEB128 varint, as used by Thrift and the Parquet RLE encoding
+    inline proc ref appendVarint(in x: uint(64)) {
+      while x >= 0x80 {
+        append(((x & 0x7f) | 0x80): uint(8));
+        x >>= 7;
+      }
+      append(x: uint(8));
+    }
+
+    // Decode the varint at pos and advance pos past it
+    inline proc readVarint(ref pos: int): uint(64) {
+      var x: uint(64);
+      var shift = 0;
+      while true {
+        const b = data[pos];
+        pos += 1;
+        x |= (b & 0x7f): uint(64) << shift;
+        if b < 0x80 then break;
+        shift += 7;
+      }
+      return x;
+    }
+
+    // Decode the little-endian word at pos and advance pos past it
+    inline proc readLE64(ref pos: int): uint(64) {
+      var x: uint(64);
+      for i in 0..<8 do x |= data[pos + i]: uint(64) << (8 * i);
+      pos += 8;
+      return x;
+    }
+
+    proc writeTo(ref writer: fileWriter(?)) throws {
+      if size > 0 then
+        writer.writeBinary(data[0..<size]);
+    }
+  }
+}
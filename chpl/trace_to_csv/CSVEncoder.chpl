@@ -0,0 +1,113 @@
+// Copyright Hewlett Packard Enterprise Development LP.
+
+/*
+ * CSV row encoder
+ *
+ * Formats rows into a reusable byteBuffer and hands the buffer to the
+ * fileWriter only once it holds csvFlushBytes, instead of going through
+ * writef (and its format-string parsing) for every row.
+ *
+ *  - Integers are converted with a digit loop.
+ *  - Reals are written with the fewest of 15, 16 or 17 significant digits
+ *    that reads back to the same value, so the text round-trips exactly and
+ *    is no longer than needed.
+ *  - Fields that repeat on every row of a file (thread and group names) are
+ *    meant to be rendered once by the caller and appended as a prefix.
+ *
+ * Usage example:
+ *   var enc = new csvRowEncoder();
+ *   const prefix = thread + "," + group + ",";
+ *   for ... {
+ *     enc.appendString(prefix);
+ *     enc.appendInt(depth);
+ *     enc.comma();
+ *     enc.appendReal(start);
+ *     enc.endRow(writer);
+ *   }
+ *   enc.flush(writer);
+ */
+module CSVEncoderModule {
+  use IO;
+  use CTypes;
+  use ByteBufferModule;
+
+  require "stdio.h", "stdlib.h";
+  private extern proc snprintf(buf: c_ptr(c_char), n: c_size_t,
+                               fmt: c_ptrConst(c_char), args...): c_int;
+  private extern proc strtod(s: c_ptrConst(c_char), endp: c_ptr(c_ptr(c_char))): c_double;
+
+  config const csvFlushBytes = 1 << 16;
+
+  private param commaByte: uint(8) = 0x2c, quoteByte: uint(8) = 0x22,
+                newlineByte: uint(8) = 0x0a, minusByte: uint(8) = 0x2d,
+                zeroByte: uint(8) = 0x30;
+
+  // Longest %.17g output is 24 characters ("-1.2345678901234567e-308")
+  private param maxRealChars = 32;
+
+  record csvRowEncoder {
+    var buf: byteBuffer;
+
+    inline proc ref comma() {
+      buf.append(commaByte);
+    }
+
+    inline proc ref appendString(const ref s: string) {
+      buf.append(s);
+    }
+
+    // The name is wrapped in quotes without escaping, as in the writef format
+    inline proc ref appendQuoted(const ref s: string) {
+      buf.append(quoteByte);
+      buf.append(s);
+      buf.append(quoteByte);
+    }
+
+    proc ref appendUint(in x: uint(64)) {
+      var digits: 20*uint(8);
+      var n = 0;
+      do {
+        digits[n] = zeroByte + (x % 10): uint(8);
+        x /= 10;
+        n += 1;
+      } while x > 0;
+      buf.reserve(n);
+      for i in 0..<n do buf.data[buf.size + i] = digits[n - 1 - i];
+      buf.size += n;
+    }
+
+    proc ref appendInt(x: int(64)) {
+      if x < 0 {
+        buf.append(minusByte);
+        // -(x + 1) + 1 avoids overflowing on min(int)
+        appendUint((-(x + 1)): uint(64) + 1);
+      } else {
+        appendUint(x: uint(64));
+      }
+    }
+
+    proc ref appendReal(x: real) {
+      buf.reserve(maxRealChars);
+      const dst = c_ptrTo(buf.data[buf.size]): c_ptr(c_char);
+      // 17 digits always round-trip (NaN never compares equal and ends there)
+      var n = snprintf(dst, maxRealChars: c_size_t, "%.15g".c_str(), x);
+      if strtod(dst, nil) != x {
+        n = snprintf(dst, maxRealChars: c_size_t, "%.16g".c_str(), x);
+        if strtod(dst, nil) != x then
+          n = snprintf(dst, maxRealChars: c_size_t, "%.17g".c_str(), x);
+      }
+      buf.size += n;
+    }
+
+    // End the row and flush if the buffer is full
+    inline proc ref endRow(ref writer: fileWriter(?)) throws {
+      buf.append(newlineByte);
+      if buf.size >= csvFlushBytes then flush(writer);
+    }
+
+    proc ref flush(ref writer: fileWriter(?)) throws {
+      buf.writeTo(writer);
+      buf.clear();
+    }
+  }
+}
@@ -5,29 +5,33 @@ module CallGraphModule {
   use Sort;
   import Math.inf;
 
+  // Intervals refer to their region by a 32-bit id (the OTF2_RegionRef or any
+  // other interned id) instead of by name, so entering a region copies no
+  // strings and an interval stays at 32 bytes. Names are resolved only when
+  // the intervals are written out.
   record interval {
     var start: real;
     var end: real;         // meaningful only if hasEnd == true
-    var depth: int;
-    var name: string;
+    var region: uint(32);
+    var depth: int(32);
     var hasEnd: bool;
 
     proc init() { // We need this version so our compiler doesn't complain about the comparator
       this.start = 0.0;
       this.end = 0.0;
+      this.region = 0;
       this.depth = 0;
-      this.name = "";
       this.hasEnd = false;
     }
     proc init(start: real,
               end: real = 0.0,
               depth: int = 0,
-              name: string = "",
+              region: uint(32) = 0,
               hasEnd: bool = false) {
       this.start = start;
       this.end = end;
-      this.depth = depth;
-      this.name = name;
+      this.region = region;
+      this.depth = depth: int(32);
       this.hasEnd = hasEnd;
     }
 
@@ -54,8 +58,8 @@ module CallGraphModule {
       const newEnd   = if hasEnd then (if end < rangeEnd then end else rangeEnd)
                                 else rangeEnd;
       if newStart > newEnd then
-        halt("Invalid clipped interval (negative length): start=" + newStart:string + " end=" + newEnd:string + " name=" + name);
-      return new interval(newStart, newEnd, depth, name, hasEnd=true);
+        halt("Invalid clipped interval (negative length): start=" + newStart:string + " end=" + newEnd:string + " region=" + region:string);
+      return new interval(newStart, newEnd, depth, region, hasEnd=true);
     }
 
     proc duration(): real {
@@ -63,65 +67,293 @@ module CallGraphModule {
     }
   }
 
+  // Columnar (structure-of-arrays) storage for intervals.
+  // Each field lives in its own contiguous array, appends grow all of them
+  // geometrically, and no interval record is built until one is asked for.
+  // An interval that is still open has end == inf.
+  record intervalColumns {
+    var dom: domain(1) = {0..<0};
+    var starts: [dom] real;
+    var ends: [dom] real;
+    var depths: [dom] int(32);
+    var regions: [dom] uint(32);
+    var size: int;
+
+    proc ref append(start: real, end: real, depth: int(32), region: uint(32)) {
+      if size == dom.size then
+        dom = {0..<max(16, 2 * dom.size)};
+      starts[size] = start;
+      ends[size] = end;
+      depths[size] = depth;
+      regions[size] = region;
+      size += 1;
+    }
+
+    // Remove the last appended interval
+    proc ref popBack() {
+      size -= 1;
+    }
+
+    proc isEmpty(): bool {
+      return size == 0;
+    }
+
+    proc indices(): range {
+      return 0..<size;
+    }
+
+    proc this(i: int): interval {
+      return new interval(starts[i], ends[i], depths[i], regions[i], hasEnd=true);
+    }
+
+    iter these(): interval {
+      for i in 0..<size do yield this(i);
+    }
+
+    // Sum of the durations of all closed intervals
+    proc totalDuration(): real {
+      return + reduce [i in 0..<size] (if ends[i] < inf then ends[i] - starts[i] else 0.0);
+    }
+
+    // Number of intervals overlapping [rangeStart, rangeEnd)
+    proc countOverlapping(rangeStart: real, rangeEnd: real): int {
+      return + reduce [i in 0..<size] (starts[i] < rangeEnd && rangeStart < ends[i]): int;
+    }
+  }
+
   // Base timeline supporting nested intervals (stack discipline)
+  //
+  // With preserveOrder (the default) every interval gets its slot in
+  // `finished` when it is entered and its end is filled in when it is left.
+  // The event readers deliver the events of a location in time order, so the
+  // slots are then already in start order and exporting the whole timeline is
+  // a linear pass: only runs of intervals with equal starts have to be put in
+  // (end, depth) order. If an enter ever goes back in time the timeline falls
+  // back to sorting.
+  //
+  // Without preserveOrder intervals are appended when they are left and
+  // getIntervalsBetween sorts them. Without storeFinished nothing is kept
+  // beyond the stack of live intervals; callers consume what leave() returns.
+  //
+  // Range queries go through a per-depth time index. Intervals at the same
+  // depth never overlap, so in each depth they are ordered by start and by
+  // end alike, and the first one overlapping a window is found by binary
+  // search on the ends. A query costs O(D log n + k) for D depths and k hits.
   class Timeline {
-    var finished: list(interval);
+    var preserveOrder: bool = true;
+    var storeFinished: bool = true;
+    // Closed intervals, plus the open ones (end == inf) with preserveOrder
+    var finished: intervalColumns;
     var live: list(interval);
+    // Slot in `finished` of each live interval, only with preserveOrder
+    var liveSlots: list(int);
+    var inStartOrder: bool = true;
+    var lastStart: real = -inf;
 
-    proc enter(start: real, name: string) {
+    // Per-depth index over `finished` in CSR form: the slots of depth d are
+    // depthSlots[depthOffsets[d]..<depthOffsets[d+1]], in start order.
+    // Rebuilt lazily after new intervals are added.
+    var indexValid: bool = false;
+    var maxDepth: int;
+    var depthDom: domain(1) = {0..<0};
+    var depthOffsets: [depthDom] int;
+    var slotDom: domain(1) = {0..<0};
+    var depthSlots: [slotDom] int;
+
+    proc enter(start: real, region: uint(32)) {
       var iv = new interval(start=start,
                             depth=live.size+1,
-                            name=name,
+                            region=region,
                             hasEnd=false);
       live.pushBack(iv);
+      if start < lastStart then
+        inStartOrder = false;
+      lastStart = start;
+      if keepsSlots() {
+        indexValid = false;
+        liveSlots.pushBack(finished.size);
+        finished.append(start, inf, iv.depth, region);
+      }
       return iv;
     }
 
-    proc leave(end: real) {
+    // Close the innermost live interval and return it
+    proc leave(end: real): interval {
       if live.isEmpty() then
         halt("No active intervals to leave");
-      var iv = live.popBack();
+      const iv = live.popBack();
       if iv.hasEnd then
         halt("interval already closed");
-      iv.end = end;
-      iv.hasEnd = true;
-      finished.pushBack(iv);
+      if keepsSlots() {
+        // Closing an interval keeps its slot, the index stays valid
+        finished.ends[liveSlots.popBack()] = end;
+      } else if storeFinished {
+        indexValid = false;
+        finished.append(iv.start, end, iv.depth, iv.region);
+      }
+      return new interval(iv.start, end, iv.depth, iv.region, hasEnd=true);
+    }
+
+    // Close the innermost live interval without recording it, for intervals
+    // that end before the time window being extracted. Everything entered
+    // after it must have been discarded as well, so its slot is the last one.
+    proc discard() {
+      if live.isEmpty() then
+        halt("No active intervals to discard");
+      live.popBack();
+      if keepsSlots() {
+        if liveSlots.popBack() != finished.size - 1 then
+          halt("Discarded interval is not the last one entered");
+        indexValid = false;
+        finished.popBack();
+      }
+    }
+
+    proc buildIndex() {
+      const n = finished.size;
+      maxDepth = 0;
+      for j in 0..<n do maxDepth = max(maxDepth, finished.depths[j]: int);
+      depthDom = {0..maxDepth+1};
+      depthOffsets = 0;
+      for j in 0..<n do depthOffsets[finished.depths[j] + 1] += 1;
+      for d in 1..maxDepth+1 do depthOffsets[d] += depthOffsets[d-1];
+      slotDom = {0..<n};
+      var next = depthOffsets;
+      for j in 0..<n {
+        const d = finished.depths[j];
+        depthSlots[next[d]] = j;
+        next[d] += 1;
+      }
+      indexValid = true;
+    }
+
+    // Slots in `finished` of the stored intervals overlapping
+    // [rangeStart, rangeEnd). The intervals are not copied, read them with
+    // finished.starts[j] etc. Slots come out grouped by depth.
+    iter slotsBetween(rangeStart: real, rangeEnd: real): int {
+      if !inStartOrder {
+        // Depths are no longer guaranteed to be ordered, scan everything
+        for j in finished.indices() do
+          if finished.starts[j] < rangeEnd && rangeStart < finished.ends[j] then
+            yield j;
+      } else {
+        if !indexValid then buildIndex();
+        for d in 1..maxDepth {
+          const hi = depthOffsets[d+1];
+          // First slot at this depth ending after rangeStart
+          var lo = depthOffsets[d], top = hi;
+          while lo < top {
+            const mid = (lo + top) / 2;
+            if finished.ends[depthSlots[mid]] <= rangeStart then lo = mid + 1;
+            else top = mid;
+          }
+          for k in lo..<hi {
+            const j = depthSlots[k];
+            if finished.starts[j] >= rangeEnd then break;
+            yield j;
+          }
+        }
+      }
+    }
+
+    // True if intervals get their slot in `finished` at enter()
+    proc keepsSlots(): bool {
+      return preserveOrder && storeFinished;
+    }
+
+    // True if `finished` is in start order and only equal-start runs need sorting
+    proc isOrdered(): bool {
+      return keepsSlots() && inStartOrder;
     }
 
     proc getIntervalsBetween(rangeStart: real, rangeEnd: real): [] interval {
       if rangeStart > rangeEnd then
         halt("Start greater than end in getIntervalsBetween");
 
-      var tmp: list(interval);
+      var ids = for j in slotsBetween(rangeStart, rangeEnd) do j;
+      // Slot order is start order in an ordered timeline
+      if isOrdered() then sort(ids);
 
-      // Finished intervals
-      for iv in finished {
-        if iv.hasOverlap(new interval(rangeStart, rangeEnd, hasEnd=true)) {
-          tmp.pushBack(iv.clip(rangeStart, rangeEnd));
-        }
+      const rangeIv = new interval(rangeStart, rangeEnd, hasEnd=true);
+      var nLive = 0;
+      if !keepsSlots() then
+        for iv in live do if iv.hasOverlap(rangeIv) then nLive += 1;
+      var A: [0..#(ids.size + nLive)] interval;
+      var i = 0;
+
+      // Stored intervals, clipped straight from the columns
+      // (open ones have end == inf and are clipped to rangeEnd)
+      for j in ids {
+        const s = finished.starts[j], e = finished.ends[j];
+        if s > e then
+          halt("Invalid clipped interval (negative length): start=" + s:string + " end=" + e:string + " region=" + finished.regions[j]:string);
+        A[i] = new interval(max(s, rangeStart), min(e, rangeEnd),
+                            finished.depths[j], finished.regions[j], hasEnd=true);
+        i += 1;
       }
       // Live intervals (treat as ending at rangeEnd for clipping)
-      for iv in live {
-        if iv.hasOverlap(new interval(rangeStart, rangeEnd, hasEnd=true)) {
-          const clipped =
-            if iv.start < rangeStart
-              then new interval(rangeStart, rangeEnd, iv.depth, iv.name, hasEnd=true)
-              else new interval(iv.start, rangeEnd, iv.depth, iv.name, hasEnd=true);
-          tmp.pushBack(clipped);
+      if !keepsSlots() {
+        for iv in live {
+          if iv.hasOverlap(rangeIv) {
+            A[i] = new interval(max(iv.start, rangeStart), rangeEnd, iv.depth, iv.region, hasEnd=true);
+            i += 1;
+          }
         }
       }
 
-      // Move into array for sorting
-      const n = tmp.size;
-      var A: [0..#n] interval;
-      var i = 0;
-      for v in tmp { A[i] = v; i += 1; }
-
       // Sort by (start, end, depth)
-      sort(A, comparator = new intervalComparator());
+      if isOrdered() then
+        sortEqualStartRuns(A);
+      else
+        sort(A, comparator = new intervalComparator());
 
       return A;
     }
+
+    // All intervals in (start, end, depth) order, open ones ending at inf.
+    // With an ordered timeline this streams over the columns without
+    // building the whole result.
+    iter intervalsInOrder(): interval {
+      if !isOrdered() {
+        for iv in getIntervalsBetween(-inf, inf) do yield iv;
+      } else {
+        var run: list(interval);
+        for j in finished.indices() {
+          if !run.isEmpty() && finished.starts[j] != run[0].start {
+            for iv in sortedRun(run) do yield iv;
+            run.clear();
+          }
+          run.pushBack(finished[j]);
+        }
+        for iv in sortedRun(run) do yield iv;
+      }
+    }
+  }
+
+  // Put runs of equal start in (end, depth) order. A run is at most as long
+  // as the stack is deep plus any zero-length siblings, so insertion sort is
+  // cheaper than a general sort here.
+  proc sortEqualStartRuns(ref A: [] interval) {
+    const cmp = new intervalComparator();
+    for i in A.domain.low+1..A.domain.high {
+      const x = A[i];
+      var j = i - 1;
+      while j >= A.domain.low && A[j].start == x.start && cmp.compare(x, A[j]) < 0 {
+        A[j+1] = A[j];
+        j -= 1;
+      }
+      A[j+1] = x;
+    }
+  }
+
+  private iter sortedRun(ref run: list(interval)): interval {
+    if run.size == 1 {
+      yield run[0];
+    } else if run.size > 1 {
+      var A = run.toArray();
+      sortEqualStartRuns(A);
+      for iv in A do yield iv;
+    }
   }
 
   record intervalComparator : relativeComparator {}
@@ -150,8 +382,8 @@ module CallGraphModule {
   // Simple usage example
   // proc main() {
   //   var cg = new CallGraph();
-  //   cg.enter(0.0, "A");
-  //     cg.enter(1.0, "B");
+  //   cg.enter(0.0, regionA);
+  //     cg.enter(1.0, regionB);
   //     cg.leave(3.0);   // B
   //   cg.leave(5.0);     // A
   // }
@@ -0,0 +1,115 @@
+// Copyright Hewlett Packard Enterprise Development LP.
+
+/*
+ * Precompiled Enter/Leave event filter
+ *
+ * The process, MPI/HIP and region filters of the converters depend only on
+ * the definitions. They are resolved once, after the global definitions are
+ * read, into bitsets over region refs and location indices. Callbacks then
+ * test one bit instead of comparing process names and lowercasing region
+ * names on every event.
+ *
+ * A region counts as MPI or HIP if its paradigm says so, or if its name
+ * starts with "mpi" or "hip" (any case). The name check covers measurement
+ * systems that leave the paradigm unset.
+ *
+ * Usage example:
+ *   const filter = compileEventFilter(defs, processesToTrack,
+ *                                     excludeMPI=true, excludeHIP=false,
+ *                                     excludeRegions="^omp_");
+ *   if filter.skipsLocation(defs.locationIndex(location)) then ...
+ *   if filter.skipsRegion(region) then ...
+ */
+module EventFilterModule {
+  use OTF2;
+  use Regex;
+  use BitOps;
+  use DefinitionStore;
+
+  record bitSet {
+    var dom: domain(1) = {0..<0};
+    var words: [dom] uint(64);
+
+    // Make bits 0..<n available, all cleared
+    proc ref resize(n: int) {
+      dom = {0..<(n + 63) / 64};
+      words = 0;
+    }
+
+    inline proc ref set(i: int) {
+      words[i >> 6] |= 1: uint(64) << (i & 63);
+    }
+
+    // Bits past the end read as cleared
+    inline proc test(i: int): bool {
+      const w = i >> 6;
+      return i >= 0 && w < dom.size && ((words[w] >> (i & 63)) & 1) != 0;
+    }
+
+    proc count(): int {
+      var n = 0;
+      for w in words do n += popCount(w): int;
+      return n;
+    }
+  }
+
+  record EventFilter {
+    // Regions whose Enter/Leave events are dropped
+    var skipRegions: bitSet;
+    // Locations, by DefinitionStore index, whose events are dropped
+    var skipLocations: bitSet;
+    // Whether events of locations missing from the definitions are dropped
+    var skipUnknownLocations: bool;
+
+    inline proc skipsRegion(r: OTF2_RegionRef): bool {
+      return skipRegions.test(r: int);
+    }
+
+    inline proc skipsLocation(i: int): bool {
+      return if i < 0 then skipUnknownLocations else skipLocations.test(i);
+    }
+  }
+
+  private proc isParadigmRegion(const ref region: Region, paradigm: OTF2_Paradigm,
+                                prefix: string): bool {
+    return region.paradigm == paradigm || region.name.toLower().startsWith(prefix);
+  }
+
+  // Throws if includeRegions or excludeRegions is not a valid regex. Regions
+  // are kept only if they match includeRegions (when given) and do not match
+  // excludeRegions; an empty processesToTrack keeps every location.
+  proc compileEventFilter(const ref defs: DefinitionStore,
+                          const ref processesToTrack: domain(string),
+                          excludeMPI: bool, excludeHIP: bool,
+                          includeRegions: string = "",
+                          excludeRegions: string = ""): EventFilter throws {
+    var f: EventFilter;
+
+    f.skipRegions.resize(defs.regionDom.size);
+    for r in defs.regionRefs() {
+      const ref region = defs.region(r);
+      if (excludeMPI && isParadigmRegion(region, OTF2_PARADIGM_MPI, "mpi")) ||
+         (excludeHIP && isParadigmRegion(region, OTF2_PARADIGM_HIP, "hip")) then
+        f.skipRegions.set(r: int);
+    }
+    if includeRegions != "" {
+      const re = new regex(includeRegions);
+      for r in defs.regionRefs() do
+        if !re.search(defs.regionName(r)).matched then f.skipRegions.set(r: int);
+    }
+    if excludeRegions != "" {
+      const re = new regex(excludeRegions);
+      for r in defs.regionRefs() do
+        if re.search(defs.regionName(r)).matched then f.skipRegions.set(r: int);
+    }
+
+    f.skipLocations.resize(defs.numLocations);
+    if !processesToTrack.isEmpty() {
+      for i in 0..<defs.numLocations do
+        if !processesToTrack.contains(defs.locations[i].processName) then
+          f.skipLocations.set(i);
+      f.skipUnknownLocations = !processesToTrack.contains(unknownLocation.processName);
+    }
+    return f;
+  }
+}
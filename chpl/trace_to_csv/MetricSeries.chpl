@@ -0,0 +1,212 @@
+// Copyright Hewlett Packard Enterprise Development LP.
+
+/*
+ * Compact metric time series
+ *
+ * A metricSeries holds the samples of one metric member. Consecutive samples
+ * with the same value are run-length encoded, replacing the old "only store
+ * on change" list of (seconds, type, value) tuples:
+ *
+ *  - Run start times stay in OTF2 ticks and are stored as varint deltas to
+ *    the previous run start, so a sample every 1e8 ticks takes 4 bytes.
+ *    Deltas wrap around modulo 2^64, so out-of-order samples are still exact.
+ *  - Run lengths follow as varints in the same buffer.
+ *  - Values are stored once per run as 64-bit words in the representation of
+ *    the series' OTF2 value type, which is fixed for the whole series.
+ *
+ * A metricSeriesSet holds the series recorded on one location (or group),
+ * indexed by metric member ref, so storing a sample is two array lookups
+ * instead of two string-keyed map lookups. Metric classes with several
+ * members (e.g. PAPI counter sets) get one series per member, and
+ * metricTracking maps the values of an event to those members.
+ *
+ * Usage example:
+ *   var set: metricSeriesSet;
+ *   ref series = set.seriesFor(member, OTF2_TYPE_DOUBLE);
+ *   series.add(time, metricValueBits(OTF2_TYPE_DOUBLE, value));
+ *   for series in set do
+ *     for (start, bits, length) in series.runs() do
+ *       writeln(start, " ", series.realValue(bits), " x", length);
+ */
+module MetricSeriesModule {
+  use OTF2;
+  use List;
+  use ByteBufferModule;
+  use DefinitionStore;
+
+  // Value types the writers know how to output
+  inline proc isNumericMetricType(t: OTF2_Type): bool {
+    return t == OTF2_TYPE_INT64 || t == OTF2_TYPE_UINT64 || t == OTF2_TYPE_DOUBLE;
+  }
+
+  // The 64 bits of a metric value in the representation of its type
+  inline proc metricValueBits(valueType: OTF2_Type, value: OTF2_MetricValue): uint(64) {
+    if valueType == OTF2_TYPE_INT64 then return value.signed_int: uint(64);
+    if valueType == OTF2_TYPE_DOUBLE then return value.floating_point.transmute(uint(64));
+    return value.unsigned_int;
+  }
+
+  record metricSeries {
+    var member: OTF2_MetricMemberRef;
+    var valueType: OTF2_Type;
+    // Samples recorded, including the repeated values folded into runs
+    var numSamples: int;
+    var numRuns: int;
+    // Start and length of the last run, which is still open
+    var lastStart: OTF2_TimeStamp;
+    var lastLength: int;
+    // Per run: varint start delta, then the varint length once the run ends
+    var ticks = new byteBuffer(minCapacity=64);
+    var valueDom: domain(1) = {0..<0};
+    var values: [valueDom] uint(64);
+
+    proc ref add(time: OTF2_TimeStamp, bits: uint(64)) {
+      numSamples += 1;
+      if numRuns > 0 && values[numRuns - 1] == bits {
+        lastLength += 1;
+        return;
+      }
+      if numRuns > 0 then ticks.appendVarint(lastLength: uint(64));
+      ticks.appendVarint(time - lastStart);
+      lastStart = time;
+      lastLength = 1;
+      if numRuns == valueDom.size then
+        valueDom = {0..<max(16, 2 * valueDom.size)};
+      values[numRuns] = bits;
+      numRuns += 1;
+    }
+
+    // Start time, value and number of samples of every run, in sample order
+    iter runs(): (OTF2_TimeStamp, uint(64), int) {
+      var pos = 0;
+      var start: OTF2_TimeStamp = 0;
+      for r in 0..<numRuns {
+        start += ticks.readVarint(pos);
+        const length = if r < numRuns - 1 then ticks.readVarint(pos): int
+                                          else lastLength;
+        yield (start, values[r], length);
+      }
+    }
+
+    inline proc realValue(bits: uint(64)): real {
+      if valueType == OTF2_TYPE_INT64 then return (bits: int(64)): real;
+      if valueType == OTF2_TYPE_DOUBLE then return bits.transmute(real);
+      return bits: real;
+    }
+
+    // Bytes allocated for the samples
+    proc storageBytes(): int {
+      return ticks.dom.size + 8 * valueDom.size;
+    }
+  }
+
+  record metricSeriesSet {
+    // 1 + index into series of each metric member ref, 0 if it has no samples
+    var slotDom: domain(1) = {0..<0};
+    var slotOf: [slotDom] int;
+    var series: list(metricSeries);
+
+    proc size: int {
+      return series.size;
+    }
+
+    // The series of member, created on its first sample
+    proc ref seriesFor(member: OTF2_MetricMemberRef, valueType: OTF2_Type) ref : metricSeries {
+      const m = member: int;
+      if m >= slotDom.size then
+        slotDom = {0..<max(m + 1, 2 * slotDom.size, 16)};
+      if slotOf[m] == 0 {
+        series.pushBack(new metricSeries(member=member, valueType=valueType));
+        slotOf[m] = series.size;
+      }
+      return series[slotOf[m] - 1];
+    }
+
+    // Series in the order of their first sample
+    iter these() const ref : metricSeries {
+      for i in 0..<series.size do yield series[i];
+    }
+
+    // Append every series to buf, see decodeMetricSeriesSet
+    proc encode(ref buf: byteBuffer) {
+      buf.appendVarint(series.size: uint(64));
+      for s in this {
+        buf.appendVarint(s.member: uint(64));
+        buf.append(s.valueType: uint(8));
+        buf.appendVarint(s.numSamples: uint(64));
+        buf.appendVarint(s.numRuns: uint(64));
+        buf.appendLE64(s.lastStart);
+        buf.appendVarint(s.lastLength: uint(64));
+        buf.appendVarint(s.ticks.size: uint(64));
+        for i in 0..<s.ticks.size do buf.append(s.ticks.data[i]);
+        for r in 0..<s.numRuns do buf.appendLE64(s.values[r]);
+      }
+    }
+  }
+
+  // The set encoded at pos in buf by metricSeriesSet.encode, advancing pos past it
+  proc decodeMetricSeriesSet(const ref buf: byteBuffer, ref pos: int): metricSeriesSet {
+    var set: metricSeriesSet;
+    const numSeries = buf.readVarint(pos): int;
+    for 0..<numSeries {
+      const member = buf.readVarint(pos): OTF2_MetricMemberRef;
+      const valueType = buf.data[pos]: OTF2_Type;
+      pos += 1;
+      ref s = set.seriesFor(member, valueType);
+      s.numSamples = buf.readVarint(pos): int;
+      s.numRuns = buf.readVarint(pos): int;
+      s.lastStart = buf.readLE64(pos);
+      s.lastLength = buf.readVarint(pos): int;
+      const tickBytes = buf.readVarint(pos): int;
+      s.ticks.reserve(tickBytes);
+      for i in 0..<tickBytes do s.ticks.append(buf.data[pos + i]);
+      pos += tickBytes;
+      s.valueDom = {0..<s.numRuns};
+      for r in 0..<s.numRuns do s.values[r] = buf.readLE64(pos);
+    }
+    return set;
+  }
+
+  // The metric members whose values each metric ref's events carry. A metric
+  // event holds one value per member of its metric class, so value k of an
+  // event for ref m belongs to members[first[m] + k] (-1 if untracked), for
+  // k < count[m]; count[m] is 0 when no member is tracked. Resolved once per
+  // reader, so the metric callback ingests a whole event with array lookups
+  // and no name comparisons.
+  record metricTracking {
+    var refDom: domain(1);
+    var first: [refDom] int;
+    var count: [refDom] int;
+    var memberDom: domain(1);
+    var members: [memberDom] int;
+  }
+
+  // An empty metricsToTrack tracks every metric when trackAllIfEmpty is set
+  proc resolveMetricTracking(const ref defCtx: DefinitionStore,
+                             const ref metricsToTrack: domain(string),
+                             trackAllIfEmpty: bool = true): metricTracking {
+    var t: metricTracking;
+    t.refDom = {0..<defCtx.metricRefBound()};
+    t.memberDom = {0..<defCtx.numClassMembers};
+    // Members are flattened per class in DefinitionStore.classMembers, and
+    // instances share the range of their class
+    for i in t.memberDom {
+      const ref name = defCtx.metricMember(defCtx.classMembers[i]).name;
+      t.members[i] = if metricsToTrack.contains(name) || (trackAllIfEmpty && metricsToTrack.isEmpty())
+                       then defCtx.classMembers[i]: int else -1;
+    }
+    for m in t.refDom {
+      const metricClass = defCtx.metricClassOf(m: OTF2_MetricRef);
+      if !defCtx.hasMetricClass(metricClass) then continue;
+      const ref mc = defCtx.metricClasses[metricClass: int];
+      const members = mc.firstMember..#(mc.numberOfMetrics: int);
+      // Events of refs without tracked members are skipped outright
+      var anyTracked = false;
+      for i in members do if t.members[i] >= 0 then anyTracked = true;
+      if !anyTracked then continue;
+      t.first[m] = mc.firstMember;
+      t.count[m] = members.size;
+    }
+    return t;
+  }
+}
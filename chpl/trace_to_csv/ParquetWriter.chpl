@@ -0,0 +1,436 @@
+// Copyright Hewlett Packard Enterprise Development LP.
+
+/*
+ * Minimal Parquet file writer
+ *
+ * Writes flat tables of required INT32, DOUBLE and UTF8 string columns,
+ * enough for the call graph and metric tables, without depending on the
+ * Arrow/Parquet C++ libraries.
+ *
+ *  - Rows are buffered per column and written out in row groups of
+ *    rowGroupSize rows, one uncompressed data page per column chunk.
+ *  - INT32 and DOUBLE columns are PLAIN encoded, so readers load them as-is.
+ *  - String columns are dictionary encoded: a PLAIN dictionary page per
+ *    column chunk followed by the value indices in the RLE/bit-packed hybrid
+ *    encoding. Thread and group names repeat on every row and collapse to a
+ *    single RLE run.
+ *  - Metadata (page headers and the footer) is written with the Thrift
+ *    compact protocol.
+ *
+ * Usage example:
+ *   var pq = new ParquetFileWriter(path);
+ *   const nameCol = pq.addColumn("Name", columnKind.STRING);
+ *   const timeCol = pq.addColumn("Time", columnKind.DOUBLE);
+ *   for ... {
+ *     pq.addString(nameCol, name);
+ *     pq.addReal(timeCol, time);
+ *     pq.endRow();
+ *   }
+ *   pq.close();
+ */
+module ParquetWriterModule {
+  use IO;
+  use List;
+  use Map;
+  use ByteBufferModule;
+
+  enum columnKind { INT32, DOUBLE, STRING }
+
+  config const parquetRowGroupSize = 1 << 20;
+
+  // parquet.thrift enums
+  private param typeInt32 = 1, typeDouble = 5, typeByteArray = 6;
+  private param repetitionRequired = 0;
+  private param convertedUTF8 = 0;
+  private param encPlain = 0, encPlainDictionary = 2, encRLE = 3, encRLEDictionary = 8;
+  private param codecUncompressed = 0;
+  private param pageData = 0, pageDictionary = 2;
+
+  // Thrift compact protocol type ids
+  private param ctI32 = 5, ctI64 = 6, ctBinary = 8, ctList = 9, ctStruct = 12;
+
+  // Literal runs of the hybrid encoding are capped at 63 groups of 8 values,
+  // which keeps their header in one byte
+  private param maxLiteralGroups = 63;
+
+  // Writer for the Thrift compact protocol. Field ids are delta-encoded
+  // against the previous field of the enclosing struct.
+  record thriftCompactWriter {
+    var out: byteBuffer;
+    var lastField: int;
+    var fieldStack: list(int);
+
+    proc ref clear() {
+      out.clear();
+      lastField = 0;
+      fieldStack.clear();
+    }
+
+    inline proc ref zigzag(x: int(64)) {
+      out.appendVarint(((x << 1) ^ (x >> 63)): uint(64));
+    }
+
+    proc ref fieldHeader(id: int, ct: int) {
+      const delta = id - lastField;
+      if delta > 0 && delta <= 15 {
+        out.append(((delta << 4) | ct): uint(8));
+      } else {
+        out.append(ct: uint(8));
+        zigzag(id);
+      }
+      lastField = id;
+    }
+
+    proc ref i32Field(id: int, x: int) {
+      fieldHeader(id, ctI32);
+      zigzag(x);
+    }
+
+    proc ref i64Field(id: int, x: int) {
+      fieldHeader(id, ctI64);
+      zigzag(x);
+    }
+
+    proc ref stringField(id: int, const ref s: string) {
+      fieldHeader(id, ctBinary);
+      stringElem(s);
+    }
+
+    proc ref listField(id: int, elemType: int, n: int) {
+      fieldHeader(id, ctList);
+      if n < 15 {
+        out.append(((n << 4) | elemType): uint(8));
+      } else {
+        out.append((0xf0 | elemType): uint(8));
+        out.appendVarint(n: uint(64));
+      }
+    }
+
+    proc ref i32Elem(x: int) {
+      zigzag(x);
+    }
+
+    proc ref stringElem(const ref s: string) {
+      out.appendVarint(s.numBytes: uint(64));
+      out.append(s);
+    }
+
+    // Start a nested struct, either as a field or as a list element
+    proc ref beginStruct(id: int) {
+      fieldHeader(id, ctStruct);
+      beginStruct();
+    }
+
+    proc ref beginStruct() {
+      fieldStack.pushBack(lastField);
+      lastField = 0;
+    }
+
+    proc ref endStruct() {
+      out.append(0: uint(8));
+      if !fieldStack.isEmpty() then lastField = fieldStack.popBack();
+    }
+  }
+
+  // Buffered values of one column for the current row group
+  record parquetColumn {
+    var name: string;
+    var kind: columnKind;
+    // PLAIN encoded values of INT32 and DOUBLE columns
+    var values: byteBuffer;
+    // Dictionary and value indices of STRING columns
+    var dictIndex: map(string, int(32));
+    var dictValues: list(string);
+    var keys: list(int(32));
+    // Consecutive rows usually repeat the same string, skip the lookup then
+    var lastKey: int(32) = -1;
+
+    proc physicalType(): int {
+      select kind {
+        when columnKind.INT32 do return typeInt32;
+        when columnKind.DOUBLE do return typeDouble;
+        otherwise do return typeByteArray;
+      }
+    }
+  }
+
+  // Location and size of a column chunk, for the footer
+  record chunkMeta {
+    var start: int;
+    var size: int;
+    var numValues: int;
+    var dataOffset: int;
+    var dictOffset: int = -1;
+  }
+
+  record rowGroupMeta {
+    var numRows: int;
+    var totalBytes: int;
+    var chunks: list(chunkMeta);
+  }
+
+  // Number of bits needed for dictionary indices below n (at least 1)
+  proc bitWidthFor(n: int): int {
+    var w = 1;
+    while (1 << w) < n do w += 1;
+    return w;
+  }
+
+  // Append keys to out in the RLE/bit-packed hybrid encoding. Runs of 8 or
+  // more equal keys become RLE runs, everything else is bit-packed in groups
+  // of 8. Only the final literal run may be padded.
+  proc encodeHybrid(ref out: byteBuffer, const ref keys: list(int(32)), bitWidth: int) {
+    const n = keys.size;
+    const valueBytes = (bitWidth + 7) / 8;
+
+    proc flushLiterals(lo: int, hi: int) {
+      var i = lo;
+      while i < hi {
+        const count = min(hi - i, maxLiteralGroups * 8);
+        const groups = (count + 7) / 8;
+        out.appendVarint(((groups << 1) | 1): uint(64));
+        var acc: uint(64) = 0;
+        var bits = 0;
+        for j in i..<i + groups * 8 {
+          const k = if j < hi then keys[j]: uint(64) else 0: uint(64);
+          acc |= k << bits;
+          bits += bitWidth;
+          while bits >= 8 {
+            out.append((acc & 0xff): uint(8));
+            acc >>= 8;
+            bits -= 8;
+          }
+        }
+        i += count;
+      }
+    }
+
+    var i = 0;
+    var litStart = 0;
+    while i < n {
+      var j = i + 1;
+      while j < n && keys[j] == keys[i] do j += 1;
+      const runLen = j - i;
+      const numLiterals = i - litStart;
+      if runLen >= 8 && numLiterals % 8 == 0 {
+        flushLiterals(litStart, i);
+        out.appendVarint((runLen << 1): uint(64));
+        const k = keys[i]: uint(64);
+        for b in 0..<valueBytes do out.append((k >> (8 * b)): uint(8));
+        i = j;
+        litStart = i;
+      } else if runLen >= 8 {
+        // Fill up the current literal group from the run, the rest of it can
+        // still be an RLE run
+        i += 8 - numLiterals % 8;
+      } else {
+        i = j;
+      }
+    }
+    flushLiterals(litStart, n);
+  }
+
+  class ParquetFileWriter {
+    const path: string;
+    const rowGroupSize: int;
+    var outfile: file;
+    var writer: fileWriter(locking=false);
+    var columns: list(parquetColumn);
+    var rowGroups: list(rowGroupMeta);
+    var rowsInGroup: int;
+    var numRows: int;
+    // Bytes written so far, for the offsets in the footer
+    var offset: int;
+    var page: byteBuffer;
+    var thrift: thriftCompactWriter;
+
+    proc init(path: string, rowGroupSize: int = parquetRowGroupSize) throws {
+      this.path = path;
+      this.rowGroupSize = rowGroupSize;
+      init this;
+      outfile = open(path, ioMode.cw);
+      writer = outfile.writer(locking=false);
+      page.append("PAR1");
+      writeBuffer(page);
+    }
+
+    proc addColumn(name: string, kind: columnKind): int {
+      if numRows > 0 || rowsInGroup > 0 then
+        halt("ParquetFileWriter: columns must be added before the first row");
+      columns.pushBack(new parquetColumn(name, kind));
+      return columns.size - 1;
+    }
+
+    proc addInt32(col: int, x: int(32)) {
+      columns[col].values.appendLE32(x: uint(32));
+    }
+
+    proc addReal(col: int, x: real) {
+      columns[col].values.appendReal(x);
+    }
+
+    proc addString(col: int, const ref s: string) {
+      ref c = columns[col];
+      if c.lastKey < 0 || c.dictValues[c.lastKey] != s {
+        if !c.dictIndex.contains(s) {
+          c.dictIndex.add(s, c.dictValues.size: int(32));
+          c.dictValues.pushBack(s);
+        }
+        c.lastKey = try! c.dictIndex[s];
+      }
+      c.keys.pushBack(c.lastKey);
+    }
+
+    proc endRow() throws {
+      rowsInGroup += 1;
+      if rowsInGroup >= rowGroupSize then flushRowGroup();
+    }
+
+    proc writeBuffer(const ref buf: byteBuffer) throws {
+      buf.writeTo(writer);
+      offset += buf.size;
+    }
+
+    // Write a page header followed by the page itself
+    proc writePage(pageType: int, numValues: int, encoding: int,
+                   const ref body: byteBuffer) throws {
+      thrift.clear();
+      thrift.i32Field(1, pageType);
+      thrift.i32Field(2, body.size);
+      thrift.i32Field(3, body.size);
+      if pageType == pageDictionary {
+        thrift.beginStruct(7);
+        thrift.i32Field(1, numValues);
+        thrift.i32Field(2, encoding);
+        thrift.endStruct();
+      } else {
+        thrift.beginStruct(5);
+        thrift.i32Field(1, numValues);
+        thrift.i32Field(2, encoding);
+        // Required columns carry no levels, but the encodings are mandatory
+        thrift.i32Field(3, encRLE);
+        thrift.i32Field(4, encRLE);
+        thrift.endStruct();
+      }
+      thrift.endStruct();
+      writeBuffer(thrift.out);
+      writeBuffer(body);
+    }
+
+    proc writeChunk(ref col: parquetColumn): chunkMeta throws {
+      var meta = new chunkMeta(start=offset, numValues=rowsInGroup);
+      if col.kind == columnKind.STRING {
+        page.clear();
+        for s in col.dictValues {
+          page.appendLE32(s.numBytes: uint(32));
+          page.append(s);
+        }
+        meta.dictOffset = offset;
+        writePage(pageDictionary, col.dictValues.size, encPlainDictionary, page);
+
+        page.clear();
+        const bitWidth = bitWidthFor(col.dictValues.size);
+        page.append(bitWidth: uint(8));
+        encodeHybrid(page, col.keys, bitWidth);
+        meta.dataOffset = offset;
+        writePage(pageData, rowsInGroup, encRLEDictionary, page);
+
+        col.dictIndex.clear();
+        col.dictValues.clear();
+        col.keys.clear();
+        col.lastKey = -1;
+      } else {
+        meta.dataOffset = offset;
+        writePage(pageData, rowsInGroup, encPlain, col.values);
+        col.values.clear();
+      }
+      meta.size = offset - meta.start;
+      return meta;
+    }
+
+    proc flushRowGroup() throws {
+      if rowsInGroup == 0 then return;
+      var rg = new rowGroupMeta(numRows=rowsInGroup);
+      const groupStart = offset;
+      for c in 0..<columns.size do
+        rg.chunks.pushBack(writeChunk(columns[c]));
+      rg.totalBytes = offset - groupStart;
+      rowGroups.pushBack(rg);
+      numRows += rowsInGroup;
+      rowsInGroup = 0;
+    }
+
+    // FileMetaData: schema, row groups and the location of every chunk
+    proc writeFooter() throws {
+      thrift.clear();
+      thrift.i32Field(1, 1);
+      thrift.listField(2, ctStruct, columns.size + 1);
+      thrift.beginStruct();
+      thrift.stringField(4, "schema");
+      thrift.i32Field(5, columns.size);
+      thrift.endStruct();
+      for col in columns {
+        thrift.beginStruct();
+        thrift.i32Field(1, col.physicalType());
+        thrift.i32Field(3, repetitionRequired);
+        thrift.stringField(4, col.name);
+        if col.kind == columnKind.STRING then
+          thrift.i32Field(6, convertedUTF8);
+        thrift.endStruct();
+      }
+      thrift.i64Field(3, numRows);
+      thrift.listField(4, ctStruct, rowGroups.size);
+      for rg in rowGroups {
+        thrift.beginStruct();
+        thrift.listField(1, ctStruct, rg.chunks.size);
+        for (col, chunk) in zip(columns, rg.chunks) {
+          thrift.beginStruct();
+          thrift.i64Field(2, chunk.start);
+          // ColumnMetaData
+          thrift.beginStruct(3);
+          thrift.i32Field(1, col.physicalType());
+          if col.kind == columnKind.STRING {
+            thrift.listField(2, ctI32, 3);
+            thrift.i32Elem(encPlainDictionary);
+            thrift.i32Elem(encRLE);
+            thrift.i32Elem(encRLEDictionary);
+          } else {
+            thrift.listField(2, ctI32, 2);
+            thrift.i32Elem(encPlain);
+            thrift.i32Elem(encRLE);
+          }
+          thrift.listField(3, ctBinary, 1);
+          thrift.stringElem(col.name);
+          thrift.i32Field(4, codecUncompressed);
+          thrift.i64Field(5, chunk.numValues);
+          thrift.i64Field(6, chunk.size);
+          thrift.i64Field(7, chunk.size);
+          thrift.i64Field(9, chunk.dataOffset);
+          if chunk.dictOffset >= 0 then
+            thrift.i64Field(11, chunk.dictOffset);
+          thrift.endStruct();
+          thrift.endStruct();
+        }
+        thrift.i64Field(2, rg.totalBytes);
+        thrift.i64Field(3, rg.numRows);
+        thrift.endStruct();
+      }
+      thrift.stringField(6, "fastotf2 trace_to_csv");
+      thrift.endStruct();
+
+      const footerSize = thrift.out.size;
+      writeBuffer(thrift.out);
+      page.clear();
+      page.appendLE32(footerSize: uint(32));
+      page.append("PAR1");
+      writeBuffer(page);
+    }
+
+    proc close() throws {
+      flushRowGroup();
+      writeFooter();
+      writer.close();
+      outfile.close();
+    }
+  }
+}
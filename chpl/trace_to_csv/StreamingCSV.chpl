@@ -0,0 +1,178 @@
+// Copyright Hewlett Packard Enterprise Development LP.
+
+/*
+ * Streaming call graph CSV output
+ *
+ * An IntervalStreamWriter writes the intervals of one thread to its CSV file
+ * as they are closed, so the reader only has to keep the stack of live
+ * intervals per thread instead of the whole call graph.
+ *
+ * Intervals close in leave order. For output in the usual
+ * (start, end, depth) order the writer spills each depth to its own run file
+ * instead: intervals at one depth never overlap, so they close in start order
+ * and every run is already sorted. finish() then k-way merges the runs into
+ * the CSV file. Memory stays bounded by the stack depth either way, as long
+ * as each location's writer is finished once the location is read.
+ */
+module StreamingCSVModule {
+  use IO;
+  use List;
+  use FileSystem;
+  use CallGraphModule;
+  use CSVEncoderModule;
+  use DefinitionStore;
+  import Math.inf;
+
+  // Spill file holding the intervals of one depth, in start order
+  class DepthRun {
+    const path: string;
+    var outfile: file;
+    var writer: fileWriter(locking=false);
+
+    proc init(path: string) throws {
+      this.path = path;
+      init this;
+      outfile = open(path, ioMode.cw);
+      writer = outfile.writer(locking=false);
+    }
+
+    proc add(iv: interval) throws {
+      writer.writeBinary(iv.start);
+      writer.writeBinary(iv.end);
+      writer.writeBinary(iv.region);
+    }
+
+    proc close() throws {
+      writer.close();
+      outfile.close();
+    }
+  }
+
+  // Read side of a DepthRun during the merge
+  class RunReader {
+    const path: string;
+    const depth: int;
+    var infile: file;
+    var reader: fileReader(locking=false);
+    var head: interval;
+    var hasHead: bool;
+
+    proc init(path: string, depth: int) throws {
+      this.path = path;
+      this.depth = depth;
+      init this;
+      infile = open(path, ioMode.r);
+      reader = infile.reader(locking=false);
+    }
+
+    proc advance() throws {
+      var start, end: real;
+      var region: uint(32);
+      hasHead = reader.readBinary(start) &&
+                reader.readBinary(end) &&
+                reader.readBinary(region);
+      if hasHead then
+        head = new interval(start, end, depth, region, hasEnd=true);
+    }
+
+    proc close() throws {
+      reader.close();
+      infile.close();
+      remove(path);
+    }
+  }
+
+  // Opening the output or a spill file throws, so a run that hits the open
+  // file limit reports it like any other write error
+  class IntervalStreamWriter {
+    const path: string;
+    const thread: string;
+    const group: string;
+    const sorted: bool;
+    var outfile: file;
+    var writer: fileWriter(locking=false);
+    // Spill runs by depth, only used for sorted output
+    var runs: list(owned DepthRun?);
+    var enc: csvRowEncoder;
+    const prefix: string;
+
+    proc init(path: string, thread: string, group: string, sorted: bool) throws {
+      this.path = path;
+      this.thread = thread;
+      this.group = group;
+      this.sorted = sorted;
+      this.prefix = thread + "," + group + ",";
+      init this;
+      outfile = open(path, ioMode.cw);
+      writer = outfile.writer(locking=false);
+      writer.writeln("Thread,Group,Depth,Name,Start Time,End Time,Duration");
+    }
+
+    proc writeRow(iv: interval, const ref defs: DefinitionStore) throws {
+      const end = if iv.hasEnd then iv.end else inf;
+      enc.appendString(prefix);
+      enc.appendInt(iv.depth);
+      enc.comma();
+      enc.appendQuoted(defs.regionName(iv.region));
+      enc.comma();
+      enc.appendReal(iv.start);
+      enc.comma();
+      enc.appendReal(end);
+      enc.comma();
+      enc.appendReal(end - iv.start);
+      enc.endRow(writer);
+    }
+
+    // Record a closed interval
+    proc add(iv: interval, const ref defs: DefinitionStore) throws {
+      if !sorted {
+        writeRow(iv, defs);
+        return;
+      }
+      const d = iv.depth: int;
+      while runs.size < d do runs.pushBack(nil);
+      if runs[d-1] == nil then
+        runs[d-1] = new DepthRun(path + ".depth" + d:string + ".run");
+      runs[d-1]!.add(iv);
+    }
+
+    // Write out the intervals still open at the end of the trace (they end at
+    // inf, as in the non-streaming output), merge the runs if the output is
+    // sorted and close the file
+    proc finish(const ref live: list(interval), const ref defs: DefinitionStore) throws {
+      for iv in live do
+        add(new interval(iv.start, inf, iv.depth, iv.region, hasEnd=true), defs);
+
+      if sorted {
+        var readers: list(owned RunReader);
+        for d in 0..<runs.size {
+          if runs[d] == nil then continue;
+          runs[d]!.close();
+          var r = new RunReader(runs[d]!.path, d + 1);
+          r.advance();
+          readers.pushBack(r);
+        }
+        runs.clear();
+
+        // The stack is shallow, a linear scan over the run heads is enough
+        const cmp = new intervalComparator();
+        while true {
+          var best = -1;
+          for i in 0..<readers.size {
+            if !readers[i].hasHead then continue;
+            if best < 0 || cmp.compare(readers[i].head, readers[best].head) < 0 then
+              best = i;
+          }
+          if best < 0 then break;
+          writeRow(readers[best].head, defs);
+          readers[best].advance();
+        }
+        for r in readers do r.close();
+      }
+
+      enc.flush(writer);
+      writer.close();
+      outfile.close();
+    }
+  }
+}
@@ -0,0 +1,1040 @@
+// Copyright Hewlett Packard Enterprise Development LP.
+
+/*
+ * Event reading and output shared by the trace_to_csv converters
+ *
+ * The callbacks, per-reader contexts, merge and CSV/Parquet writers used by
+ * trace_to_csv_parallel (one node) and trace_to_csv_distributed (one set of
+ * reader tasks per locale). Everything the callbacks need at event time is
+ * in EvtCallbackArgs, which is copied into every context, so reader tasks on
+ * any locale only touch local memory.
+ */
+module TraceToCSVCommon {
+  use OTF2;
+  use List;
+  use Map;
+  use CallGraphModule;
+  use StreamingCSVModule;
+  use CSVEncoderModule;
+  use ParquetWriterModule;
+  use MetricSeriesModule;
+  use EventFilterModule;
+  use TimeWindow;
+  use IO;
+  use Path;
+  use DefinitionStore;
+  use LocationPartition;
+  use DynamicIters;
+  use PhaseProfiler;
+  use Time;
+  use Sort;
+  use TraceCache;
+  use ByteBufferModule;
+
+  import Math.inf;
+
+  enum LogLevel {
+    NONE,
+    ERROR,
+    WARN,
+    INFO,
+    DEBUG,
+    TRACE
+  }
+
+  var log: LogLevel = LogLevel.INFO;
+
+
+  const BLUE = "\x1b[94m";
+  const GREEN = "\x1b[92m";
+  const YELLOW = "\x1b[93m";
+  const RED = "\x1b[91m";
+  const ENDC = "\x1b[0m";
+
+  proc logError(args ...?n) {
+    if log >= LogLevel.ERROR {
+      writeln(RED, "[ERROR] ", ENDC, (...args));
+    }
+  }
+
+  proc logWarn(args ...?n) {
+    if log >= LogLevel.WARN {
+      writeln(YELLOW, "[WARN] ", ENDC, (...args));
+    }
+  }
+  
+  proc logInfo(args ...?n) {
+    if log >= LogLevel.INFO {
+      writeln(GREEN, "[INFO] ", ENDC, (...args));
+    }
+  }
+
+  proc logDebug(args ...?n) {
+    if log >= LogLevel.DEBUG {
+      writeln(BLUE, "[DEBUG] ", ENDC, (...args));
+    }
+  }
+
+  proc logTrace(args ...?n) {
+    if log >= LogLevel.TRACE {
+      writeln(RED, "[TRACE] ", ENDC, (...args));
+    }
+  }
+
+
+  record EvtCallbackArgs {
+    const processesToTrack: domain(string);
+    const metricsToTrack: domain(string);
+    // Command line settings. They are copied into every context instead of
+    // being read from module variables, which live on locale 0.
+    const trace: string;
+    const outputDir: string = ".";
+    const format: string = "csv";
+    const excludeMPI: bool;
+    const excludeHIP: bool;
+    // Regex filters on region names, empty to keep every region
+    const includeRegions: string;
+    const excludeRegions: string;
+    const stream: bool;
+    const sortedStream: bool;
+    // Time window to extract, in seconds as returned by timestampToSeconds
+    const start: real = -inf;
+    const end: real = inf;
+    // Read through the global, time-merging event reader instead of one
+    // local reader per location
+    const globalReader: bool = false;
+    const log: LogLevel = LogLevel.INFO;
+
+    // The same settings writing to another directory
+    proc withOutputDir(dir: string): EvtCallbackArgs {
+      return new EvtCallbackArgs(processesToTrack=processesToTrack,
+                                 metricsToTrack=metricsToTrack,
+                                 trace=trace,
+                                 outputDir=dir,
+                                 format=format,
+                                 excludeMPI=excludeMPI,
+                                 excludeHIP=excludeHIP,
+                                 includeRegions=includeRegions,
+                                 excludeRegions=excludeRegions,
+                                 stream=stream,
+                                 sortedStream=sortedStream,
+                                 start=start,
+                                 end=end,
+                                 globalReader=globalReader,
+                                 log=log);
+    }
+  }
+
+  // Every location is read by exactly one context, so results are kept per
+  // location and the merge only has to move them into place
+  record EvtCallbackContext {
+    const evtArgs: EvtCallbackArgs;
+    var defContext: DefinitionStore;
+    // Process and region filters, compiled from evtArgs once per run
+    const filter: EventFilter;
+    // evtArgs.start and evtArgs.end in ticks of the trace clock
+    const window: timeWindow;
+    // Call graph of each location (thread) that had events
+    var callGraphs: map(OTF2_LocationRef, shared CallGraph);
+    // Metrics recorded on each location, by metric member
+    var metrics: map(OTF2_LocationRef, metricSeriesSet);
+    // With --stream, the CSV writer of each location read by this context
+    var streams: map(OTF2_LocationRef, shared IntervalStreamWriter);
+    // Metric members carried by the events of each metric ref
+    var tracking: metricTracking;
+    // Every event the callbacks see, for --profile
+    var callbacks: eventCounts;
+
+    proc init(evtArgs: EvtCallbackArgs,
+              defContext: DefinitionStore,
+              filter: EventFilter) {
+      this.evtArgs = evtArgs;
+      this.defContext = defContext;
+      this.filter = filter;
+      this.window = new timeWindow(evtArgs.start, evtArgs.end, defContext.clockProps);
+      this.callGraphs = new map(OTF2_LocationRef, shared CallGraph);
+      this.metrics = new map(OTF2_LocationRef, metricSeriesSet);
+      this.streams = new map(OTF2_LocationRef, shared IntervalStreamWriter);
+      this.tracking = resolveMetricTracking(defContext, evtArgs.metricsToTrack);
+    }
+  }
+
+  // Results of all readers, one slot per location in DefinitionStore order
+  record MergedResults {
+    const numLocations: int;
+    var callGraphs: [0..<numLocations] shared CallGraph?;
+    var metrics: [0..<numLocations] metricSeriesSet;
+  }
+
+  proc updateMaps(ref ctx: EvtCallbackContext, location: OTF2_LocationRef,
+                  locGroup: string, locName: string) {
+    // The call graph and metric series of a location are created together
+    if ctx.callGraphs.contains(location) then return;
+
+    logDebug("New call graph for thread: ", locName, " in group ", locGroup);
+    // When streaming, intervals go to the CSV writer as they close and
+    // the call graph only keeps the stack of live intervals
+    ctx.callGraphs.add(location, new shared CallGraph(preserveOrder=!ctx.evtArgs.stream,
+                                                      storeFinished=!ctx.evtArgs.stream));
+    ctx.metrics.add(location, new metricSeriesSet());
+  }
+
+  // Resolve the filters of evtArgs against the definitions, exiting if a
+  // region regex does not compile
+  proc eventFilterFor(const ref defCtx: DefinitionStore,
+                      const ref evtArgs: EvtCallbackArgs): EventFilter {
+    var filter: EventFilter;
+    try {
+      filter = compileEventFilter(defCtx, evtArgs.processesToTrack,
+                                  evtArgs.excludeMPI, evtArgs.excludeHIP,
+                                  evtArgs.includeRegions, evtArgs.excludeRegions);
+    } catch e {
+      logError("Invalid region filter: ", e);
+      exit(1);
+    }
+    logDebug("Event filter skips ", filter.skipRegions.count(), " of ", defCtx.numRegions,
+             " regions and ", filter.skipLocations.count(), " of ", defCtx.numLocations, " locations");
+    return filter;
+  }
+
+  // The locations the filter keeps, in DefinitionStore order. Readers only
+  // select these, so the event files of filtered-out processes are never
+  // opened.
+  proc selectedLocations(const ref defCtx: DefinitionStore,
+                         const ref filter: EventFilter): [] OTF2_LocationRef {
+    var selected: list(OTF2_LocationRef);
+    for i in 0..<defCtx.numLocations do
+      if !filter.skipsLocation(i) then selected.pushBack(defCtx.locations[i].id);
+    return selected.toArray();
+  }
+
+  // --- Event callbacks (now operate on EvtCallbackContext) ---
+  proc Enter_callback(location: OTF2_LocationRef,
+                      time: OTF2_TimeStamp,
+                      userData: c_ptr(void),
+                      attributes: c_ptr(OTF2_AttributeList),
+                      region: OTF2_RegionRef): OTF2_CallbackCode {
+    // Get pointers to the context and event data
+    var ctxPtr = userData: c_ptr(EvtCallbackContext);
+    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
+    ref ctx = ctxPtr.deref();
+    ref defCtx = ctx.defContext;
+    ctx.callbacks.enter += 1;
+
+    // Events come in time order, nothing after this one is in the window
+    if ctx.window.isAfter(time) then
+      return OTF2_CALLBACK_INTERRUPT;
+
+    if ctx.filter.skipsLocation(defCtx.locationIndex(location)) then
+      return OTF2_CALLBACK_SUCCESS;
+
+    const ref loc = defCtx.location(location);
+    const ref locName = loc.name;
+    const ref locGroup = loc.processName;
+    updateMaps(ctx, location, locGroup, locName);
+
+    if ctx.filter.skipsRegion(region) then
+      return OTF2_CALLBACK_SUCCESS;
+
+    // Get current time in seconds. Regions entered before the window are
+    // still pushed, clipped to its start, so the stack is right once it opens.
+    const currentTime = if ctx.window.isBefore(time) then ctx.window.start
+                        else timestampToSeconds(time, defCtx.clockProps);
+
+    // Enter Callgraph
+    ref callGraph = try! ctx.callGraphs[location];
+    callGraph.enter(currentTime, region);
+
+    return OTF2_CALLBACK_SUCCESS;
+  }
+
+  proc Leave_callback(location: OTF2_LocationRef,
+                      time: OTF2_TimeStamp,
+                      userData: c_ptr(void),
+                      attributes: c_ptr(OTF2_AttributeList),
+                      region: OTF2_RegionRef): OTF2_CallbackCode {
+    // Get pointers to the context and event data
+    var ctxPtr = userData: c_ptr(EvtCallbackContext);
+    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
+    ref ctx = ctxPtr.deref();
+    if ctx.evtArgs.log >= LogLevel.TRACE then
+      logTrace("Debug: Entering Leave_callback with location=", location, ", region=", region);
+    ref defCtx = ctx.defContext;
+    ctx.callbacks.leave += 1;
+
+    if ctx.window.isAfter(time) then
+      return OTF2_CALLBACK_INTERRUPT;
+
+    if ctx.filter.skipsLocation(defCtx.locationIndex(location)) then
+      return OTF2_CALLBACK_SUCCESS;
+
+    const ref loc = defCtx.location(location);
+    const ref locName = loc.name;
+    const ref locGroup = loc.processName;
+    updateMaps(ctx, location, locGroup, locName);
+
+    if ctx.filter.skipsRegion(region) then
+      return OTF2_CALLBACK_SUCCESS;
+
+    ref callGraph = try! ctx.callGraphs[location];
+    // Intervals that end before or at the window start are dropped
+    if ctx.window.endsBefore(time) {
+      callGraph.discard();
+      return OTF2_CALLBACK_SUCCESS;
+    }
+
+    // Get current time in seconds
+    const currentTime = timestampToSeconds(time, defCtx.clockProps);
+
+    // Leave Callgraph
+    const closed = callGraph.leave(currentTime); // We ignore regionName here
+    if ctx.evtArgs.stream {
+      try {
+        streamInterval(ctx, location, closed);
+      } catch e {
+        logError("Error streaming interval for ", locName, " in group ", locGroup, ": ", e);
+        return OTF2_CALLBACK_ERROR;
+      }
+    }
+
+    return OTF2_CALLBACK_SUCCESS;
+  }
+
+  proc Metric_callback(location: OTF2_LocationRef,
+                       time: OTF2_TimeStamp,
+                       userData: c_ptr(void),
+                       attributeList: c_ptr(OTF2_AttributeList),
+                       metric: OTF2_MetricRef,
+                       numberOfMetrics: c_uint8,
+                       typeIDs: c_ptrConst(OTF2_Type),
+                       metricValues: c_ptrConst(OTF2_MetricValue)): OTF2_CallbackCode {
+
+    // Get pointers to the context and event data
+    var ctxPtr = userData: c_ptr(EvtCallbackContext);
+    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
+    ref ctx = ctxPtr.deref();
+    ref defCtx = ctx.defContext;
+    ctx.callbacks.metric += 1;
+    if ctx.window.isAfter(time) then
+      return OTF2_CALLBACK_INTERRUPT;
+    if ctx.window.isBefore(time) then
+      return OTF2_CALLBACK_SUCCESS;
+    // Skip refs whose metric class has no tracked member
+    const m = metric: int;
+    if m >= ctx.tracking.refDom.size || ctx.tracking.count[m] == 0 then
+      return OTF2_CALLBACK_SUCCESS;
+    const first = ctx.tracking.first[m];
+    // The event carries one value per member of the metric class
+    const n = min(numberOfMetrics: int, ctx.tracking.count[m]);
+    if ctx.filter.skipsLocation(defCtx.locationIndex(location)) then
+      return OTF2_CALLBACK_SUCCESS;
+
+    const ref loc = defCtx.location(location);
+    updateMaps(ctx, location, loc.processName, loc.name);
+
+    // Consecutive equal values are folded into one run of each series
+    ref locMetrics = try! ctx.metrics[location];
+    for k in 0..<n {
+      const member = ctx.tracking.members[first + k];
+      // Only numeric values of tracked members are written out
+      const valueType = typeIDs[k];
+      if member < 0 || !isNumericMetricType(valueType) then continue;
+      ref series = locMetrics.seriesFor(member: OTF2_MetricMemberRef, valueType);
+      if series.valueType != valueType {
+        logWarn("Metric ", defCtx.metricMember(series.member).name, " changed value type, dropping sample");
+        continue;
+      }
+      series.add(time, metricValueBits(valueType, metricValues[k]));
+    }
+
+    return OTF2_CALLBACK_SUCCESS;
+  }
+
+  // --- Local event reader callbacks ---
+  // The per-location readers also pass the position of the event in its
+  // location's stream; the rest is the same as for the global reader.
+  proc Enter_local_callback(location: OTF2_LocationRef,
+                            time: OTF2_TimeStamp,
+                            eventPosition: c_uint64,
+                            userData: c_ptr(void),
+                            attributes: c_ptr(OTF2_AttributeList),
+                            region: OTF2_RegionRef): OTF2_CallbackCode {
+    return Enter_callback(location, time, userData, attributes, region);
+  }
+
+  proc Leave_local_callback(location: OTF2_LocationRef,
+                            time: OTF2_TimeStamp,
+                            eventPosition: c_uint64,
+                            userData: c_ptr(void),
+                            attributes: c_ptr(OTF2_AttributeList),
+                            region: OTF2_RegionRef): OTF2_CallbackCode {
+    return Leave_callback(location, time, userData, attributes, region);
+  }
+
+  proc Metric_local_callback(location: OTF2_LocationRef,
+                             time: OTF2_TimeStamp,
+                             eventPosition: c_uint64,
+                             userData: c_ptr(void),
+                             attributeList: c_ptr(OTF2_AttributeList),
+                             metric: OTF2_MetricRef,
+                             numberOfMetrics: c_uint8,
+                             typeIDs: c_ptrConst(OTF2_Type),
+                             metricValues: c_ptrConst(OTF2_MetricValue)): OTF2_CallbackCode {
+    return Metric_callback(location, time, userData, attributeList, metric,
+                           numberOfMetrics, typeIDs, metricValues);
+  }
+
+  // Move the per-location results of every context into one MergedResults.
+  // Locations are disjoint between contexts, so each context fills its own
+  // slots in parallel and only the references move: no lists or maps are
+  // copied and the cost does not depend on the number of events.
+  proc mergeEvtContexts(ref contexts: [] EvtCallbackContext,
+                        const ref defCtx: DefinitionStore): MergedResults {
+    var merged = new MergedResults(defCtx.numLocations);
+    forall ctx in contexts with (ref merged) {
+      for (location, callGraph) in ctx.callGraphs.items() {
+        const i = defCtx.locationIndex(location);
+        if i < 0 then continue;
+        merged.callGraphs[i] = callGraph;
+      }
+      for location in ctx.metrics.keys() {
+        const i = defCtx.locationIndex(location);
+        if i < 0 then continue;
+        ref locMetrics = try! ctx.metrics[location];
+        merged.metrics[i] <=> locMetrics;
+      }
+      ctx.callGraphs.clear();
+      ctx.metrics.clear();
+    }
+    return merged;
+  }
+
+  // --- Sidecar cache (--cache), see TraceCache ---
+
+  // The options that decide which call graphs and metrics a run extracts.
+  // Cached results are only reused by a run with the same key.
+  proc cacheKey(const ref evtArgs: EvtCallbackArgs): string {
+    var processes = [p in evtArgs.processesToTrack] p;
+    var metrics = [m in evtArgs.metricsToTrack] m;
+    sort(processes);
+    sort(metrics);
+    return "processes=" + ",".join(processes) +
+           ";metrics=" + ",".join(metrics) +
+           ";excludeMPI=" + evtArgs.excludeMPI: string +
+           ";excludeHIP=" + evtArgs.excludeHIP: string +
+           ";includeRegions=" + evtArgs.includeRegions +
+           ";excludeRegions=" + evtArgs.excludeRegions +
+           ";start=" + evtArgs.start: string +
+           ";end=" + evtArgs.end: string;
+  }
+
+  // Write the definitions and, unless they were streamed, the call graphs
+  // and metrics of a run to the sidecar of the trace, replacing old. stamps
+  // are of the files the run read. A failure only costs the next run its
+  // shortcut, so it is not fatal.
+  proc writeResultsToCache(const ref results: MergedResults,
+                           const ref defCtx: DefinitionStore,
+                           const ref evtArgs: EvtCallbackArgs,
+                           const ref stamps: traceStamps,
+                           old: borrowed MappedTraceCache?) {
+    try {
+      var w = createTraceCacheWriter(evtArgs.trace, defCtx, stamps);
+      if !evtArgs.stream {
+        var buf = new byteBuffer();
+        for i in 0..<results.numLocations {
+          if results.callGraphs[i] != nil {
+            const callGraph = results.callGraphs[i]!;
+            const ref f = callGraph.finished;
+            w.addIntervals(i, f.starts, f.ends, f.depths, f.regions, f.size,
+                           callGraph.isOrdered());
+          }
+          if results.metrics[i].size > 0 {
+            buf.clear();
+            results.metrics[i].encode(buf);
+            w.addMetrics(i, buf.data, buf.size);
+          }
+        }
+        w.setIntervalsKey(cacheKey(evtArgs));
+      }
+      w.finish(old);
+      logInfo("Wrote trace cache ", cachePath(evtArgs.trace));
+    } catch e {
+      logWarn("Error writing trace cache ", cachePath(evtArgs.trace), ": ", e);
+    }
+  }
+
+  // Results for the locations with the given indices, read from the sidecar
+  // instead of the event files. The call graphs hold exactly the columns
+  // the run that wrote them had, so the output is the same.
+  proc loadCachedResults(cache: borrowed MappedTraceCache,
+                         const ref defCtx: DefinitionStore,
+                         const ref indices): MergedResults {
+    var merged = new MergedResults(defCtx.numLocations);
+    forall i in indices with (ref merged) {
+      if cache.hasCallGraph(i) {
+        const n = cache.intervalCount(i);
+        var callGraph = new shared CallGraph();
+        callGraph.finished.dom = {0..<n};
+        cache.copyIntervals(i, callGraph.finished.starts, callGraph.finished.ends,
+                            callGraph.finished.depths, callGraph.finished.regions);
+        callGraph.finished.size = n;
+        callGraph.inStartOrder = cache.intervalsInStartOrder(i);
+        merged.callGraphs[i] = callGraph;
+      }
+      if cache.hasMetrics(i) {
+        var buf = new byteBuffer();
+        buf.reserve(cache.metricsBytes(i));
+        cache.copyMetrics(i, buf.data);
+        buf.size = cache.metricsBytes(i);
+        var pos = 0;
+        merged.metrics[i] = decodeMetricSeriesSet(buf, pos);
+      }
+    }
+    return merged;
+  }
+
+  proc callgraphFilename(group: string, thread: string, format: string): string {
+    return group + "_" + thread.replace(" ", "_") + "_callgraph." + format;
+  }
+
+  // Reserve the streamed call graph file of each of the given locations
+  // that the filter keeps, before any task writes one (see
+  // Location.callGraphFile). Files are named by group and thread, so of
+  // several locations sharing a name only the first one gets a file, as in
+  // writeCallGraphsAndMetricsToCSV.
+  proc reserveCallGraphFiles(ref defCtx: DefinitionStore,
+                             const ref evtArgs: EvtCallbackArgs,
+                             const ref filter: EventFilter,
+                             const ref locations) {
+    var reserved: domain(string);
+    for location in locations {
+      const i = defCtx.locationIndex(location);
+      if i < 0 || filter.skipsLocation(i) then continue;
+      ref loc = defCtx.locations[i];
+      if !isTrackedGroup(evtArgs, loc.processName) then continue;
+      const filename = callgraphFilename(loc.processName, loc.name, evtArgs.format);
+      if reserved.contains(filename) {
+        logWarn("Duplicate thread ", loc.name, " in group ", loc.processName, ", only the first is written.");
+        continue;
+      }
+      reserved += filename;
+      loc.callGraphFile = filename;
+    }
+  }
+
+  // Open the streamed call graph file of a location
+  proc openStream(ref ctx: EvtCallbackContext, location: OTF2_LocationRef,
+                  const ref loc: Location) throws {
+    logInfo("Streaming to file: ", loc.callGraphFile);
+    ctx.streams.add(location, new shared IntervalStreamWriter(joinPath(ctx.evtArgs.outputDir, loc.callGraphFile),
+                                                              loc.name, loc.processName,
+                                                              ctx.evtArgs.sortedStream));
+  }
+
+  // Write a closed interval to the streamed call graph file of its location,
+  // opened on its first interval. Locations without a reserved file are
+  // skipped.
+  proc streamInterval(ref ctx: EvtCallbackContext, location: OTF2_LocationRef,
+                      closed: interval) throws {
+    const ref loc = ctx.defContext.location(location);
+    if loc.callGraphFile == "" then return;
+    if !ctx.streams.contains(location) then openStream(ctx, location, loc);
+    ctx.streams[location].add(closed, ctx.defContext);
+  }
+
+  // Finish the streamed call graph file of a location once it is read: write
+  // the intervals that are still open, merge sorted output, and create the
+  // file if a tracked thread never closed an interval. Files are closed as
+  // soon as their location is done, so the open files of a task stay bounded
+  // by the stack depth of the location it reads, not by its locations.
+  proc finishStream(location: OTF2_LocationRef, ref ctx: EvtCallbackContext) {
+    if !ctx.callGraphs.contains(location) then return;
+    const ref defCtx = ctx.defContext;
+    const ref loc = defCtx.location(location);
+    if loc.callGraphFile == "" then return;
+    try {
+      const callGraph = ctx.callGraphs[location];
+      if !ctx.streams.contains(location) then openStream(ctx, location, loc);
+      ctx.streams[location].finish(callGraph.live, defCtx);
+      ctx.streams.remove(location);
+    } catch e {
+      logError("Error finishing streamed callgraph CSV ", loc.callGraphFile, ": ", e);
+    }
+  }
+
+  proc finishStreams(const ref locs, ref ctx: EvtCallbackContext) {
+    for location in locs do finishStream(location, ctx);
+  }
+
+  // Close the intervals of a location still open at the end of the time
+  // window, clipped to it as getIntervalsBetween clips them, instead of
+  // leaving them open
+  proc closeAtWindowEnd(location: OTF2_LocationRef, ref ctx: EvtCallbackContext) {
+    if !ctx.window.hasEnd || !ctx.callGraphs.contains(location) then return;
+    const callGraph = try! ctx.callGraphs[location];
+    while !callGraph.live.isEmpty() {
+      const closed = callGraph.leave(ctx.window.end);
+      if ctx.evtArgs.stream {
+        try {
+          streamInterval(ctx, location, closed);
+        } catch e {
+          const ref loc = ctx.defContext.location(location);
+          logError("Error streaming interval for ", loc.name, " in group ", loc.processName, ": ", e);
+          return;
+        }
+      }
+    }
+  }
+
+  proc closeAtWindowEnd(const ref locs, ref ctx: EvtCallbackContext) {
+    for location in locs do closeAtWindowEnd(location, ctx);
+  }
+
+  // Open a reader on the trace, read the events of the given locations and
+  // accumulate them into ctx. Returns the number of events read.
+  //
+  // Results are kept per location, so nothing needs the events of different
+  // locations merged into one time order. By default every location is
+  // decoded on its own by a local event reader, one after the other; the
+  // global event reader, which keeps a priority queue over all selected
+  // locations to interleave them by time, is only used with globalReader.
+  // Either way reading stops at the first event past the end of the time
+  // window: per location with local readers, for all of them otherwise.
+  proc readEventsForLocations(const ref locs, ref ctx: EvtCallbackContext): c_uint64 {
+    if locs.size == 0 then return 0;
+    if !ctx.evtArgs.globalReader then return readLocalEventsForLocations(locs, ctx);
+
+    var reader = OTF2_Reader_Open(ctx.evtArgs.trace.c_str());
+    if reader == nil {
+      logError("Failed to open trace file for ", locs.size, " location(s)");
+      return 0;
+    }
+    OTF2_Reader_SetSerialCollectiveCallbacks(reader);
+
+    // Select locations
+    for loc in locs {
+      OTF2_Reader_SelectLocation(reader, loc);
+    }
+
+    OTF2_Reader_OpenEvtFiles(reader);
+
+    // Mark files
+    for loc in locs {
+      var _evtReader = OTF2_Reader_GetEvtReader(reader, loc);
+    }
+
+    // Setup callbacks
+    var globalEvtReader = OTF2_Reader_GetGlobalEvtReader(reader);
+    var evtCallbacks = OTF2_GlobalEvtReaderCallbacks_New();
+
+    OTF2_GlobalEvtReaderCallbacks_SetEnterCallback(evtCallbacks, c_ptrTo(Enter_callback): c_fn_ptr);
+    OTF2_GlobalEvtReaderCallbacks_SetLeaveCallback(evtCallbacks, c_ptrTo(Leave_callback): c_fn_ptr);
+    OTF2_GlobalEvtReaderCallbacks_SetMetricCallback(evtCallbacks, c_ptrTo(Metric_callback): c_fn_ptr);
+
+    OTF2_Reader_RegisterGlobalEvtCallbacks(reader, globalEvtReader, evtCallbacks, c_ptrTo(ctx): c_ptr(void));
+    OTF2_GlobalEvtReaderCallbacks_Delete(evtCallbacks);
+
+    var totalEventsRead: c_uint64 = 0;
+    OTF2_Reader_ReadAllGlobalEvents(reader, globalEvtReader, c_ptrTo(totalEventsRead));
+    // The global reader interleaves the locations, so they are all done now
+    closeAtWindowEnd(locs, ctx);
+    if ctx.evtArgs.stream then finishStreams(locs, ctx);
+
+    OTF2_Reader_CloseGlobalEvtReader(reader, globalEvtReader);
+    OTF2_Reader_CloseEvtFiles(reader);
+    OTF2_Reader_Close(reader);
+    return totalEventsRead;
+  }
+
+  // Callbacks for the local event readers, delete with
+  // OTF2_EvtReaderCallbacks_Delete
+  proc newLocalEvtCallbacks(): c_ptr(OTF2_EvtReaderCallbacks) {
+    var evtCallbacks = OTF2_EvtReaderCallbacks_New();
+    OTF2_EvtReaderCallbacks_SetEnterCallback(evtCallbacks, c_ptrTo(Enter_local_callback): c_fn_ptr);
+    OTF2_EvtReaderCallbacks_SetLeaveCallback(evtCallbacks, c_ptrTo(Leave_local_callback): c_fn_ptr);
+    OTF2_EvtReaderCallbacks_SetMetricCallback(evtCallbacks, c_ptrTo(Metric_local_callback): c_fn_ptr);
+    return evtCallbacks;
+  }
+
+  // Decode the events of the given locations, each with its own local event
+  // reader on an already opened reader whose event files are open.
+  // Returns the number of events read.
+  proc readLocalEvents(reader: c_ptr(OTF2_Reader), const ref locs,
+                       ref ctx: EvtCallbackContext): c_uint64 {
+    var evtCallbacks = newLocalEvtCallbacks();
+    var totalEventsRead: c_uint64 = 0;
+    for loc in locs {
+      var evtReader = OTF2_Reader_GetEvtReader(reader, loc);
+      if evtReader == nil {
+        logWarn("No event reader for location ", loc);
+        continue;
+      }
+      OTF2_Reader_RegisterEvtCallbacks(reader, evtReader, evtCallbacks, c_ptrTo(ctx): c_ptr(void));
+      var eventsRead: c_uint64 = 0;
+      OTF2_Reader_ReadAllLocalEvents(reader, evtReader, c_ptrTo(eventsRead));
+      totalEventsRead += eventsRead;
+      // Also closes the location's event file
+      OTF2_Reader_CloseEvtReader(reader, evtReader);
+      // The location is done, close its intervals and its streamed file
+      closeAtWindowEnd(loc, ctx);
+      if ctx.evtArgs.stream then finishStream(loc, ctx);
+    }
+    OTF2_EvtReaderCallbacks_Delete(evtCallbacks);
+    return totalEventsRead;
+  }
+
+  // readEventsForLocations with one local event reader per location
+  proc readLocalEventsForLocations(const ref locs, ref ctx: EvtCallbackContext): c_uint64 {
+    var reader = OTF2_Reader_Open(ctx.evtArgs.trace.c_str());
+    if reader == nil {
+      logError("Failed to open trace file for ", locs.size, " location(s)");
+      return 0;
+    }
+    OTF2_Reader_SetSerialCollectiveCallbacks(reader);
+
+    for loc in locs {
+      OTF2_Reader_SelectLocation(reader, loc);
+    }
+
+    OTF2_Reader_OpenEvtFiles(reader);
+    const totalEventsRead = readLocalEvents(reader, locs, ctx);
+
+    OTF2_Reader_CloseEvtFiles(reader);
+    OTF2_Reader_Close(reader);
+    return totalEventsRead;
+  }
+
+  // Open a reader on the trace that several tasks can use at once, see
+  // readEventsWithTasks. Returns nil if the trace cannot be opened or OTF2
+  // does not take the locking callbacks; callers then open one reader per
+  // task instead of sharing an unlocked one.
+  proc openSharedReader(trace: string): c_ptr(OTF2_Reader) {
+    var reader = OTF2_Reader_Open(trace.c_str());
+    if reader == nil then return nil;
+    // OTF2 guards its shared state with these; must come before any file is opened
+    const status = otf2ChplSyncReaderSetLockingCallbacks(reader);
+    if status != OTF2_SUCCESS {
+      logError("Failed to set locking callbacks on the shared reader on locale ", here.id,
+               ", error code ", status);
+      OTF2_Reader_Close(reader);
+      return nil;
+    }
+    OTF2_Reader_SetSerialCollectiveCallbacks(reader);
+    return reader;
+  }
+
+  // Read the given locations with one task per context, handing out
+  // locations by event count: one fixed LPT bin per task ("static") or
+  // batches from a shared work queue ("dynamic").
+  //
+  // Every task (or batch) opens its own reader on the trace unless a
+  // sharedReader from openSharedReader is given. Then the archive is opened
+  // and its event files are selected once, and all tasks create their local
+  // event readers on it; the caller still owns and closes the reader.
+  // When profiling, every task reports its time and counters to the
+  // profiler. Returns the number of events read.
+  proc readEventsWithTasks(const ref locationArray: [] OTF2_LocationRef,
+                           const ref locationWeights: [] uint(64),
+                           ref evtContexts: [] EvtCallbackContext,
+                           schedule: string,
+                           sharedReader: c_ptr(OTF2_Reader) = nil): c_uint64 {
+    const numberOfReaders = evtContexts.size;
+    var totalEventsReadAcrossReaders: c_uint64 = 0;
+
+    if sharedReader != nil {
+      for loc in locationArray do OTF2_Reader_SelectLocation(sharedReader, loc);
+      OTF2_Reader_OpenEvtFiles(sharedReader);
+    }
+    proc readBatch(const ref locs, ref ctx: EvtCallbackContext): c_uint64 {
+      return if sharedReader != nil then readLocalEvents(sharedReader, locs, ctx)
+                                    else readEventsForLocations(locs, ctx);
+    }
+    const profiling = profiler.enabled;
+    proc profileTask(i: int, seconds: real, locations: int, events: c_uint64,
+                     const ref ctx: EvtCallbackContext, bytesRead: uint(64)) {
+      profiler.addTask(new taskProfile(localeId=here.id, task=i, seconds=seconds,
+                                       locations=locations, events=events,
+                                       callbacks=ctx.callbacks, bytesRead=bytesRead));
+    }
+
+    if schedule == "static" {
+      // Each task gets one fixed bin of locations, balanced by event count
+      const parts = lptPartition(locationArray, locationWeights, numberOfReaders);
+      coforall i in 0..<numberOfReaders with (+ reduce totalEventsReadAcrossReaders, ref evtContexts) {
+        var sw: stopwatch;
+        sw.start();
+        const eventsRead = readBatch(parts[i], evtContexts[i]);
+        totalEventsReadAcrossReaders += eventsRead;
+        if profiling then
+          profileTask(i, sw.elapsed(), parts[i].size, eventsRead, evtContexts[i],
+                      + reduce (for l in parts[i] do eventFileBytes(evtContexts[i].evtArgs.trace, l)));
+      }
+    } else {
+      // Tasks pull batches of locations, heaviest first, until none are left
+      const workQueue = new LocationWorkQueue(locationArray, locationWeights, numberOfReaders);
+      logTrace("Total weight of all locations: ", workQueue.totalWeight());
+      coforall i in 0..<numberOfReaders with (+ reduce totalEventsReadAcrossReaders, ref evtContexts) {
+        var sw: stopwatch;
+        sw.start();
+        var eventsRead: c_uint64 = 0;
+        var locationsRead = 0;
+        var bytesRead: uint(64) = 0;
+        for batch in workQueue.batches() {
+          const locs = workQueue.locationsIn(batch);
+          logTrace("Task ", i, " claimed ", locs.size, " location(s)");
+          eventsRead += readBatch(locs, evtContexts[i]);
+          locationsRead += locs.size;
+          if profiling then
+            for l in locs do bytesRead += eventFileBytes(evtContexts[i].evtArgs.trace, l);
+        }
+        totalEventsReadAcrossReaders += eventsRead;
+        if profiling then
+          profileTask(i, sw.elapsed(), locationsRead, eventsRead, evtContexts[i], bytesRead);
+      }
+    }
+    if sharedReader != nil then OTF2_Reader_CloseEvtFiles(sharedReader);
+    return totalEventsReadAcrossReaders;
+  }
+
+  proc callgraphToCSV(callGraph: borrowed CallGraph, const ref defCtx: DefinitionStore,
+                      group: string, thread: string, path: string) {
+    // Convert a CallGraph to a CSV file
+    try {
+      var outfile = open(path, ioMode.cw);
+      var writer = outfile.writer(locking=false);
+
+      writer.writeln("Thread,Group,Depth,Name,Start Time,End Time,Duration");
+
+      var enc = new csvRowEncoder();
+      const prefix = thread + "," + group + ",";
+      // Intervals come out in (start, end, depth) order, see Timeline
+      for iv in callGraph.intervalsInOrder() {
+        const start = iv.start;
+        const end = if iv.hasEnd then iv.end else inf;
+        const duration = end - start;
+
+        enc.appendString(prefix);
+        enc.appendInt(iv.depth);
+        enc.comma();
+        enc.appendQuoted(defCtx.regionName(iv.region));
+        enc.comma();
+        enc.appendReal(start);
+        enc.comma();
+        enc.appendReal(end);
+        enc.comma();
+        enc.appendReal(duration);
+        enc.endRow(writer);
+      }
+      enc.flush(writer);
+
+      writer.close();
+      outfile.close();
+    } catch e {
+      logError("Error writing callgraph to CSV: ", e);
+    }
+  }
+
+  proc metricsToCSV(group: string, const ref metrics: [] metricSeriesSet,
+                    const ref members: list(int), const ref defCtx: DefinitionStore,
+                    path: string) {
+    // Convert metrics to a CSV file
+    // Note: In the Python version, metrics are stored as List[Tuple[float, float]] (time, value)
+    try {
+      var outfile = open(path, ioMode.cw);
+      var writer = outfile.writer(locking=false);
+
+      writer.writeln("Group,Metric Name,Time,Value");
+
+      var enc = new csvRowEncoder();
+      // One row per run, i.e. per change of value
+      for i in members do for series in metrics[i] {
+        const prefix = group + "," + defCtx.metricMember(series.member).name + ",";
+        for (start, bits, _) in series.runs() {
+          enc.appendString(prefix);
+          enc.appendReal(timestampToSeconds(start, defCtx.clockProps));
+          enc.comma();
+          if series.valueType == OTF2_TYPE_INT64 then
+            enc.appendInt(bits: int(64));
+          else if series.valueType == OTF2_TYPE_UINT64 then
+            enc.appendUint(bits);
+          else
+            enc.appendReal(bits.transmute(real));
+          enc.endRow(writer);
+        }
+      }
+      enc.flush(writer);
+
+      writer.close();
+      outfile.close();
+    } catch e {
+      logError("Error writing metrics to CSV: ", e);
+    }
+  }
+
+  proc callgraphToParquet(callGraph: borrowed CallGraph, const ref defCtx: DefinitionStore,
+                          group: string, thread: string, path: string) {
+    // Same table as callgraphToCSV, with dictionary-encoded string columns
+    try {
+      var pq = new ParquetFileWriter(path);
+      const threadCol = pq.addColumn("Thread", columnKind.STRING);
+      const groupCol = pq.addColumn("Group", columnKind.STRING);
+      const depthCol = pq.addColumn("Depth", columnKind.INT32);
+      const nameCol = pq.addColumn("Name", columnKind.STRING);
+      const startCol = pq.addColumn("Start Time", columnKind.DOUBLE);
+      const endCol = pq.addColumn("End Time", columnKind.DOUBLE);
+      const durationCol = pq.addColumn("Duration", columnKind.DOUBLE);
+
+      for iv in callGraph.intervalsInOrder() {
+        const end = if iv.hasEnd then iv.end else inf;
+        pq.addString(threadCol, thread);
+        pq.addString(groupCol, group);
+        pq.addInt32(depthCol, iv.depth);
+        pq.addString(nameCol, defCtx.regionName(iv.region));
+        pq.addReal(startCol, iv.start);
+        pq.addReal(endCol, end);
+        pq.addReal(durationCol, end - iv.start);
+        pq.endRow();
+      }
+
+      pq.close();
+    } catch e {
+      logError("Error writing callgraph to Parquet: ", e);
+    }
+  }
+
+  proc metricsToParquet(group: string, const ref metrics: [] metricSeriesSet,
+                        const ref members: list(int), const ref defCtx: DefinitionStore,
+                        path: string) {
+    // Values are stored as doubles: a file mixes metrics of different
+    // types, and pandas reads the CSV Value column as float64 anyway
+    try {
+      var pq = new ParquetFileWriter(path);
+      const groupCol = pq.addColumn("Group", columnKind.STRING);
+      const nameCol = pq.addColumn("Metric Name", columnKind.STRING);
+      const timeCol = pq.addColumn("Time", columnKind.DOUBLE);
+      const valueCol = pq.addColumn("Value", columnKind.DOUBLE);
+
+      for i in members do for series in metrics[i] {
+        const ref metricName = defCtx.metricMember(series.member).name;
+        for (start, bits, _) in series.runs() {
+          pq.addString(groupCol, group);
+          pq.addString(nameCol, metricName);
+          pq.addReal(timeCol, timestampToSeconds(start, defCtx.clockProps));
+          pq.addReal(valueCol, series.realValue(bits));
+          pq.endRow();
+        }
+      }
+
+      pq.close();
+    } catch e {
+      logError("Error writing metrics to Parquet: ", e);
+    }
+  }
+
+  proc isTrackedGroup(const ref evtArgs: EvtCallbackArgs, group: string): bool {
+    return evtArgs.processesToTrack.isEmpty() || evtArgs.processesToTrack.contains(group);
+  }
+
+  proc writeCallGraphsAndMetricsToCSV(const ref results: MergedResults,
+                                      const ref defCtx: DefinitionStore,
+                                      const ref evtArgs: EvtCallbackArgs) {
+    const n = results.numLocations;
+    const format = evtArgs.format;
+    const outputDir = evtArgs.outputDir;
+
+    // Group the locations with events by process. Output files are named by
+    // group and thread, so of several locations sharing a name only the
+    // first one gets a call graph file.
+    var groupIds: map(string, int);
+    var groupNames: list(string);
+    var groupOf: [0..<n] int = -1;
+    var writesCallGraph: [0..<n] bool;
+    var skippedGroups: domain(string);
+    var callGraphFiles: domain(string);
+    for i in 0..<n {
+      if results.callGraphs[i] == nil then continue;
+      const ref loc = defCtx.locations[i];
+      const ref group = loc.processName;
+      if !isTrackedGroup(evtArgs, group) {
+        if !skippedGroups.contains(group) {
+          logInfo("Skipping group ", group, " as it is not in the processes to track.");
+          skippedGroups += group;
+        }
+        continue;
+      }
+      if !groupIds.contains(group) {
+        groupIds.add(group, groupNames.size);
+        groupNames.pushBack(group);
+      }
+      groupOf[i] = try! groupIds[group];
+
+      const filename = callgraphFilename(group, loc.name, format);
+      if callGraphFiles.contains(filename) {
+        // Streamed runs warned when the files were reserved
+        if !evtArgs.stream then
+          logWarn("Duplicate thread ", loc.name, " in group ", group, ", only the first is written.");
+        continue;
+      }
+      callGraphFiles += filename;
+      writesCallGraph[i] = true;
+    }
+    var groupMembers: [0..<groupNames.size] list(int);
+    for i in 0..<n do
+      if groupOf[i] >= 0 then groupMembers[groupOf[i]].pushBack(i);
+
+    // Write call graphs, one file per task at a time. Streamed call graphs
+    // are already written by the reader tasks.
+    if !evtArgs.stream {
+      forall i in dynamic(0..<n, chunkSize=1) {
+        if writesCallGraph[i] {
+          const ref loc = defCtx.locations[i];
+          const filename = callgraphFilename(loc.processName, loc.name, format);
+          const path = joinPath(outputDir, filename);
+          logInfo("Writing to file: ", filename);
+          const callGraph = results.callGraphs[i]!;
+          if format == "parquet" then
+            callgraphToParquet(callGraph, defCtx, loc.processName, loc.name, path);
+          else
+            callgraphToCSV(callGraph, defCtx, loc.processName, loc.name, path);
+        }
+      }
+    }
+
+    // Write metrics to one file per group
+    forall g in dynamic(0..<groupNames.size, chunkSize=1) {
+      const group = groupNames[g];
+      const filename = group + "_metrics." + format;
+      const path = joinPath(outputDir, filename);
+      logInfo("Writing to file: ", filename);
+      if format == "parquet" then
+        metricsToParquet(group, results.metrics, groupMembers[g], defCtx, path);
+      else
+        metricsToCSV(group, results.metrics, groupMembers[g], defCtx, path);
+    }
+  }
+
+  proc printCallGraphAndMetrics(const ref results: MergedResults,
+                                const ref defCtx: DefinitionStore,
+                                verbose: bool = false) {
+    // Output call graphs and metrics summary to console
+    logDebug("\n--- Call Graphs ---");
+    for i in 0..<results.numLocations {
+      if results.callGraphs[i] == nil then continue;
+      const ref loc = defCtx.locations[i];
+      logDebug("Location Group: ", loc.processName, ", Thread: ", loc.name);
+    }
+
+    logDebug("\n--- Metrics Summary ---");
+    var totalMetricsStored: int = 0;
+    var totalMetricBytes: int = 0;
+    for i in 0..<results.numLocations {
+      for series in results.metrics[i] {
+        logDebug("  Metric: ", defCtx.metricMember(series.member).name, " on ", defCtx.locations[i].name,
+                 ", Samples: ", series.numSamples, ", Runs: ", series.numRuns);
+        totalMetricsStored += series.numSamples;
+        totalMetricBytes += series.storageBytes();
+      }
+    }
+    logDebug("Total metrics stored: ", totalMetricsStored, " in ", totalMetricBytes, " bytes");
+  }
+}
@@ -6,303 +6,55 @@ module TraceToCSV {
   use List;
   use Map;
   use CallGraphModule;
+  use CSVEncoderModule;
+  use MetricSeriesModule;
+  use EventFilterModule;
+  use DefinitionStore;
+  use TimeWindow;
+  use PhaseProfiler;
   use IO;
   import Math.inf;
 
-  // This record should be in a Chapel OTF2 module since it is common for all readers
-  // but for simplicity, we keep it here for now.
-  record ClockProperties {
-    // See https://perftools.pages.jsc.fz-juelich.de/cicd/otf2/tags/latest/html/group__records__definition.html#ClockProperties
-    var timerResolution: uint(64);
-    var globalOffset: uint(64);
-    var traceLength: uint(64);
-    var realtimeTimestamp: uint(64);
-  }
-
-  proc registerClockProperties(userData: c_ptr(void),
-                              timerResolution: uint(64),
-                              globalOffset: uint(64),
-                              traceLength: uint(64),
-                              realtimeTimestamp: uint(64)): OTF2_CallbackCode {
-    var defContextPtr = userData: c_ptr(DefCallbackContext);
-    if defContextPtr == nil then return OTF2_CALLBACK_ERROR;
-    ref defContext = defContextPtr.deref();
-    ref clockProps = defContext.clockProps;
-    clockProps.timerResolution = timerResolution;
-    clockProps.globalOffset = globalOffset;
-    clockProps.traceLength = traceLength;
-    clockProps.realtimeTimestamp = realtimeTimestamp;
-    writeln("Trace Clock Properties:");
-    writeln(" Timer Resolution. : ", clockProps.timerResolution);
-    writeln(" Global Offset     : ", clockProps.globalOffset);
-    writeln(" Trace Length      : ", clockProps.traceLength);
-    writeln(" Realtime Timestamp: ", clockProps.realtimeTimestamp);
-    return OTF2_CALLBACK_SUCCESS;
-  }
-
-  // These records should be classes and moved into a proper Chapel OTF2 module
-  // but for simplicity, we keep them here for now.
-  // They are also not feature complete but sufficient for the current needs.
-  record LocationGroup {
-    var name: string;
-    var creatingLocationGroup: string;
-  }
-  record Location {
-    var name: string;
-    var group: OTF2_LocationGroupRef;
-  }
-
-  record MetricMember {
-    var name: string;
-    var unit: string;
-  }
-
-  // Metric class and instance should inherit from a common Metric base class
-  record MetricClass {
-    var numberOfMetrics: c_uint8;
-    var firstMemberID: OTF2_MetricMemberRef;  // Store just the first member ID directly
-  }
-
-  record MetricInstance {
-    var metricClass: OTF2_MetricRef;
-    var recorder: OTF2_LocationRef;
-  }
-
-  record MetricDefContext {
-    var metricClassIds: domain(OTF2_MetricRef);
-    var metricClassTable: [metricClassIds] MetricClass;
-    var metricInstanceIds: domain(OTF2_MetricRef);
-    var metricInstanceTable: [metricInstanceIds] MetricInstance;
-    var metricMemberIds: domain(OTF2_MetricMemberRef);
-    var metricMemberTable: [metricMemberIds] MetricMember;
-    var metricClassRecorderIds: domain(OTF2_MetricRef);
-    var metricClassRecorderTable: [metricClassRecorderIds] OTF2_LocationRef;
-  }
-
-  record DefCallbackContext {
-    var locationGroupIds: domain(OTF2_LocationGroupRef);
-    var locationGroupTable: [locationGroupIds] LocationGroup;
-    var locationIds: domain(OTF2_LocationRef);
-    var locationTable: [locationIds] Location;
-    var regionIds: domain(OTF2_RegionRef);
-    var regionTable: [regionIds] string;
-    var stringIds: domain(OTF2_StringRef);
-    var stringTable: [stringIds] string;
-    var clockProps: ClockProperties;
-    var metricDefContext: MetricDefContext;
-  }
-
-  // --- Definition callbacks ---
-  proc GlobDefString_Register(userData: c_ptr(void),
-                              strRef: OTF2_StringRef,
-                              strName: c_ptrConst(c_uchar)):
-                              OTF2_CallbackCode {
-    var ctxPtr = userData: c_ptr(DefCallbackContext);
-    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
-    ref ctx = ctxPtr.deref();
-    // Add string to the lookup table
-    ctx.stringIds += strRef;
-    if strName != nil {
-      try! ctx.stringTable[strRef] = string.createCopyingBuffer(strName);
-    } else {
-      ctx.stringTable[strRef] = "UnknownString";
-    }
-    // writeln("Registered string: ", ctx.stringTable[str]);
-    return OTF2_CALLBACK_SUCCESS;
-  }
-
-  proc GlobDefLocationGroup_Register(userData: c_ptr(void),
-                                     self : OTF2_LocationGroupRef,
-                                     name : OTF2_StringRef,
-                                     locationGroupType : OTF2_LocationGroupType,
-                                     systemTreeParent : OTF2_SystemTreeNodeRef,
-                                     creatingLocationGroup : OTF2_LocationGroupRef): OTF2_CallbackCode {
-    // Get the reference to the context record
-    var ctxPtr = userData: c_ptr(DefCallbackContext);
-    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
-    ref ctx = ctxPtr.deref();
-    // Lookup name in string table
-    const groupName = if ctx.stringIds.contains(name) && ctx.stringTable[name] != "" then ctx.stringTable[name] else "UnknownGroup";
-    // Check if this location has a creating group
-    // if creatingLocationGroup != 0 then
-    //   writeln("Location group ", groupName, " created by group ID ", creatingLocationGroup);
-    // else
-    //   writeln("Location group ", groupName, " has no creating group");
-    const creatingGroupName = if ctx.locationGroupIds.contains(creatingLocationGroup) then ctx.locationGroupTable[creatingLocationGroup].name else "None";
-    // Add location group to the lookup table
-    ctx.locationGroupIds += self;
-    ctx.locationGroupTable[self] = new LocationGroup(name=groupName, creatingLocationGroup=creatingGroupName);
-    // writeln("Registered location group: ", ctx.locationGroupTable[self]);
-    return OTF2_CALLBACK_SUCCESS;
-  }
-
-  proc GlobDefLocation_Register(userData: c_ptr(void),
-                                location: OTF2_LocationRef,
-                                name: OTF2_StringRef,
-                                locationType: OTF2_LocationType,
-                                numberOfEvents: c_uint64,
-                                locationGroup: OTF2_LocationGroupRef):
-                                OTF2_CallbackCode {
-    // Get the reference to the context record
-    var ctxPtr = userData: c_ptr(DefCallbackContext);
-    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
-    ref ctx = ctxPtr.deref();
-    // Lookup name in string table
-    const locName = if ctx.stringIds.contains(name) && ctx.stringTable[name] != "" then ctx.stringTable[name] else "UnknownLocation";
-    ctx.locationIds += location;
-    var loc = new Location(name=locName, group=locationGroup);
-    ctx.locationTable[location] = loc;
-    writeln("Registered location ID=", location, ": ", ctx.locationTable[location], " in group ID ", locationGroup, " (", if ctx.locationGroupIds.contains(locationGroup) then ctx.locationGroupTable[locationGroup].name else "UnknownGroup", ")");
-    return OTF2_CALLBACK_SUCCESS;
-  }
-
-  proc GlobDefRegion_Register(userData: c_ptr(void),
-                              region: OTF2_RegionRef,
-                              name: OTF2_StringRef,
-                              canonicalName: OTF2_StringRef,
-                              description: OTF2_StringRef,
-                              regionRole: OTF2_RegionRole,
-                              paradigm: OTF2_Paradigm,
-                              regionFlags: OTF2_RegionFlag,
-                              sourceFile: OTF2_StringRef,
-                              beginLineNumber: c_uint32,
-                              endLineNumber: c_uint32):
-                              OTF2_CallbackCode {
-    // Get the reference to the context record
-    var ctxPtr = userData: c_ptr(DefCallbackContext);
-    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
-    ref ctx = ctxPtr.deref();
-    // Lookup name in string table
-    const regionName = if ctx.stringIds.contains(name) && ctx.stringTable[name] != "" then ctx.stringTable[name] else "UnknownRegion";
-    // Add region to the lookup table
-    ctx.regionIds += region;
-    ctx.regionTable[region] = regionName;
-    // writeln("Registered region: ", regionName);
-    return OTF2_CALLBACK_SUCCESS;
-  }
-
-  proc GlobDefMetricMember_Register(userData: c_ptr(void),
-                                    self: OTF2_MetricMemberRef,
-                                    name: OTF2_StringRef,
-                                    description: OTF2_StringRef,
-                                    metricType: OTF2_MetricType,
-                                    mode: OTF2_MetricMode,
-                                    valueType: OTF2_Type,
-                                    base: OTF2_Base,
-                                    exponent: c_int64,
-                                    unit: OTF2_StringRef): OTF2_CallbackCode {
-    var ctxPtr = userData: c_ptr(DefCallbackContext);
-    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
-    ref ctx = ctxPtr.deref();
-    ref mctx = ctx.metricDefContext;
-    mctx.metricMemberIds += self;
-    const memberName = if ctx.stringIds.contains(name) && ctx.stringTable[name] != "" then ctx.stringTable[name] else "UnknownMetricMember";
-    const unitName = if ctx.stringIds.contains(unit) && ctx.stringTable[unit] != "" then ctx.stringTable[unit] else "UnknownUnit";
-    mctx.metricMemberTable[self] = new MetricMember(name=memberName, unit=unitName);
-    // writeln("Registered metric member: ", mctx.metricMemberTable[self]);
-    return OTF2_CALLBACK_SUCCESS;
-  }
-
-  proc GlobDefMetricClass_Register(userData: c_ptr(void),
-                                   self: OTF2_MetricRef,
-                                   numberOfMetrics: c_uint8,
-                                   metricMembers: c_ptrConst(OTF2_MetricMemberRef),
-                                   metricOccurrence: OTF2_MetricOccurrence,
-                                   recorderKind: OTF2_RecorderKind): OTF2_CallbackCode {
-    var ctxPtr = userData: c_ptr(DefCallbackContext);
-    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
-    ref ctx = ctxPtr.deref();
-    ref mctx = ctx.metricDefContext;
-    mctx.metricClassIds += self;
-    const firstMember = if numberOfMetrics > 0 then metricMembers[0] else 0;
-    mctx.metricClassTable[self] = new MetricClass(numberOfMetrics=numberOfMetrics, firstMemberID=firstMember);
-    return OTF2_CALLBACK_SUCCESS;
-  }
-
-  proc GlobDefMetricInstance_Register(userData: c_ptr(void),
-                                      self: OTF2_MetricRef,
-                                      metricClass: OTF2_MetricRef,
-                                      recorder: OTF2_LocationRef,
-                                      metricScope: OTF2_MetricScope,
-                                      scope: c_uint64): OTF2_CallbackCode {
-    var ctxPtr = userData: c_ptr(DefCallbackContext);
-    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
-    ref ctx = ctxPtr.deref();
-    ref mctx = ctx.metricDefContext;
-    mctx.metricInstanceIds += self;
-    mctx.metricInstanceTable[self] = new MetricInstance(metricClass=metricClass, recorder=recorder);
-    // writeln("Registered metric instance ID=", self, " with class=", metricClass, " recorder=", recorder);
-    return OTF2_CALLBACK_SUCCESS;
-  }
-
-  proc GlobDefMetricClassRecorder_Register(userData: c_ptr(void),
-                                           metric: OTF2_MetricRef,
-                                           recorder: OTF2_LocationRef): OTF2_CallbackCode {
-    var ctxPtr = userData: c_ptr(DefCallbackContext);
-    if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
-    ref ctx = ctxPtr.deref();
-    ref mctx = ctx.metricDefContext;
-    mctx.metricClassRecorderIds += metric;
-    mctx.metricClassRecorderTable[metric] = recorder;
-    // writeln("Registered metric class recorder: metric=", metric, " recorder=", recorder);
-    return OTF2_CALLBACK_SUCCESS;
-  }
-
   record EvtCallbackArgs {
     const processesToTrack: domain(string);
     const metricsToTrack: domain(string);
     const crayTimeOffset: real(64);
+    // Time window to extract, in seconds as returned by timestampToSeconds
+    const start: real = -inf;
+    const end: real = inf;
   }
 
   record EvtCallbackContext {
     const evtArgs: EvtCallbackArgs;
-    var defContext: DefCallbackContext;
+    var defContext: DefinitionStore;
+    // Process filter and MPI/HIP region exclusion, resolved once
+    const filter: EventFilter;
+    // evtArgs.start and evtArgs.end in ticks of the trace clock
+    const window: timeWindow;
     var seenGroups: map(string, domain(string));
     // Call Graphs are per location group and per location (thread)
     var callGraphs: map(string, map(string, shared CallGraph));
-    // Metrics recorded per location group and per location (thread)
-    var metrics: map(string, map(string, list((real(64), OTF2_Type, OTF2_MetricValue))));
+    // Metrics recorded per location group, by metric member
+    var metrics: map(string, metricSeriesSet);
+    // Metric members carried by the events of each metric ref
+    var tracking: metricTracking;
+    // Every event the callbacks see, for --profile
+    var callbacks: eventCounts;
 
     proc init(evtArgs: EvtCallbackArgs,
-              defContext: DefCallbackContext) {
+              defContext: DefinitionStore) {
       this.evtArgs = evtArgs;
       this.defContext = defContext;
+      // No region regexes are given, so this cannot throw
+      this.filter = try! compileEventFilter(defContext, evtArgs.processesToTrack,
+                                            excludeMPI=true, excludeHIP=true);
+      this.window = new timeWindow(evtArgs.start, evtArgs.end, defContext.clockProps);
       this.seenGroups = new map(string, domain(string));
       this.callGraphs = new map(string, map(string, shared CallGraph));
-      this.metrics = new map(string, map(string, list((real(64), OTF2_Type, OTF2_MetricValue))));
-    }
-  }
-
-  proc timestampToSeconds(ts: OTF2_TimeStamp, clockProps: ClockProperties): real(64) {
-    if clockProps.timerResolution == 0 then
-      return 0.0;
-    // We use this start_time to normalize timestamps to start from zero
-    // We don't use a ProgramBegin event because each MPI rank will have it's own
-    // and we want a global start time
-    const start_time = clockProps.globalOffset;
-    if ts < start_time {
-      return -1.0 * ((start_time - ts):real(64) / clockProps.timerResolution);
-    }
-    return (ts - start_time):real(64) / clockProps.timerResolution;
-  }
-
-  proc getLocationAndRegionInfo(defCtx: DefCallbackContext,
-                       location: OTF2_LocationRef,
-                       region: OTF2_RegionRef) : (string, string, string) {
-    const locName = if defCtx.locationIds.contains(location) then defCtx.locationTable[location].name else "UnknownLocation";
-    var locGroup = "UnknownLocationGroup";
-    if defCtx.locationIds.contains(location) {
-      const lgid = defCtx.locationTable[location].group;
-      if defCtx.locationGroupIds.contains(lgid) {
-        const locationGroup = defCtx.locationGroupTable[lgid];
-        // Use creating_location_group if it exists (matching Python behavior)
-        locGroup = if locationGroup.creatingLocationGroup != "None" && locationGroup.creatingLocationGroup != "" 
-                   then locationGroup.creatingLocationGroup
-                   else locationGroup.name;
-      }
+      this.metrics = new map(string, metricSeriesSet);
+      this.tracking = resolveMetricTracking(defContext, evtArgs.metricsToTrack,
+                                            trackAllIfEmpty=false);
     }
-    const regionName = if defCtx.regionIds.contains(region) then defCtx.regionTable[region] else "UnknownRegion";
-    return (locName, locGroup, regionName);
   }
 
   proc updateMaps(ref ctx: EvtCallbackContext, locGroup: string, location: string) {
@@ -338,33 +90,11 @@ module TraceToCSV {
     // Update metrics
     ref metrics = ctx.metrics;
     if !metrics.contains(locGroup) {
-      metrics[locGroup] = new map(string, list((real(64), OTF2_Type, OTF2_MetricValue)));
-      for metric in ctx.evtArgs.metricsToTrack {
-        metrics[locGroup][metric] = new list((real(64), OTF2_Type, OTF2_MetricValue));
-        writeln("New metric list for metric: ", metric, " in group ", locGroup);
-      }
+      metrics.add(locGroup, new metricSeriesSet());
+      writeln("New metric series for group ", locGroup);
     }
   }
 
-  proc checkEnterLeaveSkipConditions(const ref ctx: EvtCallbackContext,
-                                     locGroup: string,
-                                     regionName: string): bool {
-    // Check if we are tracking this process
-    // I don't know how to get "all processes" in Chapel so we don't do this check for now
-    // if !ctx.evtArgs.processesToTrack.contains(locGroup) then
-    //   return true; // Skip this event
-
-    // Check for other skip conditions
-    const regionNameLower = regionName.toLower();
-    if regionNameLower.size >= 3 {
-      const prefix = regionNameLower[0..2];
-      if prefix == "mpi" || prefix == "hip" {
-        return true; // Skip this event
-      }
-    }
-    return false; // Do not skip
-  }
-
   // --- Event callbacks (now operate on EvtCallbackContext) ---
   proc Enter_callback(location: OTF2_LocationRef,
                       time: OTF2_TimeStamp,
@@ -377,19 +107,31 @@ module TraceToCSV {
     if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
     ref ctx = ctxPtr.deref();
     ref defCtx = ctx.defContext;
+    ctx.callbacks.enter += 1;
+
+    // Events come in time order, nothing after this one is in the window
+    if ctx.window.isAfter(time) then
+      return OTF2_CALLBACK_INTERRUPT;
+
+    if ctx.filter.skipsLocation(defCtx.locationIndex(location)) then
+      return OTF2_CALLBACK_SUCCESS;
 
-    const (locName, locGroup, regionName) = getLocationAndRegionInfo(defCtx, location, region);
+    const ref loc = defCtx.location(location);
+    const ref locName = loc.name;
+    const ref locGroup = loc.processName;
     updateMaps(ctx, locGroup, locName);
 
-    if checkEnterLeaveSkipConditions(ctx, locGroup, regionName) then
+    if ctx.filter.skipsRegion(region) then
       return OTF2_CALLBACK_SUCCESS;
 
-    // Get current time in seconds
-    const currentTime = timestampToSeconds(time, defCtx.clockProps);
+    // Get current time in seconds. Regions entered before the window are
+    // still pushed, clipped to its start, so the stack is right once it opens.
+    const currentTime = if ctx.window.isBefore(time) then ctx.window.start
+                        else timestampToSeconds(time, defCtx.clockProps);
 
     // Enter Callgraph
     ref callGraph = try! ctx.callGraphs[locGroup][locName];
-    callGraph.enter(currentTime, regionName);
+    callGraph.enter(currentTime, region);
 
     return OTF2_CALLBACK_SUCCESS;
   }
@@ -405,76 +147,38 @@ module TraceToCSV {
     if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
     ref ctx = ctxPtr.deref();
     ref defCtx = ctx.defContext;
+    ctx.callbacks.leave += 1;
+
+    if ctx.window.isAfter(time) then
+      return OTF2_CALLBACK_INTERRUPT;
+
+    if ctx.filter.skipsLocation(defCtx.locationIndex(location)) then
+      return OTF2_CALLBACK_SUCCESS;
 
-    const (locName, locGroup, regionName) = getLocationAndRegionInfo(defCtx, location, region);
+    const ref loc = defCtx.location(location);
+    const ref locName = loc.name;
+    const ref locGroup = loc.processName;
     updateMaps(ctx, locGroup, locName);
 
-    if checkEnterLeaveSkipConditions(ctx, locGroup, regionName) then
+    if ctx.filter.skipsRegion(region) then
       return OTF2_CALLBACK_SUCCESS;
 
+    ref callGraph = try! ctx.callGraphs[locGroup][locName];
+    // Intervals that end before or at the window start are dropped
+    if ctx.window.endsBefore(time) {
+      callGraph.discard();
+      return OTF2_CALLBACK_SUCCESS;
+    }
 
     // Get current time in seconds
     const currentTime = timestampToSeconds(time, defCtx.clockProps);
 
     // Leave Callgraph
-    ref callGraph = try! ctx.callGraphs[locGroup][locName];
     callGraph.leave(currentTime); // We ignore regionName here
 
     return OTF2_CALLBACK_SUCCESS;
   }
 
-  proc getMetricInfo(defCtx: DefCallbackContext,
-                     location: OTF2_LocationRef,
-                     metric: OTF2_MetricRef): (string, string, string) {
-    var metricName: string;
-    var metricUnit: string;
-    var metricRecorder: string;
-
-    ref metricCtx = defCtx.metricDefContext;
-    var metricClassRef: OTF2_MetricRef;
-    // This metric can be a metric class or a metric instance, check both
-    // If it is a metric instance, it will also have a recorder location
-    // Otherwise the recorder is the same as the location of the event
-    if metricCtx.metricInstanceIds.contains(metric) {
-      const mInstance = metricCtx.metricInstanceTable[metric];
-      metricRecorder = if defCtx.locationIds.contains(mInstance.recorder) then defCtx.locationTable[mInstance.recorder].name else "UnknownLocation";
-      metricClassRef = mInstance.metricClass;
-    } else {
-      metricClassRef = metric;
-      (metricRecorder, _, _) = getLocationAndRegionInfo(defCtx, location, 0);
-    }
-    if metricCtx.metricClassIds.contains(metricClassRef) {
-      const metricClass = metricCtx.metricClassTable[metricClassRef];
-      if metricClass.numberOfMetrics == 1 { // We only handle single metric members for now
-        const metricMemberRef = metricClass.firstMemberID;
-        if metricCtx.metricMemberIds.contains(metricMemberRef) {
-          const metricMember = metricCtx.metricMemberTable[metricMemberRef];
-          metricName = metricMember.name;
-          metricUnit = metricMember.unit;
-        } else {
-          metricName = "UnknownMetricMember";
-          metricUnit = "UnknownUnit";
-        }
-      } else {
-        writeln("WARNING: Metric class with ", metricClass.numberOfMetrics, " members - only processing first member");
-        // Instead of halting, just process the first member
-        const metricMemberRef = metricClass.firstMemberID;
-        if metricCtx.metricMemberIds.contains(metricMemberRef) {
-          const metricMember = metricCtx.metricMemberTable[metricMemberRef];
-          metricName = metricMember.name;
-          metricUnit = metricMember.unit;
-        } else {
-          metricName = "UnknownMetricMember";
-          metricUnit = "UnknownUnit";
-        }
-      }
-    } else {
-      metricName = "UnknownMetricClass";
-      metricUnit = "UnknownUnit";
-    }
-    return (metricName, metricUnit, metricRecorder);
-  }
-
   proc Metric_callback(location: OTF2_LocationRef,
                        time: OTF2_TimeStamp,
                        userData: c_ptr(void),
@@ -489,53 +193,39 @@ module TraceToCSV {
     if ctxPtr == nil then return OTF2_CALLBACK_ERROR;
     ref ctx = ctxPtr.deref();
     ref defCtx = ctx.defContext;
-    // Get metric info like name, unit, value, recorder location
-    const (locName, locGroup, _) = getLocationAndRegionInfo(defCtx, location, 0);
-    // We only handle single metric members for now
-    if numberOfMetrics != 1 then
-      halt("Metric event with multiple metrics not supported yet");
-
-    // Question: Should we check if this metric is one we want to track? Python version does not do that
-
-
-    const (metricName, metricUnit, metricRecorder) = getMetricInfo(defCtx, location, metric);
-
-    // If we are not tracking this metric, skip it
-    if !ctx.evtArgs.metricsToTrack.contains(metricName) {
+    ctx.callbacks.metric += 1;
+    if ctx.window.isAfter(time) then
+      return OTF2_CALLBACK_INTERRUPT;
+    if ctx.window.isBefore(time) then
       return OTF2_CALLBACK_SUCCESS;
-    }
-
-    const metricType = typeIDs[0];
-    const metricValue = metricValues[0];
+    // Skip refs whose metric class has no tracked member
+    const m = metric: int;
+    if m >= ctx.tracking.refDom.size || ctx.tracking.count[m] == 0 then
+      return OTF2_CALLBACK_SUCCESS;
+    const first = ctx.tracking.first[m];
+    // The event carries one value per member of the metric class
+    const n = min(numberOfMetrics: int, ctx.tracking.count[m]);
 
-    // Get the time for this metric in seconds
-    var currentTime = timestampToSeconds(time, defCtx.clockProps);
-    // Adjust for craypm metrics, as they are reported with a delay
-    if metricName.toLower().find("cray") >= 0 && ctx.evtArgs.crayTimeOffset != 0.0 {
-      currentTime -= ctx.evtArgs.crayTimeOffset;
-    }
+    const ref loc = defCtx.location(location);
+    const ref locName = loc.name;
+    const ref locGroup = loc.processName;
     // Update the seen groups, call graphs, and metrics maps
     updateMaps(ctx, locGroup, locName);
 
-    ref metrics = ctx.metrics;
-
-    // Store the metric value if this metric is one we want to track
-    // If either the value has changed or if this is the first value for this metric
-    // We append it to the list for this metric
-    try {
-      if metrics[locGroup][metricName].isEmpty() ||
-         metrics[locGroup][metricName].last[2] != metricValue {
-        metrics[locGroup][metricName].pushBack((currentTime, metricType, metricValue));
-        // writeln("Stored metric value: ", metricValue, " for metric ", metricName, " in location ", locName, " of group ", locGroup, " at time ", currentTime);
-      }
-    } catch e {
-      writeln("Error storing metric: ", e);
-      writeln("  locGroup: ", locGroup);
-      writeln("  metricName: ", metricName);
-      writeln("  metrics.contains(locGroup): ", metrics.contains(locGroup));
-      if metrics.contains(locGroup) {
-        try! writeln("  metrics[locGroup].contains(metricName): ", metrics[locGroup].contains(metricName));
+    // Consecutive equal values are folded into one run of each series.
+    // Times stay in ticks; the craypm offset is applied when writing.
+    ref groupMetrics = try! ctx.metrics[locGroup];
+    for k in 0..<n {
+      const member = ctx.tracking.members[first + k];
+      // Only numeric values of tracked members are written out
+      const valueType = typeIDs[k];
+      if member < 0 || !isNumericMetricType(valueType) then continue;
+      ref series = groupMetrics.seriesFor(member: OTF2_MetricMemberRef, valueType);
+      if series.valueType != valueType {
+        writeln("WARNING: Metric ", defCtx.metricMember(series.member).name, " changed value type, dropping sample");
+        continue;
       }
+      series.add(time, metricValueBits(valueType, metricValues[k]));
     }
 
     return OTF2_CALLBACK_SUCCESS;
@@ -548,14 +238,26 @@ module TraceToCSV {
   //   ./trace_to_csv --metricsToTrackArg="metric1,metric2,metric3"
   //   ./trace_to_csv --processesToTrackArg="process1,process2"
   //   ./trace_to_csv --tracePath=/path/to/traces.otf2 --crayTimeOffsetArg=1.5 --metricsToTrackArg="metric1,metric2"
+  //   ./trace_to_csv --start=10.0 --end=12.5
 
   config const tracePath: string = "/workspace/scorep-traces/frontier-hpl-run-using-2-ranks-with-craypm/traces.otf2";
   config const crayTimeOffsetArg: real(64) = 1.0;
   config const metricsToTrackArg: string = "A2rocm_smi:::energy_count:device=0,A2rocm_smi:::energy_count:device=2,A2rocm_smi:::energy_count:device=4,A2rocm_smi:::energy_count:device=6,A2coretemp:::craypm:accel0_energy,A2coretemp:::craypm:accel1_energy,A2coretemp:::craypm:accel2_energy,A2coretemp:::craypm:accel3_energy";
   config const processesToTrackArg: string = ""; // Empty string means track all processes
+  config const start: real = -inf; // Time window in seconds, unbounded by default
+  config const end: real = inf;
+  // Write phase timings and reader counters as JSON to this file
+  //   ./trace_to_csv --profile=profile.json
+  config const profile: string = "";
 
   proc main() {
+    if start > end {
+      writeln("Invalid time window: start ", start, " is after end ", end);
+      return;
+    }
 
+    profiler.enable("trace_to_csv", profile);
+    profiler.phase("open");
     var sw: stopwatch;
     sw.start();
 
@@ -569,6 +271,7 @@ module TraceToCSV {
     writef("Time taken to open OTF2 archive: %.2dr seconds\n", openTime);
     sw.clear(); // Restart stopwatch for next timing
 
+    profiler.phase("global definitions");
     OTF2_Reader_SetSerialCollectiveCallbacks(reader);
 
     var numberOfLocations: c_uint64 = 0;
@@ -576,36 +279,57 @@ module TraceToCSV {
     writeln("Number of locations: ", numberOfLocations);
 
 
-    var defCtx = new DefCallbackContext();
-    var globalDefReader = OTF2_Reader_GetGlobalDefReader(reader);
-    var defCallbacks = OTF2_GlobalDefReaderCallbacks_New();
-    OTF2_GlobalDefReaderCallbacks_SetClockPropertiesCallback(defCallbacks,
-                                                        c_ptrTo(registerClockProperties): c_fn_ptr);
-    OTF2_GlobalDefReaderCallbacks_SetStringCallback(defCallbacks, c_ptrTo(GlobDefString_Register): c_fn_ptr);
-    OTF2_GlobalDefReaderCallbacks_SetLocationGroupCallback(defCallbacks, c_ptrTo(GlobDefLocationGroup_Register): c_fn_ptr);
-    OTF2_GlobalDefReaderCallbacks_SetLocationCallback(defCallbacks, c_ptrTo(GlobDefLocation_Register): c_fn_ptr);
-    OTF2_GlobalDefReaderCallbacks_SetRegionCallback(defCallbacks, c_ptrTo(GlobDefRegion_Register): c_fn_ptr);
-    OTF2_GlobalDefReaderCallbacks_SetMetricMemberCallback(defCallbacks, c_ptrTo(GlobDefMetricMember_Register): c_fn_ptr);
-    OTF2_GlobalDefReaderCallbacks_SetMetricClassCallback(defCallbacks, c_ptrTo(GlobDefMetricClass_Register): c_fn_ptr);
-    OTF2_GlobalDefReaderCallbacks_SetMetricInstanceCallback(defCallbacks, c_ptrTo(GlobDefMetricInstance_Register): c_fn_ptr);
-    OTF2_GlobalDefReaderCallbacks_SetMetricClassRecorderCallback(defCallbacks, c_ptrTo(GlobDefMetricClassRecorder_Register): c_fn_ptr);
-
-    OTF2_Reader_RegisterGlobalDefCallbacks(reader,
-                                           globalDefReader,
-                                           defCallbacks,
-                                           c_ptrTo(defCtx): c_ptr(void));
-    OTF2_GlobalDefReaderCallbacks_Delete(defCallbacks);
-
-    var definitionsRead: c_uint64 = 0;
-    OTF2_Reader_ReadAllGlobalDefinitions(reader, globalDefReader, c_ptrTo(definitionsRead));
+    var defCtx = new DefinitionStore();
+    const definitionsRead = readGlobalDefinitions(reader, defCtx);
+    writeln("Trace Clock Properties:");
+    writeln(" Timer Resolution. : ", defCtx.clockProps.timerResolution);
+    writeln(" Global Offset     : ", defCtx.clockProps.globalOffset);
+    writeln(" Trace Length      : ", defCtx.clockProps.traceLength);
+    writeln(" Realtime Timestamp: ", defCtx.clockProps.realtimeTimestamp);
     writeln("Global definitions read: ", definitionsRead);
 
     const defReadTime = sw.elapsed();
     writef("Time taken to read global definitions: %.2dr seconds\n", defReadTime);
     sw.clear(); // Restart stopwatch for next timing
 
-    // Select all locations
-    for loc in defCtx.locationIds {
+    profiler.phase("local definitions");
+    // Parse metrics to track from config argument
+    var metricsToTrack: domain(string);
+    if metricsToTrackArg != "" {
+      var metricsArray = metricsToTrackArg.split(",");
+      for metric in metricsArray {
+        metricsToTrack += metric.strip();
+      }
+    }
+
+    // Parse processes to track from config argument
+    var processesToTrack: domain(string);
+    if processesToTrackArg != "" {
+      var processesArray = processesToTrackArg.split(",");
+      for process in processesArray {
+        processesToTrack += process.strip();
+      }
+    }
+
+    // Use the config const for crayTimeOffset
+    var crayPmOffset: real(64) = crayTimeOffsetArg;
+    var evtArgs = new EvtCallbackArgs(processesToTrack=processesToTrack,
+                                      metricsToTrack=metricsToTrack,
+                                      crayTimeOffset=crayPmOffset,
+                                      start=start,
+                                      end=end);
+
+    // Create event callaback context
+    var evtCtx = new EvtCallbackContext(evtArgs, defCtx);
+
+    // Select the locations of the tracked processes; the files of the
+    // others are never opened
+    var selectedLocations: list(OTF2_LocationRef);
+    for i in 0..<defCtx.numLocations do
+      if !evtCtx.filter.skipsLocation(i) then
+        selectedLocations.pushBack(defCtx.locations[i].id);
+    writeln("Selected ", selectedLocations.size, " of ", defCtx.numLocations, " locations");
+    for loc in selectedLocations {
       // writeln("Selecting location ", loc);
       OTF2_Reader_SelectLocation(reader, loc);
     }
@@ -616,7 +340,7 @@ module TraceToCSV {
 
     OTF2_Reader_OpenEvtFiles(reader);
 
-    for loc in defCtx.locationIds {
+    for loc in selectedLocations {
       if successfulOpenDefFiles {
         var defReader = OTF2_Reader_GetDefReader(reader, loc);
         if defReader != nil {
@@ -636,36 +360,8 @@ module TraceToCSV {
     sw.clear();
     if successfulOpenDefFiles then OTF2_Reader_CloseDefFiles(reader);
 
-    // Event reading setup with new event context
-
-    // Parse metrics to track from config argument
-    var metricsToTrack: domain(string);
-    if metricsToTrackArg != "" {
-      var metricsArray = metricsToTrackArg.split(",");
-      for metric in metricsArray {
-        metricsToTrack += metric.strip();
-      }
-    }
-
-    // Parse processes to track from config argument
-    var processesToTrack: domain(string);
-    if processesToTrackArg != "" {
-      var processesArray = processesToTrackArg.split(",");
-      for process in processesArray {
-        processesToTrack += process.strip();
-      }
-    }
-
-    // Use the config const for crayTimeOffset
-    var crayPmOffset: real(64) = crayTimeOffsetArg;
-    var evtArgs = new EvtCallbackArgs(processesToTrack=processesToTrack,
-                                      metricsToTrack=metricsToTrack,
-                                      crayTimeOffset=crayPmOffset);
-
-    // Create event callaback context
-    var evtCtx = new EvtCallbackContext(evtArgs, defCtx);
-
-
+    profiler.phase("read events");
+    // Event reading setup with the event context created above
     var globalEvtReader = OTF2_Reader_GetGlobalEvtReader(reader);
     var evtCallbacks = OTF2_GlobalEvtReaderCallbacks_New();
     OTF2_GlobalEvtReaderCallbacks_SetEnterCallback(evtCallbacks,
@@ -686,9 +382,24 @@ module TraceToCSV {
                                     globalEvtReader,
                                     c_ptrTo(totalEventsRead));
 
+    // Intervals still open at the end of the window end there
+    if evtCtx.window.hasEnd then
+      for threads in evtCtx.callGraphs.values() do
+        for callGraph in threads.values() do
+          while !callGraph.live.isEmpty() do callGraph.leave(evtCtx.window.end);
+
     const evtReadTime = sw.elapsed();
     writeln("Time taken to read events: ", evtReadTime, " seconds");
     sw.clear();
+    if profiler.enabled then
+      profiler.addTask(new taskProfile(localeId=here.id, task=0, seconds=evtReadTime,
+                                       locations=selectedLocations.size,
+                                       events=totalEventsRead,
+                                       callbacks=evtCtx.callbacks,
+                                       bytesRead=+ reduce (for l in selectedLocations
+                                                             do eventFileBytes(tracePath, l))));
+
+    profiler.phase("close");
 
     OTF2_Reader_CloseGlobalEvtReader(reader, globalEvtReader);
     OTF2_Reader_CloseEvtFiles(reader);
@@ -697,10 +408,18 @@ module TraceToCSV {
     sw.stop();
     writeln("Total time: ", openTime + defReadTime + markTime + evtReadTime + closeTime, " seconds");
     // printCallGraphAndMetrics(evtCtx, true);
+    profiler.phase("write output");
     writeCallGraphsAndMetricsToCSV(evtCtx);
+
+    try {
+      profiler.finish();
+    } catch e {
+      writeln("Failed to write profile ", profile, ": ", e);
+    }
   }
 
-  proc callgraphToCSV(callGraph: shared CallGraph, group: string, thread: string, filename: string) {
+  proc callgraphToCSV(callGraph: shared CallGraph, const ref defCtx: DefinitionStore,
+                      group: string, thread: string, filename: string) {
     // Convert a CallGraph to a CSV file
     try {
       var outfile = open(filename, ioMode.cw);
@@ -708,18 +427,27 @@ module TraceToCSV {
 
       writer.writeln("Thread,Group,Depth,Name,Start Time,End Time,Duration");
 
-      const intervals = callGraph.getIntervalsBetween(-inf, inf);
-
-      for iv in intervals {
+      var enc = new csvRowEncoder();
+      const prefix = thread + "," + group + ",";
+      // Intervals come out in (start, end, depth) order, see Timeline
+      for iv in callGraph.intervalsInOrder() {
         const start = iv.start;
         const end = if iv.hasEnd then iv.end else inf;
         const duration = end - start;
-        const name = if iv.name != "" then iv.name else "Unknown";
-        const depth = iv.depth;
 
-        writer.writef("%s,%s,%i,\"%s\",%.15dr,%.15dr,%.15dr\n",
-                      thread, group, depth, name, start, end, duration);
+        enc.appendString(prefix);
+        enc.appendInt(iv.depth);
+        enc.comma();
+        enc.appendQuoted(defCtx.regionName(iv.region));
+        enc.comma();
+        enc.appendReal(start);
+        enc.comma();
+        enc.appendReal(end);
+        enc.comma();
+        enc.appendReal(duration);
+        enc.endRow(writer);
       }
+      enc.flush(writer);
 
       writer.close();
       outfile.close();
@@ -728,7 +456,9 @@ module TraceToCSV {
     }
   }
 
-  proc metricsToCSV(group: string, threadMetrics: map(string, list((real(64), OTF2_Type, OTF2_MetricValue))), filename: string) {
+  proc metricsToCSV(group: string, const ref groupMetrics: metricSeriesSet,
+                    const ref defCtx: DefinitionStore, crayTimeOffset: real(64),
+                    filename: string) {
     // Convert metrics to a CSV file
     // Note: In the Python version, metrics are stored as List[Tuple[float, float]] (time, value)
     try {
@@ -737,16 +467,26 @@ module TraceToCSV {
 
       writer.writeln("Group,Metric Name,Time,Value");
 
-      for (metricName, values) in threadMetrics.items() {
-        for (time, valueType, value) in values {
-          if valueType == OTF2_TYPE_INT64 then
-            writer.writef("%s,%s,%.15dr,%i\n", group, metricName, time, value.signed_int);
-          else if valueType == OTF2_TYPE_UINT64 then
-            writer.writef("%s,%s,%.15dr,%u\n", group, metricName, time, value.unsigned_int);
-          else if valueType == OTF2_TYPE_DOUBLE then
-            writer.writef("%s,%s,%.15dr,%.15dr\n", group, metricName, time, value.floating_point);
+      var enc = new csvRowEncoder();
+      for series in groupMetrics {
+        const ref metricName = defCtx.metricMember(series.member).name;
+        const prefix = group + "," + metricName + ",";
+        // Adjust for craypm metrics, as they are reported with a delay
+        const offset = if metricName.toLower().find("cray") >= 0 then crayTimeOffset else 0.0;
+        for (start, bits, _) in series.runs() {
+          enc.appendString(prefix);
+          enc.appendReal(timestampToSeconds(start, defCtx.clockProps) - offset);
+          enc.comma();
+          if series.valueType == OTF2_TYPE_INT64 then
+            enc.appendInt(bits: int(64));
+          else if series.valueType == OTF2_TYPE_UINT64 then
+            enc.appendUint(bits);
+          else
+            enc.appendReal(bits.transmute(real));
+          enc.endRow(writer);
         }
       }
+      enc.flush(writer);
 
       writer.close();
       outfile.close();
@@ -768,19 +508,20 @@ module TraceToCSV {
         const callGraph = try! threads[thread];
         const filename = group + "_" + thread.replace(" ", "_") + "_callgraph.csv";
         writeln("Writing to file: ", filename);
-        callgraphToCSV(callGraph, group, thread, filename);
+        callgraphToCSV(callGraph, evtCtx.defContext, group, thread, filename);
       }
     }
 
     // Write metrics to CSV files
-    forall (group, threadMetrics) in evtCtx.metrics.toArray() {
+    forall group in evtCtx.metrics.keysToArray() {
       if !evtCtx.evtArgs.processesToTrack.isEmpty() && !evtCtx.evtArgs.processesToTrack.contains(group) {
         writeln("Skipping group ", group, " as it is not in the processes to track.");
         continue;
       }
       const filename = group + "_metrics.csv";
       writeln("Writing to file: ", filename);
-      metricsToCSV(group, threadMetrics, filename);
+      metricsToCSV(group, try! evtCtx.metrics[group], evtCtx.defContext,
+                   evtCtx.evtArgs.crayTimeOffset, filename);
     }
     // }
   }
@@ -798,16 +539,12 @@ module TraceToCSV {
 
     writeln("\n--- Metrics Summary ---");
     var totalMetricsStored: int = 0;
-    for (locGroup, metricMap) in evtCtx.metrics.items() {
+    for locGroup in evtCtx.metrics.keys() {
       writeln("Location Group: ", locGroup);
-      for (metricName, values) in metricMap.items() {
-        write("  Metric: ", metricName, ", Count: ", values.size);
-        if values.size > 0 {
-          writeln(", First Value: ", values[0]);
-        } else {
-          writeln();
-        }
-        totalMetricsStored += values.size;
+      for series in try! evtCtx.metrics[locGroup] {
+        writeln("  Metric: ", evtCtx.defContext.metricMember(series.member).name,
+                ", Samples: ", series.numSamples, ", Runs: ", series.numRuns);
+        totalMetricsStored += series.numSamples;
       }
     }
     writeln("Total metrics stored: ", totalMetricsStored);
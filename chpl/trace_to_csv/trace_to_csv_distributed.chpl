@@ -0,0 +1,496 @@
+// Copyright Hewlett Packard Enterprise Development LP.
+
+/*
+ * Multi-locale OTF2 to CSV/Parquet converter
+ *
+ * Processes (location groups) are spread over the locales with the LPT
+ * bin-packing from LocationPartition, weighted by their event counts, so
+ * all threads of a process and its metrics file end up on one locale. Every
+ * locale reads the global definitions itself, reads its locations with
+ * here.maxTaskPar tasks like trace_to_csv_parallel, and writes its files
+ * directly: nothing but event counts is sent back to locale 0.
+ *
+ * Each locale writes to <outputDir>/locale<N>, so node-local or per-node
+ * scratch directories can be used; --sharedOutputDir writes all files to
+ * <outputDir> instead.
+ */
+module TraceToCSVDistributed {
+  use OTF2;
+  use Time;
+  use List;
+  use Map;
+  use IO;
+  use Path;
+  use FileSystem;
+  use ArgumentParser;
+  use DefinitionStore;
+  use LocationPartition;
+  use TraceToCSVCommon;
+  use PhaseProfiler;
+  use TraceCache;
+  import Math.inf;
+
+  var trace: string = "./traces.otf2";
+  var metrics: string = ""; // Empty string means track all metrics
+  var processes: string = ""; // Empty string means track all processes
+  var excludeMPI: bool = false;
+  var excludeHIP: bool = false;
+  var includeRegions: string = "";
+  var excludeRegions: string = "";
+  var start: real = -inf; // Time window in seconds, unbounded by default
+  var end: real = inf;
+  var globalReader: bool = false;
+  var sharedReader: bool = false;
+  var outputDir: string = ".";
+  var schedule: string = "dynamic";
+  var stream: bool = false;
+  var sortedStream: bool = false;
+  var format: string = "csv";
+  var profile: string = ""; // Profile JSON path, empty = no profile
+  var sharedOutputDir: bool = false;
+  var cache: bool = false;
+
+  proc main(programArgs: [] string) {
+    try {
+      var parser = new argumentParser(
+        addHelp=true // Automatically add --help flag
+      );
+
+      var traceArg = parser.addArgument(
+        name="trace",
+        defaultValue="./traces.otf2",
+        help="Path to the OTF2 trace file"
+      );
+
+      var metricsArg = parser.addOption(
+        name="metrics",
+        defaultValue="",
+        numArgs=1,
+        help="Metrics to track (comma-separated, empty = all)"
+      );
+
+      var processesArg = parser.addOption(
+        name="processes",
+        defaultValue="",
+        numArgs=1,
+        help="Processes to track (comma-separated, empty = all)"
+      );
+
+      var outputDirArg = parser.addOption(
+        name="outputDir",
+        defaultValue="./",
+        numArgs=1,
+        help="Directory to write output CSV files to"
+      );
+
+      var excludeMPIArg = parser.addFlag(
+        name="excludeMPI",
+        defaultValue=false,
+        numArgs=0,
+        help="Exclude MPI functions from the callgraph output"
+      );
+
+      var excludeHIPArg = parser.addFlag(
+        name="excludeHIP",
+        defaultValue=false,
+        numArgs=0,
+        help="Exclude HIP functions from the callgraph output"
+      );
+
+      var includeRegionsArg = parser.addOption(
+        name="includeRegions",
+        defaultValue="",
+        numArgs=1,
+        help="Only keep regions whose name matches this regex in the callgraph output"
+      );
+
+      var excludeRegionsArg = parser.addOption(
+        name="excludeRegions",
+        defaultValue="",
+        numArgs=1,
+        help="Exclude regions whose name matches this regex from the callgraph output"
+      );
+
+      var startArg = parser.addOption(
+        name="start",
+        defaultValue="",
+        numArgs=1,
+        help="Only extract events at or after this time in seconds (empty = trace start)"
+      );
+
+      var endArg = parser.addOption(
+        name="end",
+        defaultValue="",
+        numArgs=1,
+        help="Only extract events up to this time in seconds, reading stops there (empty = trace end)"
+      );
+
+      var globalReaderArg = parser.addFlag(
+        name="globalReader",
+        defaultValue=false,
+        numArgs=0,
+        help="Read through the global event reader, which merges all locations of a reader task into time order, instead of decoding each location on its own"
+      );
+
+      var sharedReaderArg = parser.addFlag(
+        name="sharedReader",
+        defaultValue=false,
+        numArgs=0,
+        help="Open the trace once per locale and let all reader tasks share it instead of opening it per task"
+      );
+
+      var streamArg = parser.addFlag(
+        name="stream",
+        defaultValue=false,
+        numArgs=0,
+        help="Write callgraph intervals to CSV as they close instead of after reading the whole trace (rows in leave order)"
+      );
+
+      var sortedStreamArg = parser.addFlag(
+        name="sortedStream",
+        defaultValue=false,
+        numArgs=0,
+        help="With --stream, merge each callgraph CSV back into (start, end, depth) order"
+      );
+
+      var formatArg = parser.addOption(
+        name="format",
+        defaultValue="csv",
+        numArgs=1,
+        help="Output file format: csv or parquet (typed, dictionary-encoded columns)"
+      );
+
+      var scheduleArg = parser.addOption(
+        name="schedule",
+        defaultValue="dynamic",
+        numArgs=1,
+        help="How a locale's locations are assigned to its reader tasks: static (event-count LPT bins) or dynamic (work queue)"
+      );
+
+      var sharedOutputDirArg = parser.addFlag(
+        name="sharedOutputDir",
+        defaultValue=false,
+        numArgs=0,
+        help="Write the files of all locales to outputDir instead of outputDir/locale<N>"
+      );
+
+      var cacheArg = parser.addFlag(
+        name="cache",
+        defaultValue=false,
+        numArgs=0,
+        help="Reuse the definitions and results kept in <trace>cache by an earlier run (written by trace_to_csv_parallel; this program only adds the definitions)"
+      );
+
+      var profileArg = parser.addOption(
+        name="profile",
+        defaultValue="",
+        numArgs=1,
+        help="Write phase timings and per-task reader counters as JSON to this file"
+      );
+
+      var logArg = parser.addOption(
+        name="log",
+        defaultValue="INFO",
+        numArgs=1,
+        help="Logging level (NONE, ERROR, WARN, INFO, DEBUG, TRACE)"
+      );
+
+      parser.parseArgs(programArgs);
+      trace = traceArg.value();
+      metrics = metricsArg.value();
+      processes = processesArg.value();
+      outputDir = outputDirArg.value();
+      schedule = scheduleArg.value();
+      if schedule != "static" && schedule != "dynamic" {
+        logError("Invalid schedule: ", schedule, ". Use one of: static, dynamic.");
+        exit(1);
+      }
+
+      format = formatArg.value();
+      if format != "csv" && format != "parquet" {
+        logError("Invalid format: ", format, ". Use one of: csv, parquet.");
+        exit(1);
+      }
+
+      sharedOutputDir = sharedOutputDirArg.valueAsBool();
+      profile = profileArg.value();
+      cache = cacheArg.valueAsBool();
+      excludeMPI = excludeMPIArg.valueAsBool();
+      excludeHIP = excludeHIPArg.valueAsBool();
+      includeRegions = includeRegionsArg.value();
+      excludeRegions = excludeRegionsArg.value();
+      try {
+        if startArg.value() != "" then start = startArg.value(): real;
+        if endArg.value() != "" then end = endArg.value(): real;
+      } catch e {
+        logError("Invalid time window: --start=", startArg.value(), " --end=", endArg.value());
+        exit(1);
+      }
+      if start > end {
+        logError("Invalid time window: start ", start, " is after end ", end);
+        exit(1);
+      }
+      globalReader = globalReaderArg.valueAsBool();
+      sharedReader = sharedReaderArg.valueAsBool();
+      if sharedReader && globalReader {
+        logError("--sharedReader reads each location on its own and cannot be combined with --globalReader");
+        exit(1);
+      }
+      sortedStream = sortedStreamArg.valueAsBool();
+      stream = streamArg.valueAsBool() || sortedStream;
+      if stream && format != "csv" {
+        logError("--stream only supports --format=csv");
+        exit(1);
+      }
+
+      try {
+        log = logArg.value(): LogLevel;
+      } catch e {
+        logError("Invalid log level: ", logArg.value(), ". Use one of: NONE, ERROR, WARN, INFO, DEBUG, or TRACE.");
+        exit(1);
+      }
+      if excludeMPI {
+        logInfo("Excluding MPI functions from callgraph output");
+      }
+      if excludeHIP {
+        logInfo("Excluding HIP functions from callgraph output");
+      }
+      if start > -inf || end < inf {
+        logInfo("Extracting events between ", start, " and ", end, " seconds");
+      }
+    } catch e {
+      logError("Error parsing arguments: ", e);
+      exit(1);
+    }
+
+    try {
+      if !exists(trace) { logError("Trace file does not exist: ", trace); exit(1); }
+    } catch e { logError("Error checking trace file existence: ", e); exit(1); }
+
+    try {
+      if !exists(outputDir) {
+        logInfo("Output directory does not exist, creating: ", outputDir);
+        mkdir(outputDir);
+      }
+    } catch e { logError("Error checking/creating output directory: ", e); exit(1); }
+
+    var sw: stopwatch;
+    var global_sw: stopwatch;
+    sw.start();
+    global_sw.start();
+    profiler.enable("trace_to_csv_distributed", profile);
+    profiler.phase("open");
+
+    // With --cache, a sidecar that still matches the archive replaces
+    // decoding the definitions and possibly the events
+    var traceCache: owned MappedTraceCache?;
+    var stamps: traceStamps;
+    if cache {
+      stamps = stampTrace(trace);
+      traceCache = openTraceCache(trace);
+      logInfo(if traceCache != nil then "Using trace cache " else "No valid trace cache at ",
+              cachePath(trace));
+    }
+
+    var defCtx: DefinitionStore;
+    if traceCache != nil {
+      profiler.phase("global definitions");
+      logInfo("Reading OTF2 trace ", trace, " on ", numLocales, " locales.");
+      defCtx = traceCache!.definitions();
+      logDebug("Read global definitions from ", cachePath(trace), " in ", sw.elapsed(), " seconds");
+      sw.clear();
+    } else {
+      var reader = OTF2_Reader_Open(trace.c_str());
+      if reader == nil {
+        logError("Failed to open trace");
+        exit(1);
+      }
+
+      const openTime = sw.elapsed();
+      logTrace("Time taken to open OTF2 archive: %.2dr seconds\n", openTime);
+      sw.clear(); // Restart stopwatch for next timing
+
+      profiler.phase("global definitions");
+      OTF2_Reader_SetSerialCollectiveCallbacks(reader);
+
+      var numberOfLocations: c_uint64 = 0;
+      OTF2_Reader_GetNumberOfLocations(reader, c_ptrTo(numberOfLocations));
+      logTrace("Number of locations: ", numberOfLocations);
+      logInfo("Reading OTF2 trace ", trace, " on ", numLocales, " locales.");
+
+      defCtx = new DefinitionStore();
+      const definitionsRead = readGlobalDefinitions(reader, defCtx);
+      logTrace("Global definitions read: ", definitionsRead);
+
+      const defReadTime = sw.elapsed();
+      logTrace("Time taken to read global definitions: %.2dr seconds\n", defReadTime);
+      sw.clear(); // Restart stopwatch for next timing
+
+      // Close the initial reader
+      OTF2_Reader_Close(reader);
+    }
+
+    // Parse metrics to track from config argument
+    var metricsToTrack: domain(string);
+    if metrics != "" {
+      var metricsArray = metrics.split(",");
+      for metric in metricsArray {
+        metricsToTrack += metric.strip();
+      }
+    }
+
+    // Parse processes to track from config argument
+    var processesToTrack: domain(string);
+    if processes != "" {
+      var processesArray = processes.split(",");
+      for process in processesArray {
+        processesToTrack += process.strip();
+      }
+    }
+
+    // Use the config const for crayTimeOffset
+    var evtArgs = new EvtCallbackArgs(processesToTrack=processesToTrack,
+                                      metricsToTrack=metricsToTrack,
+                                      trace=trace,
+                                      outputDir=outputDir,
+                                      format=format,
+                                      excludeMPI=excludeMPI,
+                                      excludeHIP=excludeHIP,
+                                      includeRegions=includeRegions,
+                                      excludeRegions=excludeRegions,
+                                      stream=stream,
+                                      sortedStream=sortedStream,
+                                      start=start,
+                                      end=end,
+                                      globalReader=globalReader,
+                                      log=log);
+
+    // Distribution: whole processes per locale, balanced by event count.
+    // Untracked processes are left out and never opened on any locale.
+    const selection = selectedLocations(defCtx, eventFilterFor(defCtx, evtArgs));
+    logInfo("Reading ", selection.size, " of ", defCtx.numLocations, " locations");
+    var groupIds: map(string, int);
+    var groupNames: list(string);
+    var groupLocations: list(list(OTF2_LocationRef));
+    var groupWeights: list(uint(64));
+    for l in selection {
+      const ref loc = defCtx.location(l);
+      if !groupIds.contains(loc.processName) {
+        groupIds.add(loc.processName, groupNames.size);
+        groupNames.pushBack(loc.processName);
+        groupLocations.pushBack(new list(OTF2_LocationRef));
+        groupWeights.pushBack(0);
+      }
+      const g = try! groupIds[loc.processName];
+      groupLocations[g].pushBack(l);
+      groupWeights[g] += loc.numberOfEvents;
+    }
+    // LPT works on any ids, here the group indices
+    const groupArray: [0..<groupNames.size] OTF2_LocationRef = [g in 0..<groupNames.size] g: OTF2_LocationRef;
+    const groupParts = lptPartition(groupArray, groupWeights.toArray(), numLocales);
+    logDebug("Distributed ", groupNames.size, " processes over ", numLocales, " locales");
+
+    // Results cached by a run with the same options skip the event files
+    const cachedResults = traceCache != nil && traceCache!.hasIntervals && !stream &&
+                          traceCache!.intervalsKey() == cacheKey(evtArgs);
+    if cache then stamps.stampEvents(trace, defCtx);
+
+    var totalEventsReadAcrossLocales: c_uint64 = 0;
+    // Each locale adds its own read, merge and output phases
+    profiler.phase("locales");
+    coforall l in Locales with (+ reduce totalEventsReadAcrossLocales) do on l {
+      var sw_locale: stopwatch;
+      sw_locale.start();
+      const profiling = profiler.enabled;
+
+      // This locale's locations, copied over once
+      var myLocationList: list(OTF2_LocationRef);
+      for g in groupParts[here.id] do
+        for loc in groupLocations[g: int] do myLocationList.pushBack(loc);
+      const myLocations = myLocationList.toArray();
+
+      // The sidecar is mapped on each locale that uses it, it may be missing
+      // where the trace directory is node-local
+      var localCache: owned MappedTraceCache?;
+      if traceCache != nil && here.id != 0 then localCache = openTraceCache(trace);
+      const myCache = if here.id == 0 then traceCache.borrow() else localCache.borrow();
+
+      // Definitions in this locale's memory, so the callbacks never go remote
+      var localDefs = if here.id == 0 then defCtx
+                        else if myCache != nil then myCache!.definitions()
+                        else loadGlobalDefinitions(trace);
+      const localDir = if sharedOutputDir then outputDir
+                       else joinPath(outputDir, "locale" + here.id: string);
+      const localArgs = evtArgs.withOutputDir(localDir);
+      try {
+        if !exists(localDir) then mkdir(localDir, parents=true);
+      } catch e {
+        logError("Error creating output directory ", localDir, ": ", e);
+        exit(1);
+      }
+
+      var merged: MergedResults;
+      var readTime, mergeTime: real;
+      if cachedResults && myCache != nil {
+        const myIndices = [loc in myLocations] localDefs.locationIndex(loc);
+        merged = loadCachedResults(myCache!, localDefs, myIndices);
+        readTime = sw_locale.elapsed();
+      } else {
+        const myWeights = [loc in myLocations] localDefs.location(loc).numberOfEvents;
+        const numberOfReaders = max(1, min(here.maxTaskPar, myLocations.size));
+        const filter = eventFilterFor(localDefs, localArgs);
+        // Streamed files are opened by the reader tasks, so their names are
+        // reserved up front: across all locales when they share a directory
+        if stream then
+          reserveCallGraphFiles(localDefs, localArgs, filter,
+                                if sharedOutputDir then selection else myLocations);
+        var evtContexts = [0..<numberOfReaders] new EvtCallbackContext(localArgs, localDefs, filter);
+        // One reader per locale for all its tasks with --sharedReader
+        var localReader: c_ptr(OTF2_Reader) = nil;
+        if sharedReader {
+          localReader = openSharedReader(trace);
+          if localReader == nil then
+            logError("Failed to open trace on locale ", here.id, ", opening it per task instead");
+        }
+        totalEventsReadAcrossLocales += readEventsWithTasks(myLocations, myWeights,
+                                                            evtContexts, schedule, localReader);
+        if localReader != nil then OTF2_Reader_Close(localReader);
+        readTime = sw_locale.elapsed();
+
+        merged = mergeEvtContexts(evtContexts, localDefs);
+        mergeTime = sw_locale.elapsed() - readTime;
+      }
+      writeCallGraphsAndMetricsToCSV(merged, localDefs, localArgs);
+      if profiling {
+        // Reading includes getting this locale's definitions
+        profiler.addPhase("read events", readTime);
+        profiler.addPhase("merge", mergeTime);
+        profiler.addPhase("write output", sw_locale.elapsed() - readTime - mergeTime);
+      }
+      logInfo("Locale ", here.id, ": read ", myLocations.size, " location(s) in ", readTime,
+              " seconds, wrote ", localDir, " in ", sw_locale.elapsed() - readTime, " seconds");
+    }
+
+    logDebug("Total events read: ", totalEventsReadAcrossLocales);
+
+    // Results stay on the locales that wrote them, so only the definitions
+    // are kept for the next run
+    if cache && traceCache == nil {
+      try {
+        var w = createTraceCacheWriter(trace, defCtx, stamps);
+        w.finish(nil);
+        logInfo("Wrote trace cache ", cachePath(trace));
+      } catch e {
+        logWarn("Error writing trace cache ", cachePath(trace), ": ", e);
+      }
+    }
+    logInfo("Finished converting trace in ", global_sw.elapsed(), " seconds");
+
+    try {
+      profiler.finish();
+      if profiler.enabled then logInfo("Wrote profile to ", profile);
+    } catch e {
+      logError("Error writing profile ", profile, ": ", e);
+    }
+  }
+}